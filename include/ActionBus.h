@@ -0,0 +1,136 @@
+#ifndef ACTION_BUS_H
+#define ACTION_BUS_H
+
+#include <boost/lockfree/spsc_queue.hpp>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Controllers, MIDI and the control socket that may feed one session
+#define ACTION_BUS_MAX_SOURCES 16
+
+// Messages each source may have in flight before its producer waits; small, so a flood from one controller
+// backs up at that controller instead of queueing seconds of edits
+#define ACTION_BUS_SOURCE_CAPACITY 16
+
+// Multi-producer, single-consumer queue from every input of a session to its consumer thread.
+//
+// Each producer registers as a source and gets a single-producer ring of its own, so pushes from different
+// threads never contend on a lock or on a shared index, and a stalled or flooding source cannot block the
+// others. Messages carry their source and a per-source sequence number. pop() drains the sources round-robin,
+// one message per source per turn, so every source is served within one message of each other source no
+// matter how fast it pushes.
+template <typename T, size_t SourceCapacity = ACTION_BUS_SOURCE_CAPACITY>
+class ActionBus {
+public:
+    struct Message {
+        T value;
+        uint16_t source = 0;
+        uint32_t sequence = 0;  // Counts from 0 per source, without gaps
+    };
+
+    struct SourceStatistics {
+        std::string name;
+        uint64_t n_pushed = 0;
+        uint64_t n_full = 0;     // Pushes refused because the source's ring was full
+        uint64_t n_popped = 0;
+    };
+
+    // Registers a producer and returns its source id, or -1 when ACTION_BUS_MAX_SOURCES are registered. Safe
+    // from any thread, alongside pushes and pops of the sources registered earlier.
+    int addSource(const std::string &name) {
+        std::lock_guard<std::mutex> lock(register_mtx);
+
+        size_t id = n_sources.load(std::memory_order_relaxed);
+        if (id >= ACTION_BUS_MAX_SOURCES) return -1;
+
+        sources[id].reset(new Source());
+        sources[id]->name = name;
+        n_sources.store(id + 1, std::memory_order_release);
+        return static_cast<int>(id);
+    }
+
+    // Producer of `source` (one thread at a time per source): false if its ring is full
+    bool push(int source, const T &value) {
+        Source &s = *sources[source];
+
+        Message message;
+        message.value = value;
+        message.source = static_cast<uint16_t>(source);
+        message.sequence = s.next_sequence;
+
+        if (!s.ring.push(message)) {
+            s.n_full.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        s.next_sequence++;
+        s.n_pushed.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer: the next message of the first source after the last one served that has any; false if all are empty
+    bool pop(Message &message) {
+        size_t count = n_sources.load(std::memory_order_acquire);
+
+        for (size_t i = 0; i < count; ++i) {
+            size_t id = (next_source + i) % count;
+            Source &s = *sources[id];
+
+            if (s.ring.pop(message)) {
+                s.n_popped.fetch_add(1, std::memory_order_relaxed);
+                next_source = (id + 1) % count;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t sourceCount() const {
+        return n_sources.load(std::memory_order_acquire);
+    }
+
+    std::vector<SourceStatistics> statistics() const {
+        std::vector<SourceStatistics> result;
+
+        size_t count = n_sources.load(std::memory_order_acquire);
+        for (size_t id = 0; id < count; ++id) {
+            const Source &s = *sources[id];
+
+            SourceStatistics stats;
+            stats.name = s.name;
+            stats.n_pushed = s.n_pushed.load(std::memory_order_relaxed);
+            stats.n_full = s.n_full.load(std::memory_order_relaxed);
+            stats.n_popped = s.n_popped.load(std::memory_order_relaxed);
+            result.push_back(stats);
+        }
+        return result;
+    }
+
+private:
+    // On cache lines of their own, so producers do not share one with each other or with the consumer
+    struct alignas(64) Source {
+        boost::lockfree::spsc_queue<Message, boost::lockfree::capacity<SourceCapacity>> ring;
+        std::string name;
+
+        // Producer
+        alignas(64) uint32_t next_sequence = 0;
+        std::atomic<uint64_t> n_pushed{0};
+        std::atomic<uint64_t> n_full{0};
+
+        // Consumer
+        alignas(64) std::atomic<uint64_t> n_popped{0};
+    };
+
+    std::unique_ptr<Source> sources[ACTION_BUS_MAX_SOURCES];
+    std::atomic<size_t> n_sources{0};
+    std::mutex register_mtx;
+
+    // Consumer: where the next round-robin turn starts
+    size_t next_source = 0;
+};
+
+#endif // ACTION_BUS_H
@@ -0,0 +1,179 @@
+#ifndef ALSA_MIDI_H
+#define ALSA_MIDI_H
+
+// Built with `make mac ALSA_MIDI=1` (Linux, needs libasound)
+#ifdef MIDI_USE_ALSA
+
+#include <alsa/asoundlib.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define ALSA_MIDI_CLIENT_NAME "drum-machine"
+#define ALSA_MIDI_CLOCK_CLIENT_NAME "drum-machine-clock"
+
+// One port of an ALSA sequencer client that other clients connect to, e.g. with `aconnect 20:0 drum-machine:0`
+// or with connect(). Input ports receive channel messages; output ports send to every subscriber.
+class AlsaMidiPort {
+public:
+    enum Direction {
+        INPUT,
+        OUTPUT,
+    };
+
+    AlsaMidiPort() {}
+
+    ~AlsaMidiPort() {
+        close();
+    }
+
+    AlsaMidiPort(const AlsaMidiPort &) = delete;
+    AlsaMidiPort &operator=(const AlsaMidiPort &) = delete;
+
+    bool open(const char *port_name, Direction direction, const char *client_name = ALSA_MIDI_CLIENT_NAME) {
+        close();
+
+        int err = snd_seq_open(&seq, "default", direction == INPUT ? SND_SEQ_OPEN_INPUT : SND_SEQ_OPEN_OUTPUT, SND_SEQ_NONBLOCK);
+        if (err < 0) {
+            std::cerr << "Error: cannot open the ALSA sequencer: " << snd_strerror(err) << "\n";
+            seq = nullptr;
+            return false;
+        }
+
+        snd_seq_set_client_name(seq, client_name);
+
+        unsigned int caps = direction == INPUT
+            ? SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE
+            : SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
+        port_id = snd_seq_create_simple_port(seq, port_name, caps, SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+        if (port_id < 0) {
+            std::cerr << "Error: cannot create MIDI port " << port_name << ": " << snd_strerror(port_id) << "\n";
+            close();
+            return false;
+        }
+
+        this->direction = direction;
+        int n_fds = snd_seq_poll_descriptors_count(seq, POLLIN);
+        poll_fds.resize(n_fds > 0 ? n_fds : 0);
+        if (!poll_fds.empty()) {
+            snd_seq_poll_descriptors(seq, poll_fds.data(), static_cast<unsigned int>(poll_fds.size()), POLLIN);
+        }
+
+        printf("MIDI %s port %d:%d (%s:%s)\n", direction == INPUT ? "input" : "output", snd_seq_client_id(seq), port_id,
+               client_name, port_name);
+        return true;
+    }
+
+    void close() {
+        if (!seq) return;
+
+        snd_seq_close(seq);
+        seq = nullptr;
+        port_id = -1;
+        poll_fds.clear();
+    }
+
+    bool isOpen() const {
+        return seq != nullptr;
+    }
+
+    // Subscribes the port to (input) or from (output) another client's port, given as "CLIENT:PORT" where the
+    // client may be a number or a name
+    bool connect(const std::string &address) {
+        if (!seq) return false;
+
+        snd_seq_addr_t addr;
+        int err = snd_seq_parse_address(seq, &addr, address.c_str());
+        if (err >= 0) {
+            err = direction == INPUT ? snd_seq_connect_from(seq, port_id, addr.client, addr.port)
+                                     : snd_seq_connect_to(seq, port_id, addr.client, addr.port);
+        }
+
+        if (err < 0) {
+            std::cerr << "Error: cannot connect MIDI port to " << address << ": " << snd_strerror(err) << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Waits up to `timeout_ms` for input, then calls handler(status, data1, data2) for every note and
+    // controller event that has arrived; false once the sequencer fails
+    template <typename Handler>
+    bool receive(int timeout_ms, Handler handler) {
+        if (!seq) return false;
+
+        if (!poll_fds.empty()) {
+            int ready = ::poll(poll_fds.data(), poll_fds.size(), timeout_ms);
+            if (ready < 0) return errno == EINTR;
+            if (ready == 0) return true;
+        }
+
+        while (true) {
+            snd_seq_event_t *event = nullptr;
+            int err = snd_seq_event_input(seq, &event);
+
+            // -ENOSPC: the kernel queue overflowed and events were lost, but the port still works
+            if (err == -EAGAIN || err == -ENOSPC) return true;
+            if (err < 0) {
+                std::cerr << "Error: MIDI input failed: " << snd_strerror(err) << "\n";
+                return false;
+            }
+            if (!event) continue;
+
+            switch (event->type) {
+                case SND_SEQ_EVENT_NOTEON:
+                    handler(static_cast<uint8_t>(0x90 | (event->data.note.channel & 0x0F)), event->data.note.note, event->data.note.velocity);
+                    break;
+                case SND_SEQ_EVENT_NOTEOFF:
+                    handler(static_cast<uint8_t>(0x80 | (event->data.note.channel & 0x0F)), event->data.note.note, event->data.note.velocity);
+                    break;
+                case SND_SEQ_EVENT_CONTROLLER:
+                    handler(static_cast<uint8_t>(0xB0 | (event->data.control.channel & 0x0F)),
+                            static_cast<uint8_t>(event->data.control.param & 0x7F), static_cast<uint8_t>(event->data.control.value & 0x7F));
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    // Output ports: sends a system real-time message (clock, start, continue, stop) or a song position to every
+    // subscriber right away, bypassing the sequencer's queues
+    bool send(uint8_t status, uint16_t song_position = 0) {
+        if (!seq) return false;
+
+        snd_seq_event_t event;
+        snd_seq_ev_clear(&event);
+        snd_seq_ev_set_source(&event, port_id);
+        snd_seq_ev_set_subs(&event);
+        snd_seq_ev_set_direct(&event);
+
+        switch (status) {
+            case 0xF8: event.type = SND_SEQ_EVENT_CLOCK; break;
+            case 0xFA: event.type = SND_SEQ_EVENT_START; break;
+            case 0xFB: event.type = SND_SEQ_EVENT_CONTINUE; break;
+            case 0xFC: event.type = SND_SEQ_EVENT_STOP; break;
+            case 0xF2:
+                event.type = SND_SEQ_EVENT_SONGPOS;
+                event.data.control.value = song_position;
+                break;
+            default:
+                return false;
+        }
+
+        return snd_seq_event_output_direct(seq, &event) >= 0;
+    }
+
+private:
+    snd_seq_t *seq = nullptr;
+    int port_id = -1;
+    Direction direction = INPUT;
+    std::vector<struct pollfd> poll_fds;
+};
+
+#endif // MIDI_USE_ALSA
+
+#endif // ALSA_MIDI_H
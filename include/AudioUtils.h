@@ -2,8 +2,226 @@
 #define AUDIO_UTILS_H
 
 #include <SFML/Audio.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <utility>
 #include <vector>
+#include <DrumMachineTrackData.h>
+
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_CHANNELS 2
+
+// Frames quieter than this (relative to full scale, about -60 dBFS) count as silence when trimming samples
+#define SAMPLE_SILENCE_THRESHOLD 0.001f
+
+typedef std::vector<sf::Int16> AudioStreamBuffer;
+typedef std::shared_ptr<const AudioStreamBuffer> SharedStreamBuffer;
+
+// A track's effect parameters in physical units (see effectSettings() in TrackEffects.h)
+struct EffectSettings {
+    uint8_t effects = 0;         // TrackEffect bits to process
+    float cutoff_hz = 20000.0f;
+    float resonance = 0.7071f;   // Filter Q
+    float drive = 1.0f;          // Saturator input gain
+    size_t delay_frames = 0;
+    float feedback = 0.0f;
+    float delay_mix = 0.0f;
+};
+
+// One track's cycle, looped by the stream on its own period
+struct TrackLoop {
+    track_id_t track_id;
+    SharedStreamBuffer buffer;
+    float gain;
+    uint64_t length_q32;  // Exact cycle length in 32.32 fixed point frames; the buffer holds its ceiling
+    EffectSettings live_effects;  // Applied by the stream as the loop plays
+};
+
+// What the stream plays for one state of the sequence: a single bar-length mix when every audible track
+// cycles once per bar, otherwise one independently wrapping loop per audible track (never an LCM-length mix)
+struct StreamMix {
+    SharedStreamBuffer mix;
+    std::vector<TrackLoop> track_loops;
+    float gain_reduction_db = 0.0f;  // Deepest master-limiter reduction applied when the bar-length mix was rendered
+
+    StreamMix(SharedStreamBuffer mix = nullptr) : mix(std::move(mix)) {}
+
+    bool isPolymetric() const {
+        return !track_loops.empty();
+    }
+};
+
+// Gain of each velocity level relative to the track volume; accents go above it
+const float VELOCITY_GAINS[VELOCITY_LEVELS] = {0.3f, 0.6f, 1.0f, 1.4f};
+
+// Every audible track enters the master bus at this fixed gain (-6 dB), however many tracks play; the master
+// limiter keeps the sum under full scale
+#define TRACK_BUS_GAIN 0.5f
+
+// Per-format conversion and saturation, so the mix kernels can be instantiated for int16 or float samples
+template <typename SampleT>
+struct SampleTraits;
+
+template <>
+struct SampleTraits<sf::Int16> {
+    static constexpr sf::Int16 fromInt16(sf::Int16 v) { return v; }
+    static constexpr sf::Int16 toInt16(sf::Int16 v) { return v; }
+    static constexpr float toUnit(sf::Int16 v) { return static_cast<float>(v) * (1.0f / 32767.0f); }
+    static constexpr sf::Int16 fromUnit(float v) { return saturate(v * 32767.0f); }
+
+    static constexpr sf::Int16 saturate(float v) {
+        return v > 32767.0f ? 32767 : (v < -32768.0f ? -32768 : static_cast<sf::Int16>(v));
+    }
+
+    // Sums of scaled samples do not depend on the order the hits were added in
+    static constexpr bool exact_sums = true;
+
+    // `v` scaled by `gain` and rounded half away from zero. The rounding is symmetric, so scaling by -gain gives
+    // exactly the negated term and subtracting a hit removes exactly what adding it added.
+    static constexpr int32_t scale(sf::Int16 v, float gain) {
+        return static_cast<int32_t>(static_cast<float>(v) * gain + (static_cast<float>(v) * gain < 0.0f ? -0.5f : 0.5f));
+    }
+
+    static constexpr sf::Int16 addSaturating(sf::Int16 out, int32_t term) {
+        return out + term > 32767 ? 32767 : (out + term < -32768 ? -32768 : static_cast<sf::Int16>(out + term));
+    }
+
+    // Only where the sum is known to stay in range; an overflow would wrap around
+    static constexpr sf::Int16 addUnclamped(sf::Int16 out, int32_t term) {
+        return static_cast<sf::Int16>(out + term);
+    }
+};
+
+template <>
+struct SampleTraits<float> {
+    static constexpr float fromInt16(sf::Int16 v) { return static_cast<float>(v) * (1.0f / 32768.0f); }
+    static constexpr sf::Int16 toInt16(float v) { return SampleTraits<sf::Int16>::saturate(v * 32768.0f); }
+    static constexpr float toUnit(float v) { return v; }
+    static constexpr float fromUnit(float v) { return v; }
+
+    static constexpr float saturate(float v) {
+        return v > 1.0f ? 1.0f : (v < -1.0f ? -1.0f : v);
+    }
+
+    // Float sums round differently in a different order, so removing a hit is only approximately exact
+    static constexpr bool exact_sums = false;
+    static constexpr float scale(float v, float gain) { return v * gain; }
+    static constexpr float addSaturating(float out, float term) { return saturate(out + term); }
+    static constexpr float addUnclamped(float out, float term) { return out + term; }
+};
+
+// Converts a mix in the engine's sample format into what the output stream plays
+const AudioStreamBuffer &toStreamBuffer(const AudioStreamBuffer &buffer) {
+    return buffer;
+}
+
+AudioStreamBuffer toStreamBuffer(AudioStreamBuffer &&buffer) {
+    return std::move(buffer);
+}
+
+template <typename SampleT>
+AudioStreamBuffer toStreamBuffer(const std::vector<SampleT> &buffer) {
+    AudioStreamBuffer out(buffer.size());
+    for (size_t i = 0; i < buffer.size(); ++i) {
+        out[i] = SampleTraits<SampleT>::toInt16(buffer[i]);
+    }
+    return out;
+}
+
+// Shares an immutable engine buffer with the output stream, converting only when the formats differ
+SharedStreamBuffer toSharedStreamBuffer(const SharedStreamBuffer &buffer) {
+    return buffer;
+}
+
+template <typename SampleT>
+SharedStreamBuffer toSharedStreamBuffer(const std::shared_ptr<const std::vector<SampleT>> &buffer) {
+    return std::make_shared<const AudioStreamBuffer>(toStreamBuffer(*buffer));
+}
+
+// Exact frame positions are kept in 32.32 fixed point, so rounding never accumulates across steps or bars
+const uint64_t Q32_ONE = 1ULL << 32;
+const uint64_t Q32_HALF = 1ULL << 31;
+const uint64_t Q32_FRACTION_MASK = Q32_ONE - 1;
+
+template <int NSteps>
+struct BasicLoopingStatistics {
+    bpm_t bpm;
+    uint8_t bpm_fraction;       // Hundredths of a BPM
+    uint8_t swing;              // Share of each pair of steps given to the first one, in percent (50 is straight)
+    int beat_interval_frames;   // Rounded
+    int bar_length_frames;      // Longest bar in frames; bars alternate between this and one frame less
+    int n_frames_subdivision;   // Rounded, for reporting only; steps are placed with stepFrame()
+    uint64_t bar_length_q32;    // Exact bar length in frames
+
+    static constexpr BasicLoopingStatistics fromTempo(bpm_t bpm, uint8_t bpm_fraction, uint8_t swing) {
+        BasicLoopingStatistics stats = {};
+        stats.bpm = bpm;
+        stats.bpm_fraction = bpm_fraction;
+        stats.swing = swing;
+
+        uint64_t centi_bpm = static_cast<uint64_t>(bpm) * 100 + bpm_fraction;
+        uint64_t frames_per_bar_numerator = (static_cast<uint64_t>(AUDIO_SAMPLE_RATE) * 60 * 4 * 100) << 32;
+        stats.bar_length_q32 = (frames_per_bar_numerator + centi_bpm / 2) / centi_bpm;
+
+        stats.beat_interval_frames = static_cast<int>((stats.bar_length_q32 / 4 + Q32_HALF) >> 32);
+        stats.bar_length_frames = static_cast<int>((stats.bar_length_q32 + Q32_FRACTION_MASK) >> 32);
+        stats.n_frames_subdivision = static_cast<int>((stats.bar_length_q32 / NSteps + Q32_HALF) >> 32);
+
+        return stats;
+    }
+
+    static constexpr BasicLoopingStatistics fromBPM(bpm_t bpm) {
+        return fromTempo(bpm, 0, 50);
+    }
+
+    // First frame of `step` on a grid of 1/division notes, rounded to the nearest frame. Odd steps are
+    // delayed by the swing amount (up to half a step at 75%).
+    constexpr int stepFrame(int step, int division = NSteps) const {
+        uint64_t step_q32 = bar_length_q32 / division;
+        uint64_t swing_q32 = (step & 1) ? step_q32 / 50 * (swing - 50) : 0;
+
+        return static_cast<int>((step * step_q32 + swing_q32 + Q32_HALF) >> 32);
+    }
+
+    // Exact length of `n_steps` steps of 1/division notes
+    constexpr uint64_t cycleLengthQ32(int n_steps, int division) const {
+        return bar_length_q32 * n_steps / division;
+    }
+};
+
+typedef BasicLoopingStatistics<N_TRACK_SUBDIVISIONS> LoopingStatistics;
+
+// Looping statistics for every supported tempo, computed at compile time
+template <int NSteps>
+struct LoopingStatisticsTable {
+    typedef BasicLoopingStatistics<NSteps> Stats;
+    typedef std::array<Stats, MAX_BPM - MIN_BPM + 1> Table;
+
+    static constexpr Table build() {
+        Table table = {};
+        for (int bpm = MIN_BPM; bpm <= MAX_BPM; ++bpm) {
+            table[bpm - MIN_BPM] = Stats::fromBPM(static_cast<bpm_t>(bpm));
+        }
+        return table;
+    }
+
+    static constexpr Table table = build();
+
+    // Tempos outside [MIN_BPM, MAX_BPM] are clamped to the nearest supported one
+    static constexpr const Stats &forBPM(bpm_t bpm) {
+        return table[(bpm < MIN_BPM ? MIN_BPM : (bpm > MAX_BPM ? MAX_BPM : bpm)) - MIN_BPM];
+    }
+
+    // Whole, straight tempos come from the table; fractional or swung ones are computed, which is just as cheap
+    static constexpr Stats forTempo(bpm_t bpm, uint8_t bpm_fraction, uint8_t swing) {
+        if (bpm_fraction == 0 && swing == 50) return forBPM(bpm);
+        return Stats::fromTempo(bpm < MIN_BPM ? MIN_BPM : (bpm > MAX_BPM ? MAX_BPM : bpm), bpm_fraction, swing);
+    }
+};
 
 void loadWavFile(const std::string& filename, std::vector<sf::Int16>& buffer, int& sampleRate, int& channels) {
     sf::SoundBuffer soundBuffer;
@@ -22,36 +240,159 @@ void loadWavFile(const std::string& filename, std::vector<sf::Int16>& buffer, in
               << sampleRate << " Hz, " << channels << " channels.\n";
 }
 
-void mixSample(std::vector<sf::Int16>& mix, const std::vector<sf::Int16>& sample, int start, float volume = 0.75f) {
-    for (size_t i = 0; i < sample.size(); i += 2) {
-        int mixIndexL = 2 * (start + i / 2);
-        int mixIndexR = 2 * (start + i / 2) + 1;
+// Non-silent span and loudness of an instrument sample, measured once when it is loaded. Levels are relative
+// to full scale (1.0).
+struct SampleAnalysis {
+    size_t start_frame = 0;
+    size_t end_frame = 0;  // One past the last non-silent frame
+    float peak = 0.0f;
+    float rms = 0.0f;
+
+    size_t activeFrames() const {
+        return end_frame - start_frame;
+    }
+};
+
+template <typename SampleT, int Channels>
+SampleAnalysis analyzeSample(const std::vector<SampleT>& sample) {
+    typedef SampleTraits<SampleT> Traits;
+
+    SampleAnalysis analysis;
+    size_t n_frames = sample.size() / Channels;
+    bool found = false;
+    double sum_squares = 0.0;
 
-        if (mixIndexR < mix.size()) {
-            mix[mixIndexL] += static_cast<sf::Int16>(sample[i] * volume);
-            mix[mixIndexR] += static_cast<sf::Int16>(sample[i + 1] * volume);
+    for (size_t f = 0; f < n_frames; ++f) {
+        float frame_peak = 0.0f;
+        for (int c = 0; c < Channels; ++c) {
+            float v = Traits::toUnit(sample[f * Channels + c]);
+            frame_peak = std::max(frame_peak, std::fabs(v));
+            sum_squares += static_cast<double>(v) * v;
+        }
 
-            // Prevent clipping
-            mix[mixIndexL] = std::max(static_cast<sf::Int16>(-32768), std::min(static_cast<sf::Int16>(32767), mix[mixIndexL]));
-            mix[mixIndexR] = std::max(static_cast<sf::Int16>(-32768), std::min(static_cast<sf::Int16>(32767), mix[mixIndexR]));
-        } else break;
+        analysis.peak = std::max(analysis.peak, frame_peak);
+
+        if (frame_peak >= SAMPLE_SILENCE_THRESHOLD) {
+            if (!found) analysis.start_frame = f;
+            analysis.end_frame = f + 1;
+            found = true;
+        }
+    }
+
+    if (n_frames > 0) {
+        analysis.rms = static_cast<float>(std::sqrt(sum_squares / (static_cast<double>(n_frames) * Channels)));
     }
+
+    return analysis;
 }
 
-void unmixSample(std::vector<sf::Int16>& mix, const std::vector<sf::Int16>& sample, int start, float volume = 0.75f) {
-    for (size_t i = 0; i < sample.size(); i += 2) {
-        int mixIndexL = 2 * (start + i / 2);
-        int mixIndexR = 2 * (start + i / 2) + 1;
+// Adds `n_frames` frames of `in` scaled by `gain` to `out`. The channel loop has a compile-time trip count so
+// it unrolls, and the frame loop has no bounds check. Each input sample is scaled and rounded on its own before
+// it is added, so for int16 samples a negative gain takes out exactly what the positive one put in, unless
+// the sum clipped in between. Sums saturate unless `Saturate` is false, which is only for callers that have
+// shown the sums cannot leave full scale.
+template <typename SampleT, int Channels, bool Saturate = true>
+void accumulateFrames(SampleT* out, const SampleT* in, size_t n_frames, float gain) {
+    typedef SampleTraits<SampleT> Traits;
 
-        if (mixIndexR < mix.size()) {
-            mix[mixIndexL] -= static_cast<sf::Int16>(sample[i] * volume);
-            mix[mixIndexR] -= static_cast<sf::Int16>(sample[i + 1] * volume);
+    for (size_t i = 0; i < n_frames * Channels; i += Channels) {
+        for (int c = 0; c < Channels; ++c) {
+            if (Saturate) {
+                out[i + c] = Traits::addSaturating(out[i + c], Traits::scale(in[i + c], gain));
+            } else {
+                out[i + c] = Traits::addUnclamped(out[i + c], Traits::scale(in[i + c], gain));
+            }
+        }
+    }
+}
 
-            // Prevent clipping
-            mix[mixIndexL] = std::max(static_cast<sf::Int16>(-32768), std::min(static_cast<sf::Int16>(32767), mix[mixIndexL]));
-            mix[mixIndexR] = std::max(static_cast<sf::Int16>(-32768), std::min(static_cast<sf::Int16>(32767), mix[mixIndexR]));
-        } else break;
+// Adds `n_sample_frames` frames of `sample` scaled by `gain` at frame `start` (a negative gain removes it).
+// `mix` is a loop, so the part of the sample that runs past its end wraps around to the start. The wrap points
+// are found up front and each contiguous segment goes through the branch-free kernel. Removal walks the same
+// segments, so for int16 samples it unwraps exactly, even where the sample overlaps its own tail, as long as no
+// sum clipped; float removal leaves rounding residue.
+template <typename SampleT, int Channels>
+void accumulateSample(
+    std::vector<SampleT>& mix,
+    const SampleT* sample,
+    size_t n_sample_frames,
+    int start,
+    float gain,
+    bool saturate = true
+) {
+    size_t mix_frames = mix.size() / Channels;
+    if (start < 0 || mix_frames == 0) return;
+
+    size_t position = static_cast<size_t>(start) % mix_frames;
+    size_t done = 0;
+
+    while (done < n_sample_frames) {
+        size_t n_frames = std::min(n_sample_frames - done, mix_frames - position);
+        SampleT* out = mix.data() + position * Channels;
+        if (saturate) {
+            accumulateFrames<SampleT, Channels, true>(out, sample + done * Channels, n_frames, gain);
+        } else {
+            accumulateFrames<SampleT, Channels, false>(out, sample + done * Channels, n_frames, gain);
+        }
+
+        done += n_frames;
+        position = 0;
     }
 }
 
-#endif
\ No newline at end of file
+template <typename SampleT, int Channels>
+void accumulateSample(std::vector<SampleT>& mix, const std::vector<SampleT>& sample, int start, float gain) {
+    accumulateSample<SampleT, Channels>(mix, sample.data(), sample.size() / Channels, start, gain);
+}
+
+// Mixes only the non-silent span of an analyzed sample; the span keeps its offset from the trigger
+template <typename SampleT, int Channels>
+void accumulateSample(
+    std::vector<SampleT>& mix,
+    const std::vector<SampleT>& sample,
+    const SampleAnalysis& analysis,
+    int start,
+    float gain,
+    bool saturate = true
+) {
+    const SampleT* span = sample.data() + analysis.start_frame * Channels;
+    accumulateSample<SampleT, Channels>(
+        mix, span, analysis.activeFrames(), start + static_cast<int>(analysis.start_frame), gain, saturate
+    );
+}
+
+template <typename SampleT = sf::Int16, int Channels = AUDIO_CHANNELS>
+void mixSample(std::vector<SampleT>& mix, const std::vector<SampleT>& sample, int start, float volume = 0.75f) {
+    accumulateSample<SampleT, Channels>(mix, sample, start, volume);
+}
+
+template <typename SampleT = sf::Int16, int Channels = AUDIO_CHANNELS>
+void unmixSample(std::vector<SampleT>& mix, const std::vector<SampleT>& sample, int start, float volume = 0.75f) {
+    accumulateSample<SampleT, Channels>(mix, sample, start, -volume);
+}
+
+template <typename SampleT = sf::Int16, int Channels = AUDIO_CHANNELS>
+void mixSample(
+    std::vector<SampleT>& mix,
+    const std::vector<SampleT>& sample,
+    const SampleAnalysis& analysis,
+    int start,
+    float volume,
+    bool saturate = true
+) {
+    accumulateSample<SampleT, Channels>(mix, sample, analysis, start, volume, saturate);
+}
+
+template <typename SampleT = sf::Int16, int Channels = AUDIO_CHANNELS>
+void unmixSample(
+    std::vector<SampleT>& mix,
+    const std::vector<SampleT>& sample,
+    const SampleAnalysis& analysis,
+    int start,
+    float volume,
+    bool saturate = true
+) {
+    accumulateSample<SampleT, Channels>(mix, sample, analysis, start, -volume, saturate);
+}
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef CONTROL_PROTOCOL_H
+#define CONTROL_PROTOCOL_H
+
+#include <DrumMachineState.h>
+#include <DrumMachineTrackData.h>
+#include <InstrumentLUT.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Text protocol of the control socket (audio_mix --control-socket PATH), one request per line. Every request is
+// answered with zero or more data lines and then a line starting with `ok` or `error`.
+//
+//   toggle TRACK STEP               step on or off          velocity TRACK STEP LEVEL     level 0-3
+//   mute TRACK                      mute on or off          instrument TRACK ID
+//   length TRACK STEPS/DIVISION     e.g. 7/8                pitch TRACK CENTS
+//   effect TRACK NAME=VALUE         cutoff, resonance, drive, delay, feedback, mix or live (a bit mask)
+//   bpm BPM                         whole BPM               groove HUNDREDTHS SWING       fractional BPM, swing
+//   clear                                                   snapshot HEX                  a whole sequence
+//   pattern ID                      select (at the next bar) pause                        pause or resume
+//   trigger TRACK VELOCITY          play a track once (1-127)
+//
+//   batch                           the edits up to `end` are applied together, with one render of the mix
+//   end
+//   state                           active pattern, tempo and the sequence's snapshot
+//   stats                           estimated latency percentiles, action count, inferred underruns
+//   subscribe                       from now on, `bar N` at every bar start and `swap LATENCY_MS` (estimated) at every mix swap
+//
+// Only sequence edits can be batched; pattern, pause and trigger always apply on their own.
+#define CONTROL_MAX_BATCH_ACTIONS 4096
+
+template <typename Sequence>
+class ControlProtocol {
+public:
+    typedef BasicTrackData<Sequence::n_steps> Track;
+
+    // Parses an action line into `action`; returns an error message, or an empty string on success
+    static std::string parseAction(const std::string &line, Action &action) {
+        std::istringstream words(line);
+        std::string keyword;
+        if (!(words >> keyword)) return "empty request";
+
+        if (keyword == "clear") {
+            action = Action::create_ClearAll();
+            return "";
+        }
+        if (keyword == "pause") {
+            action = Action::create_PauseToggle();
+            return "";
+        }
+
+        if (keyword == "bpm") {
+            long bpm;
+            if (!(words >> bpm) || bpm < MIN_BPM || bpm > MAX_BPM) return "bpm must be " + std::to_string(MIN_BPM) + "-" + std::to_string(MAX_BPM);
+            action = Action::create_BPMSelect(static_cast<bpm_t>(bpm));
+            return "";
+        }
+
+        if (keyword == "groove") {
+            long bpm_fraction, swing;
+            if (!(words >> bpm_fraction >> swing) || bpm_fraction < 0 || bpm_fraction > 255 || swing < 0 || swing > 255 ||
+                !Sequence::isValidGroove(static_cast<uint8_t>(bpm_fraction), static_cast<uint8_t>(swing))) {
+                return "groove needs hundredths of a BPM (0-99) and a swing (50-75)";
+            }
+            action = Action::create_GrooveSelect(static_cast<uint8_t>(bpm_fraction), static_cast<uint8_t>(swing));
+            return "";
+        }
+
+        if (keyword == "pattern") {
+            long pattern_id;
+            if (!(words >> pattern_id) || pattern_id < 0 || pattern_id >= N_PATTERNS) return "invalid pattern";
+            action = Action::create_SelectPattern(static_cast<pattern_id_t>(pattern_id));
+            return "";
+        }
+
+        if (keyword == "snapshot") {
+            std::string hex;
+            if (!(words >> hex) || !parseHex(hex, action)) {
+                return "snapshot must be " + std::to_string(2 * Sequence::serialized_size) + " hex digits";
+            }
+            action.type = Action::Type::SEQUENCE_SNAPSHOT;
+            return "";
+        }
+
+        // Everything else addresses a track
+        static const char *track_keywords[] = {"mute", "toggle", "velocity", "instrument", "length", "pitch", "effect", "trigger"};
+        if (std::find(std::begin(track_keywords), std::end(track_keywords), keyword) == std::end(track_keywords)) {
+            return "unknown request `" + keyword + "`";
+        }
+
+        long track_id;
+        if (!(words >> track_id) || track_id < 0 || track_id >= Sequence::n_tracks) return "invalid track";
+        track_id_t track = static_cast<track_id_t>(track_id);
+
+        if (keyword == "mute") {
+            action = Action::create_TrackMuteToggle(track);
+        } else if (keyword == "toggle") {
+            long step;
+            if (!(words >> step) || step < 0 || step >= Sequence::n_steps) return "invalid step";
+            action = Action::create_TrackBeatToggle(track, static_cast<unsigned char>(step));
+        } else if (keyword == "velocity") {
+            long step, level;
+            if (!(words >> step >> level) || step < 0 || step >= Sequence::n_steps || level < 0 || level >= VELOCITY_LEVELS) {
+                return "velocity needs a step and a level 0-" + std::to_string(VELOCITY_LEVELS - 1);
+            }
+            action = Action::create_StepVelocitySelect(track, static_cast<unsigned char>(step), static_cast<uint8_t>(level));
+        } else if (keyword == "instrument") {
+            long instrument_id;
+            if (!(words >> instrument_id) || instrument_id < 0 || instrument_id >= NUM_INSTRUMENTS) return "invalid instrument";
+            action = Action::create_ChangeTrackInstrumentID(track, static_cast<instrument_id_t>(instrument_id));
+        } else if (keyword == "length") {
+            std::string value;
+            int n_steps = 0, step_division = 0;
+            if (!(words >> value) || sscanf(value.c_str(), "%d/%d", &n_steps, &step_division) != 2 || n_steps < 0 ||
+                n_steps > 255 || step_division < 0 || step_division > 255 ||
+                !Track::isValidLength(static_cast<uint8_t>(n_steps), static_cast<uint8_t>(step_division))) {
+                return "invalid length";
+            }
+            action = Action::create_TrackLengthSelect(track, static_cast<uint8_t>(n_steps), static_cast<uint8_t>(step_division));
+        } else if (keyword == "pitch") {
+            long cents;
+            if (!(words >> cents) || cents < -MAX_PITCH_CENTS || cents > MAX_PITCH_CENTS) return "invalid pitch";
+            action = Action::create_TrackPitchSelect(track, static_cast<int16_t>(cents));
+        } else if (keyword == "effect") {
+            std::string value;
+            if (!(words >> value)) return "effect needs NAME=VALUE";
+
+            size_t equals = value.find('=');
+            int param = equals == std::string::npos ? -1 : effectParam(value.substr(0, equals));
+            long param_value = equals == std::string::npos ? -1 : atol(value.c_str() + equals + 1);
+            if (param < 0 || param_value < 0 || param_value > 255 ||
+                !Track::isValidEffectParam(static_cast<uint8_t>(param), static_cast<uint8_t>(param_value))) {
+                return "invalid effect `" + value + "`";
+            }
+            action = Action::create_TrackEffectSelect(track, static_cast<uint8_t>(param), static_cast<uint8_t>(param_value));
+        } else if (keyword == "trigger") {
+            long velocity;
+            if (!(words >> velocity) || velocity < 1 || velocity > 127) return "trigger needs a velocity 1-127";
+            action = Action::create_LiveTrigger(track, static_cast<uint8_t>(velocity));
+        }
+
+        return "";
+    }
+
+    // Edits of the active pattern's sequence, which a batch applies together
+    static bool isBatchable(const Action &action) {
+        switch (action.type) {
+            case Action::Type::SELECT_PATTERN:
+            case Action::Type::PAUSE_TOGGLE:
+            case Action::Type::LIVE_TRIGGER:
+            case Action::Type::INSTRUMENT_SAMPLE:
+            case Action::Type::TRACK_SELECT:
+            case Action::Type::NOOP:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+    static std::string toHex(const Sequence &sequence_data) {
+        unsigned char snapshot[Sequence::serialized_size];
+        sequence_data.serialize(snapshot);
+
+        std::string hex;
+        char digits[3];
+        for (unsigned char byte : snapshot) {
+            snprintf(digits, sizeof(digits), "%02x", byte);
+            hex += digits;
+        }
+        return hex;
+    }
+
+private:
+    static int effectParam(const std::string &name) {
+        static const char *names[N_EFFECT_PARAMS] = {"cutoff", "resonance", "drive", "delay", "feedback", "mix"};
+
+        if (name == "live") return EFFECT_PARAM_LIVE;
+        for (int p = 0; p < N_EFFECT_PARAMS; ++p) {
+            if (name == names[p]) return p;
+        }
+        return -1;
+    }
+
+    static bool parseHex(const std::string &hex, Action &action) {
+        if (hex.size() != 2u * Sequence::serialized_size) return false;
+
+        for (size_t i = 0; i < Sequence::serialized_size; ++i) {
+            char digits[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+            char *end = nullptr;
+            action.data.snapshot[i] = static_cast<unsigned char>(strtoul(digits, &end, 16));
+            if (end != digits + 2) return false;
+        }
+        return true;
+    }
+};
+
+#endif // CONTROL_PROTOCOL_H
@@ -10,6 +10,7 @@ class DrumMachineLEDs {
 public:
     DrumMachineLEDs(Adafruit_NeoPixel strip_beat, Adafruit_NeoPixel strip_track) : strip_beat(strip_beat), strip_track(strip_track) {
         ACTIVE_BEAT_IDX_COLOR = strip_beat.Color(0, 128, 255);
+        ACCENT_BEAT_IDX_COLOR = strip_beat.Color(255, 255, 255);
 
         INACTIVE_BEAT_IDX_COLORS[0] = strip_beat.Color(255, 0, 0);
         INACTIVE_BEAT_IDX_COLORS[1] = strip_beat.Color(255, 165, 0);
@@ -33,16 +34,21 @@ public:
         strip_beat.clear();
         
         // Light up the active track
-        TrackData track = sequence_data.tracks[active_track_id];
-
-        for (int j = 0; j < N_TRACK_SUBDIVISIONS; ++j) {
-            if (track.triggers[j]) {
-                strip_beat.setPixelColor(j, ACTIVE_BEAT_IDX_COLOR);
-            } else {
-                strip_beat.setPixelColor(j, INACTIVE_BEAT_IDX_COLORS[j % 4]);
-            }
+        const TrackData &track = sequence_data.tracks[active_track_id];
+
+        // Steps past the track's cycle length stay dark
+        for (int j = 0; j < track.n_steps; ++j) {
+            strip_beat.setPixelColor(j, INACTIVE_BEAT_IDX_COLORS[j % 4]);
         }
 
+        forEachStep(track.activeTriggers(), [this](uint8_t j) {
+            strip_beat.setPixelColor(j, ACTIVE_BEAT_IDX_COLOR);
+        });
+
+        forEachStep(track.triggersAtVelocity(VELOCITY_ACCENT), [this](uint8_t j) {
+            strip_beat.setPixelColor(j, ACCENT_BEAT_IDX_COLOR);
+        });
+
         strip_beat.show();
 
         // Light up the active track
@@ -58,6 +64,7 @@ private:
     Adafruit_NeoPixel strip_track;
 
     uint32_t ACTIVE_BEAT_IDX_COLOR;
+    uint32_t ACCENT_BEAT_IDX_COLOR;
     uint32_t INACTIVE_BEAT_IDX_COLORS[4];
 
     uint32_t ACTIVE_TRACK_IDX_COLOR;
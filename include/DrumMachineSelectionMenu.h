@@ -6,15 +6,13 @@
 #include <InstrumentLUT.h>
 #include <LiquidCrystal_I2C.h>
 #include <Wire.h>
+#include <DrumMachineTrackData.h>
 
 #define MENU_BUTTON_DEBOUNCE_MS 25
 
 const byte SELECTOR_ICON = byte(0x7E);
 const byte SELECTED_ICON = byte(33);
 
-const int MAX_BPM = 250;
-const int MIN_BPM = 30;
-
 class DrumMachineSelectionMenu {
 public:
     enum Page { CATEGORY_SELECTION, INSTRUMENT_SELECTION, BPM_SELECTION };
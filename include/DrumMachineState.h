@@ -2,6 +2,7 @@
 #define DRUM_MACHINE_STATE_H
 
 #include <Messaging.h>
+#include <DrumMachineTrackData.h>
 
 struct Action {
     enum Type {
@@ -14,6 +15,14 @@ struct Action {
         BPM_SELECT = 6,
         CHANGE_TRACK_INSTRUMENT_ID = 7,
         CLEAR_ALL = 8,
+        SEQUENCE_SNAPSHOT = 9,
+        SELECT_PATTERN = 10,
+        TRACK_LENGTH_SELECT = 11,
+        GROOVE_SELECT = 12,
+        TRACK_PITCH_SELECT = 13,
+        STEP_VELOCITY_SELECT = 14,
+        TRACK_EFFECT_SELECT = 15,
+        LIVE_TRIGGER = 16,  // Host only (MIDI): plays a track's instrument once, over the loop
     };
     Type type;
 
@@ -30,6 +39,38 @@ struct Action {
         track_id_t new_curr_track_id;
         instrument_id_t sample_instrument_id;
         bpm_t new_bpm;
+        pattern_id_t new_pattern_id;
+        struct {
+            track_id_t length_track_id;
+            uint8_t new_n_steps;
+            uint8_t new_step_division;
+        };
+        struct {
+            uint8_t new_bpm_fraction;
+            uint8_t new_swing;
+        };
+        struct {
+            track_id_t pitch_track_id;
+            int16_t new_pitch_cents;
+        };
+        struct {
+            track_id_t velocity_track_id;
+            unsigned char velocity_step_id;
+            uint8_t new_velocity;
+        };
+        struct {
+            track_id_t effect_track_id;
+            uint8_t effect_param;
+            uint8_t new_effect_value;
+        };
+        struct {
+            track_id_t trigger_track_id;
+            uint8_t trigger_velocity;  // 1-127, as in MIDI
+        };
+#ifndef ARDUINO
+        // Only the host decodes snapshots into actions; the firmware sends them straight from its state
+        unsigned char snapshot[SequenceData::serialized_size];
+#endif
     } data;
 
     static Action create_TrackBeatToggle(track_id_t track_id, unsigned char toggled_beat_id) {
@@ -96,7 +137,147 @@ struct Action {
         return action;
     }
 
-    static Action fromSerialized(MessageType &msg_type, const unsigned char *buffer) {
+    static Action create_SelectPattern(pattern_id_t pattern_id) {
+        Action action;
+        action.type = SELECT_PATTERN;
+        action.data.new_pattern_id = pattern_id;
+
+        return action;
+    }
+
+    static Action create_TrackLengthSelect(track_id_t track_id, uint8_t n_steps, uint8_t step_division) {
+        Action action;
+        action.type = TRACK_LENGTH_SELECT;
+        action.data.length_track_id = track_id;
+        action.data.new_n_steps = n_steps;
+        action.data.new_step_division = step_division;
+
+        return action;
+    }
+
+    static Action create_GrooveSelect(uint8_t bpm_fraction, uint8_t swing) {
+        Action action;
+        action.type = GROOVE_SELECT;
+        action.data.new_bpm_fraction = bpm_fraction;
+        action.data.new_swing = swing;
+
+        return action;
+    }
+
+    static Action create_TrackPitchSelect(track_id_t track_id, int16_t pitch_cents) {
+        Action action;
+        action.type = TRACK_PITCH_SELECT;
+        action.data.pitch_track_id = track_id;
+        action.data.new_pitch_cents = pitch_cents;
+
+        return action;
+    }
+
+    static Action create_StepVelocitySelect(track_id_t track_id, unsigned char step_id, uint8_t velocity) {
+        Action action;
+        action.type = STEP_VELOCITY_SELECT;
+        action.data.velocity_track_id = track_id;
+        action.data.velocity_step_id = step_id;
+        action.data.new_velocity = velocity;
+
+        return action;
+    }
+
+    static Action create_TrackEffectSelect(track_id_t track_id, uint8_t param, uint8_t value) {
+        Action action;
+        action.type = TRACK_EFFECT_SELECT;
+        action.data.effect_track_id = track_id;
+        action.data.effect_param = param;
+        action.data.new_effect_value = value;
+
+        return action;
+    }
+
+    static Action create_LiveTrigger(track_id_t track_id, uint8_t velocity) {
+        Action action;
+        action.type = LIVE_TRIGGER;
+        action.data.trigger_track_id = track_id;
+        action.data.trigger_velocity = velocity;
+
+        return action;
+    }
+
+#ifndef ARDUINO
+    static Action create_SequenceSnapshot(const unsigned char *buffer) {
+        Action action;
+        action.type = SEQUENCE_SNAPSHOT;
+        memcpy(action.data.snapshot, buffer, SequenceData::serialized_size);
+
+        return action;
+    }
+#endif
+
+    // Payload bytes a message of `msg_type` carries, or -1 for types that are not decoded into actions
+    static int16_t payloadSize(MessageType msg_type) {
+        switch (msg_type) {
+            case MSG_TYPE_PAUSE_PLAY:
+            case MSG_TYPE_CLEAR_ALL:
+                return 0;
+            case MSG_TYPE_MUTE_TRACK:
+            case MSG_TYPE_SAMPLE:
+            case MSG_TYPE_BPM_SELECT:
+            case MSG_TYPE_SELECT_PATTERN:
+                return 1;
+            case MSG_TYPE_SEQUENCE_DATA:
+            case MSG_TYPE_CHANGE_TRACK_INSTRUMENT_ID:
+            case MSG_TYPE_GROOVE:
+                return 2;
+            case MSG_TYPE_TRACK_LENGTH:
+            case MSG_TYPE_TRACK_PITCH:
+            case MSG_TYPE_STEP_VELOCITY:
+            case MSG_TYPE_TRACK_EFFECT:
+                return 3;
+            case MSG_TYPE_SEQUENCE_SNAPSHOT:
+                return SequenceData::serialized_size;
+            default:
+                return -1;
+        }
+    }
+
+    // True for messages whose first payload byte is a track id
+    static bool addressesTrack(MessageType msg_type) {
+        switch (msg_type) {
+            case MSG_TYPE_SEQUENCE_DATA:
+            case MSG_TYPE_MUTE_TRACK:
+            case MSG_TYPE_CHANGE_TRACK_INSTRUMENT_ID:
+            case MSG_TYPE_TRACK_LENGTH:
+            case MSG_TYPE_TRACK_PITCH:
+            case MSG_TYPE_STEP_VELOCITY:
+            case MSG_TYPE_TRACK_EFFECT:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Decodes a message received with `payload_size` bytes in `buffer`. Messages whose payload is not exactly
+    // the size of their type (truncated frames, snapshots from a build of another shape) decode to NOOP, so
+    // nothing is read past the payload. So do messages addressing a track or step that has no storage, as
+    // receivers index their tracks and steps with the ids as they are.
+    static Action fromSerialized(MessageType &msg_type, const unsigned char *buffer, size_t payload_size) {
+        if (payloadSize(msg_type) < 0 || payload_size != static_cast<size_t>(payloadSize(msg_type))) {
+            return Action{ .type = NOOP };
+        }
+
+        if (addressesTrack(msg_type) && buffer[0] >= N_TRACKS) {
+            return Action{ .type = NOOP };
+        }
+
+        if (msg_type == MSG_TYPE_SELECT_PATTERN && buffer[0] >= N_PATTERNS) {
+            return Action{ .type = NOOP };
+        }
+
+        // Steps past a track's length are stored too (they return when it grows), so any stored step is valid
+        bool addresses_step = msg_type == MSG_TYPE_SEQUENCE_DATA || msg_type == MSG_TYPE_STEP_VELOCITY;
+        if (addresses_step && buffer[1] >= N_TRACK_SUBDIVISIONS) {
+            return Action{ .type = NOOP };
+        }
+
         switch (msg_type) {
             case MSG_TYPE_SEQUENCE_DATA: {
                 track_id_t track_id = buffer[0];
@@ -138,6 +319,56 @@ struct Action {
                 return create_ClearAll();
             }
 
+            case MSG_TYPE_SELECT_PATTERN: {
+                pattern_id_t pattern_id = buffer[0];
+
+                return create_SelectPattern(pattern_id);
+            }
+
+            case MSG_TYPE_TRACK_LENGTH: {
+                track_id_t track_id = buffer[0];
+                uint8_t n_steps = buffer[1];
+                uint8_t step_division = buffer[2];
+
+                return create_TrackLengthSelect(track_id, n_steps, step_division);
+            }
+
+            case MSG_TYPE_GROOVE: {
+                uint8_t bpm_fraction = buffer[0];
+                uint8_t swing = buffer[1];
+
+                return create_GrooveSelect(bpm_fraction, swing);
+            }
+
+            case MSG_TYPE_TRACK_PITCH: {
+                track_id_t track_id = buffer[0];
+                int16_t pitch_cents = static_cast<int16_t>(buffer[1] | (static_cast<uint16_t>(buffer[2]) << 8));
+
+                return create_TrackPitchSelect(track_id, pitch_cents);
+            }
+
+            case MSG_TYPE_STEP_VELOCITY: {
+                track_id_t track_id = buffer[0];
+                unsigned char step_id = buffer[1];
+                uint8_t velocity = buffer[2];
+
+                return create_StepVelocitySelect(track_id, step_id, velocity);
+            }
+
+            case MSG_TYPE_TRACK_EFFECT: {
+                track_id_t track_id = buffer[0];
+                uint8_t param = buffer[1];
+                uint8_t value = buffer[2];
+
+                return create_TrackEffectSelect(track_id, param, value);
+            }
+
+#ifndef ARDUINO
+            case MSG_TYPE_SEQUENCE_SNAPSHOT: {
+                return create_SequenceSnapshot(buffer);
+            }
+#endif
+
             default:
                 return Action{ .type = NOOP };
         }
@@ -164,6 +395,26 @@ public:
         action_queue.push(&action);
     }
 
+    // Sends the whole sequence in one message so the host can rebuild its state from scratch
+    void sendSnapshot() {
+        static_assert(SequenceData::serialized_size <= 255, "A snapshot must fit in one message");
+
+        unsigned char msg[SequenceData::serialized_size];
+        uint8_t size = sequence_data.serialize(msg);
+        sendMessage(msg, size, MSG_TYPE_SEQUENCE_SNAPSHOT);
+    }
+
+    // A board that reconnected (and reset) is sent the sequence the host is playing; applying it and sending it
+    // back as a snapshot confirms the resync
+    void receiveFromHost() {
+        if (!host_reader.poll()) return;
+
+        if (host_reader.type() == MSG_TYPE_SEQUENCE_SNAPSHOT && host_reader.size() == SequenceData::serialized_size) {
+            sequence_data.deserialize(host_reader.payload());
+            sendSnapshot();
+        }
+    }
+
     void sendActionOverSerial(Action action) {
         switch (action.type) {
             case Action::Type::TRACK_BEAT_TOGGLE: {
@@ -209,6 +460,59 @@ public:
 
             case Action::Type::CLEAR_ALL: {
                 sendMessage(NULL, 0, MSG_TYPE_CLEAR_ALL);
+
+                break;
+            }
+
+            case Action::Type::SELECT_PATTERN: {
+                unsigned char msg[1] = {action.data.new_pattern_id};
+                sendMessage(msg, 1, MSG_TYPE_SELECT_PATTERN);
+
+                break;
+            }
+
+            case Action::Type::TRACK_LENGTH_SELECT: {
+                unsigned char msg[3] = {
+                    action.data.length_track_id, action.data.new_n_steps, action.data.new_step_division
+                };
+                sendMessage(msg, 3, MSG_TYPE_TRACK_LENGTH);
+
+                break;
+            }
+
+            case Action::Type::GROOVE_SELECT: {
+                unsigned char msg[2] = {action.data.new_bpm_fraction, action.data.new_swing};
+                sendMessage(msg, 2, MSG_TYPE_GROOVE);
+
+                break;
+            }
+
+            case Action::Type::TRACK_PITCH_SELECT: {
+                uint16_t pitch = static_cast<uint16_t>(action.data.new_pitch_cents);
+                unsigned char msg[3] = {
+                    action.data.pitch_track_id, static_cast<unsigned char>(pitch), static_cast<unsigned char>(pitch >> 8)
+                };
+                sendMessage(msg, 3, MSG_TYPE_TRACK_PITCH);
+
+                break;
+            }
+
+            case Action::Type::STEP_VELOCITY_SELECT: {
+                unsigned char msg[3] = {
+                    action.data.velocity_track_id, action.data.velocity_step_id, action.data.new_velocity
+                };
+                sendMessage(msg, 3, MSG_TYPE_STEP_VELOCITY);
+
+                break;
+            }
+
+            case Action::Type::TRACK_EFFECT_SELECT: {
+                unsigned char msg[3] = {
+                    action.data.effect_track_id, action.data.effect_param, action.data.new_effect_value
+                };
+                sendMessage(msg, 3, MSG_TYPE_TRACK_EFFECT);
+
+                break;
             }
 
             default:
@@ -217,6 +521,8 @@ public:
     }
 
     void loop() {
+        receiveFromHost();
+
         // Pop all actions from the queue
         while (!action_queue.isEmpty()) {
             Action action;
@@ -227,9 +533,7 @@ public:
                     track_id_t track_id = action.data.toggle_beat_track_id;
                     unsigned char beat_idx = action.data.toggled_beat_id;
 
-                    TrackData &track = sequence_data.tracks[track_id];
-                    track.triggers[beat_idx] = !track.triggers[beat_idx];
-                    track.n_active_triggers += track.triggers[beat_idx] ? 1 : -1;
+                    sequence_data.tracks[track_id].toggleTrigger(beat_idx);
 
                     break;
                 }
@@ -260,6 +564,51 @@ public:
                     break;
                 }
 
+                case Action::Type::TRACK_LENGTH_SELECT: {
+                    if (!TrackData::isValidLength(action.data.new_n_steps, action.data.new_step_division)) break;
+
+                    TrackData &track = sequence_data.tracks[action.data.length_track_id];
+                    track.n_steps = action.data.new_n_steps;
+                    track.step_division = action.data.new_step_division;
+
+                    break;
+                }
+
+                case Action::Type::GROOVE_SELECT: {
+                    if (!SequenceData::isValidGroove(action.data.new_bpm_fraction, action.data.new_swing)) break;
+
+                    sequence_data.bpm_fraction = action.data.new_bpm_fraction;
+                    sequence_data.swing = action.data.new_swing;
+
+                    break;
+                }
+
+                case Action::Type::TRACK_PITCH_SELECT: {
+                    if (!TrackData::isValidPitch(action.data.new_pitch_cents)) break;
+
+                    sequence_data.tracks[action.data.pitch_track_id].pitch_cents = action.data.new_pitch_cents;
+
+                    break;
+                }
+
+                case Action::Type::STEP_VELOCITY_SELECT: {
+                    if (action.data.velocity_step_id >= N_TRACK_SUBDIVISIONS || action.data.new_velocity >= VELOCITY_LEVELS) break;
+
+                    TrackData &track = sequence_data.tracks[action.data.velocity_track_id];
+                    track.setVelocity(action.data.velocity_step_id, action.data.new_velocity);
+
+                    break;
+                }
+
+                case Action::Type::TRACK_EFFECT_SELECT: {
+                    if (!TrackData::isValidEffectParam(action.data.effect_param, action.data.new_effect_value)) break;
+
+                    TrackData &track = sequence_data.tracks[action.data.effect_track_id];
+                    track.setEffectParam(action.data.effect_param, action.data.new_effect_value);
+
+                    break;
+                }
+
                 case Action::Type::CLEAR_ALL: {
                     sequence_data.reset();
                     curr_track_id = 0;
@@ -277,6 +626,7 @@ public:
 
 private:
     cppQueue action_queue = cppQueue(sizeof(Action), 10, IMPLEMENTATION);
+    MessageReader<SequenceData::serialized_size> host_reader;
 };
 
 #endif // DRUM_MACHINE_STATE_H
@@ -9,59 +9,363 @@
 #include <cstring>  // For memcpy
 #endif
 
+// The firmware always uses the defaults; host builds may override them (see the `large` make target)
+#ifndef N_TRACK_SUBDIVISIONS
 #define N_TRACK_SUBDIVISIONS 16
+#endif
+
+#ifndef N_TRACKS
 #define N_TRACKS 5
+#endif
+
+// Patterns a host keeps; pattern ids from any input must be below it
+#define N_PATTERNS 16
+
+const int MAX_BPM = 250;
+const int MIN_BPM = 30;
+
+// Finest note value a track's steps can have (1/64 notes)
+const int MAX_STEP_DIVISION = 64;
+
+// Per-track pitch range, in cents (two octaves either way)
+const int MAX_PITCH_CENTS = 2400;
+
+// Per-step velocity: 0 ghost, 1 soft, 2 normal (new hits), 3 accent
+const uint8_t VELOCITY_LEVELS = 4;
+const uint8_t VELOCITY_NORMAL = 2;
+const uint8_t VELOCITY_ACCENT = 3;
+
+// Swing is the share of each pair of steps given to the first one, in percent; 50 is straight
+const int MIN_SWING = 50;
+const int MAX_SWING = 75;
+
+// Per-track insert effects, in processing order; each is one bit of a track's effect masks
+enum TrackEffect {
+    TRACK_EFFECT_FILTER = 0,
+    TRACK_EFFECT_DRIVE = 1,
+    TRACK_EFFECT_DELAY = 2,
+    N_TRACK_EFFECTS = 3
+};
+
+// Effect parameters, each 0-127 like a MIDI controller (mappings in TrackEffects.h). EFFECT_PARAM_LIVE is not
+// stored with them: it sets the mask of effects applied live in the stream instead of into the stem.
+enum EffectParam {
+    EFFECT_FILTER_CUTOFF = 0,     // Low-pass cutoff, 127 leaves the filter open
+    EFFECT_FILTER_RESONANCE = 1,
+    EFFECT_DRIVE = 2,             // Saturator input gain, 0 is clean
+    EFFECT_DELAY_TIME = 3,        // Echo time in 1/16 notes, 0 turns the delay off
+    EFFECT_DELAY_FEEDBACK = 4,
+    EFFECT_DELAY_MIX = 5,
+    N_EFFECT_PARAMS = 6,
+    EFFECT_PARAM_LIVE = N_EFFECT_PARAMS
+};
+
+const uint8_t EFFECT_PARAM_MAX = 127;
+const uint8_t MAX_DELAY_SIXTEENTHS = 16;
 
 typedef unsigned char instrument_id_t;
 typedef unsigned char bpm_t;
 typedef unsigned char track_id_t;
+typedef unsigned char pattern_id_t;
+
+// Smallest unsigned integer holding one bit per step (no <type_traits> on the Uno)
+template <uint8_t NSteps, bool Fits8 = (NSteps <= 8), bool Fits16 = (NSteps <= 16), bool Fits32 = (NSteps <= 32)>
+struct StepMask { typedef uint64_t type; };
+
+template <uint8_t NSteps, bool Fits16, bool Fits32>
+struct StepMask<NSteps, true, Fits16, Fits32> { typedef uint8_t type; };
+
+template <uint8_t NSteps, bool Fits32>
+struct StepMask<NSteps, false, true, Fits32> { typedef uint16_t type; };
+
+template <uint8_t NSteps>
+struct StepMask<NSteps, false, false, true> { typedef uint32_t type; };
+
+inline uint8_t popCount(uint8_t v) { return __builtin_popcount(v); }
+inline uint8_t popCount(uint16_t v) { return __builtin_popcount(v); }
+inline uint8_t popCount(uint32_t v) { return __builtin_popcountl(v); }
+inline uint8_t popCount(uint64_t v) { return __builtin_popcountll(v); }
+
+// Index of the lowest set bit; undefined for 0
+inline uint8_t lowestSetBit(uint8_t v) { return __builtin_ctz(v); }
+inline uint8_t lowestSetBit(uint16_t v) { return __builtin_ctz(v); }
+inline uint8_t lowestSetBit(uint32_t v) { return __builtin_ctzl(v); }
+inline uint8_t lowestSetBit(uint64_t v) { return __builtin_ctzll(v); }
+
+// Calls fn(step) for every set step in ascending order, skipping empty steps entirely
+template <typename MaskT, typename Fn>
+inline void forEachStep(MaskT mask, Fn fn) {
+    while (mask) {
+        fn(lowestSetBit(mask));
+        mask &= static_cast<MaskT>(mask - 1);
+    }
+}
+
+// 23 bytes per track on the Uno (see "Firmware memory" in the README)
+template <uint8_t NSteps>
+struct BasicTrackData {
+    typedef typename StepMask<NSteps>::type step_mask_t;
+    static const uint8_t max_steps = NSteps;
 
-struct TrackData {
     bool muted;
     float volume;
     instrument_id_t instrument_id;
-    unsigned char n_active_triggers;
-    bool triggers[N_TRACK_SUBDIVISIONS];
+    step_mask_t triggers;  // Bit i set when step i triggers
+
+    // Velocity level of step i is (bit i of velocity_hi) * 2 + (bit i of velocity_lo). Levels are kept for
+    // steps that do not trigger, so a hit comes back at the velocity it had.
+    step_mask_t velocity_lo;
+    step_mask_t velocity_hi;
+
+    // The track loops every n_steps steps of 1/step_division notes, e.g. 16 x 1/16 for a 4/4 bar,
+    // 5 x 1/16 or 7 x 1/8 for tracks that cycle against it
+    uint8_t n_steps;
+    uint8_t step_division;
+
+    int16_t pitch_cents;  // 100 cents per semitone; 0 plays the sample as recorded
+
+    uint8_t effect_params[N_EFFECT_PARAMS];
+    uint8_t live_effects;  // Bit per TrackEffect: processed by the stream as it plays rather than into the stem
+
+    BasicTrackData() :
+        muted(false), volume(0.75f), instrument_id(0), triggers(0), n_steps(NSteps), step_division(NSteps), pitch_cents(0) {
+        resetVelocities();
+        resetEffects();
+    }
+
+    static step_mask_t stepBit(uint8_t step) {
+        return static_cast<step_mask_t>(static_cast<step_mask_t>(1) << step);
+    }
+
+    // Triggers inside the track's cycle; steps past n_steps are kept but not played
+    step_mask_t activeTriggers() const {
+        if (n_steps >= 8 * sizeof(step_mask_t)) return triggers;
+        return triggers & static_cast<step_mask_t>(stepBit(n_steps) - 1);
+    }
+
+    // A cycle of n steps of 1/n notes spans exactly one bar
+    bool hasFullBarCycle() const {
+        return n_steps == step_division;
+    }
+
+    static bool isValidPitch(int16_t pitch_cents) {
+        return pitch_cents >= -MAX_PITCH_CENTS && pitch_cents <= MAX_PITCH_CENTS;
+    }
+
+    static bool isValidLength(uint8_t n_steps, uint8_t step_division) {
+        return n_steps >= 1 && n_steps <= NSteps && step_division >= 1 && step_division <= MAX_STEP_DIVISION;
+    }
+
+    static bool isValidEffectParam(uint8_t param, uint8_t value) {
+        if (param == EFFECT_PARAM_LIVE) return value < (1 << N_TRACK_EFFECTS);
+        if (param == EFFECT_DELAY_TIME) return value <= MAX_DELAY_SIXTEENTHS;
+        return param < N_EFFECT_PARAMS && value <= EFFECT_PARAM_MAX;
+    }
+
+    void setEffectParam(uint8_t param, uint8_t value) {
+        if (param == EFFECT_PARAM_LIVE) {
+            live_effects = value;
+        } else {
+            effect_params[param] = value;
+        }
+    }
+
+    // Effects that change the sound with the current parameters, as TrackEffect bits
+    uint8_t activeEffects() const {
+        uint8_t effects = 0;
+        if (effect_params[EFFECT_FILTER_CUTOFF] < EFFECT_PARAM_MAX) effects |= 1 << TRACK_EFFECT_FILTER;
+        if (effect_params[EFFECT_DRIVE] > 0) effects |= 1 << TRACK_EFFECT_DRIVE;
+        if (effect_params[EFFECT_DELAY_TIME] > 0 && effect_params[EFFECT_DELAY_MIX] > 0) effects |= 1 << TRACK_EFFECT_DELAY;
+        return effects;
+    }
+
+    // Active effects baked into the stem when it is rendered
+    uint8_t renderedEffects() const {
+        return activeEffects() & static_cast<uint8_t>(~live_effects);
+    }
+
+    // Active effects the stream applies as the track plays
+    uint8_t liveActiveEffects() const {
+        return activeEffects() & live_effects;
+    }
+
+    void resetEffects() {
+        effect_params[EFFECT_FILTER_CUTOFF] = EFFECT_PARAM_MAX;
+        effect_params[EFFECT_FILTER_RESONANCE] = 0;
+        effect_params[EFFECT_DRIVE] = 0;
+        effect_params[EFFECT_DELAY_TIME] = 0;
+        effect_params[EFFECT_DELAY_FEEDBACK] = 64;
+        effect_params[EFFECT_DELAY_MIX] = 48;
+        live_effects = 0;
+    }
+
+    uint8_t velocity(uint8_t step) const {
+        return ((velocity_hi & stepBit(step)) ? 2 : 0) | ((velocity_lo & stepBit(step)) ? 1 : 0);
+    }
+
+    void setVelocity(uint8_t step, uint8_t level) {
+        step_mask_t bit = stepBit(step);
+        velocity_lo = (level & 1) ? (velocity_lo | bit) : (velocity_lo & static_cast<step_mask_t>(~bit));
+        velocity_hi = (level & 2) ? (velocity_hi | bit) : (velocity_hi & static_cast<step_mask_t>(~bit));
+    }
+
+    // Triggering steps at exactly `level`, for rendering one velocity at a time
+    step_mask_t triggersAtVelocity(uint8_t level) const {
+        step_mask_t lo = (level & 1) ? velocity_lo : static_cast<step_mask_t>(~velocity_lo);
+        step_mask_t hi = (level & 2) ? velocity_hi : static_cast<step_mask_t>(~velocity_hi);
+        return activeTriggers() & lo & hi;
+    }
+
+    void resetVelocities() {
+        velocity_lo = (VELOCITY_NORMAL & 1) ? static_cast<step_mask_t>(~static_cast<step_mask_t>(0)) : 0;
+        velocity_hi = (VELOCITY_NORMAL & 2) ? static_cast<step_mask_t>(~static_cast<step_mask_t>(0)) : 0;
+    }
+
+    bool hasTrigger(uint8_t step) const {
+        return (triggers & stepBit(step)) != 0;
+    }
 
-    TrackData() : muted(false), volume(0.75f), instrument_id(0), n_active_triggers(0) {}
+    // Flips the step and returns its new state
+    bool toggleTrigger(uint8_t step) {
+        triggers ^= stepBit(step);
+        return hasTrigger(step);
+    }
+
+    uint8_t activeTriggerCount() const {
+        return popCount(triggers);
+    }
 
     bool isActive() const {
-        return n_active_triggers > 0 && !muted;
+        return activeTriggers() != 0 && !muted;
     }
 };
 
-struct SequenceData {
+template <uint8_t NTracks, uint8_t NSteps>
+struct BasicSequenceData {
+    typedef typename BasicTrackData<NSteps>::step_mask_t step_mask_t;
+    static const uint8_t n_tracks = NTracks;
+    static const uint8_t n_steps = NSteps;
+
+    // Snapshot layout: bpm, bpm fraction, swing, then per track instrument, flags (bit 0 = muted), volume (0-255),
+    // step count, step division, pitch in cents (int16), effect parameters, live effect mask, trigger mask,
+    // velocity low and high bit planes (multi-byte fields little endian). Two bits per step carry four velocity levels.
+    static const uint16_t serialized_track_size = 8 + N_EFFECT_PARAMS + 3 * sizeof(step_mask_t);
+    static const uint16_t serialized_size = 3 + NTracks * serialized_track_size;
+
     bpm_t bpm;
-    TrackData tracks[N_TRACKS];
+    uint8_t bpm_fraction;  // Hundredths of a BPM
+    uint8_t swing;
+    BasicTrackData<NSteps> tracks[NTracks];
+
+    BasicSequenceData() : bpm(120), bpm_fraction(0), swing(MIN_SWING) {}
 
-    SequenceData() : bpm(120) {}
+    static bool isValidGroove(uint8_t bpm_fraction, uint8_t swing) {
+        return bpm_fraction < 100 && swing >= MIN_SWING && swing <= MAX_SWING;
+    }
 
     void reset() {
         bpm = 120;
-        for (unsigned char i = 0; i < N_TRACKS; i++) {
+        bpm_fraction = 0;
+        swing = MIN_SWING;
+        for (unsigned char i = 0; i < NTracks; i++) {
             tracks[i].instrument_id = 0;
             tracks[i].volume = 0.75f;
             tracks[i].muted = false;
-            tracks[i].n_active_triggers = 0;
+            tracks[i].triggers = 0;
+            tracks[i].n_steps = NSteps;
+            tracks[i].step_division = NSteps;
+            tracks[i].pitch_cents = 0;
+            tracks[i].resetVelocities();
+            tracks[i].resetEffects();
+        }
+    }
 
-            for (unsigned char j = 0; j < N_TRACK_SUBDIVISIONS; j++) {
-                tracks[i].triggers[j] = false;
+    // Writes serialized_size bytes into `buffer`
+    uint16_t serialize(unsigned char *buffer) const {
+        uint16_t offset = 0;
+        buffer[offset++] = bpm;
+        buffer[offset++] = bpm_fraction;
+        buffer[offset++] = swing;
+
+        for (unsigned char i = 0; i < NTracks; i++) {
+            buffer[offset++] = tracks[i].instrument_id;
+            buffer[offset++] = tracks[i].muted ? 1 : 0;
+            buffer[offset++] = static_cast<unsigned char>(tracks[i].volume * 255.0f + 0.5f);
+            buffer[offset++] = tracks[i].n_steps;
+            buffer[offset++] = tracks[i].step_division;
+            buffer[offset++] = static_cast<unsigned char>(static_cast<uint16_t>(tracks[i].pitch_cents));
+            buffer[offset++] = static_cast<unsigned char>(static_cast<uint16_t>(tracks[i].pitch_cents) >> 8);
+
+            for (unsigned char p = 0; p < N_EFFECT_PARAMS; p++) {
+                buffer[offset++] = tracks[i].effect_params[p];
             }
+            buffer[offset++] = tracks[i].live_effects;
+
+            offset += writeMask(buffer + offset, tracks[i].triggers);
+            offset += writeMask(buffer + offset, tracks[i].velocity_lo);
+            offset += writeMask(buffer + offset, tracks[i].velocity_hi);
+        }
+
+        return offset;
+    }
+
+    // Reads serialized_size bytes from `buffer`
+    void deserialize(const unsigned char *buffer) {
+        uint16_t offset = 0;
+        bpm = buffer[offset++];
+        bpm_fraction = buffer[offset++];
+        swing = buffer[offset++];
+
+        if (!isValidGroove(bpm_fraction, swing)) {
+            bpm_fraction = 0;
+            swing = MIN_SWING;
+        }
+
+        for (unsigned char i = 0; i < NTracks; i++) {
+            tracks[i].instrument_id = buffer[offset++];
+            tracks[i].muted = (buffer[offset++] & 1) != 0;
+            tracks[i].volume = buffer[offset++] / 255.0f;
+            tracks[i].n_steps = buffer[offset++];
+            tracks[i].step_division = buffer[offset++];
+
+            if (!BasicTrackData<NSteps>::isValidLength(tracks[i].n_steps, tracks[i].step_division)) {
+                tracks[i].n_steps = NSteps;
+                tracks[i].step_division = NSteps;
+            }
+
+            uint16_t pitch = buffer[offset] | (static_cast<uint16_t>(buffer[offset + 1]) << 8);
+            offset += 2;
+            tracks[i].pitch_cents = static_cast<int16_t>(pitch);
+            if (!BasicTrackData<NSteps>::isValidPitch(tracks[i].pitch_cents)) {
+                tracks[i].pitch_cents = 0;
+            }
+
+            tracks[i].resetEffects();
+            for (unsigned char p = 0; p <= EFFECT_PARAM_LIVE; p++) {
+                uint8_t value = buffer[offset++];
+                if (BasicTrackData<NSteps>::isValidEffectParam(p, value)) tracks[i].setEffectParam(p, value);
+            }
+
+            offset += readMask(buffer + offset, tracks[i].triggers);
+            offset += readMask(buffer + offset, tracks[i].velocity_lo);
+            offset += readMask(buffer + offset, tracks[i].velocity_hi);
         }
     }
 
     void prettyPrint() const {
-        printf("BPM: %d\n", bpm);
+        printf("BPM: %d.%02d, swing %d%%\n", bpm, bpm_fraction, swing);
 
-        for (unsigned char i = 0; i < N_TRACKS; i++) {
+        for (unsigned char i = 0; i < NTracks; i++) {
             printf(
-                "Track %d: (instrument=%d, vol=%f, muted: %d)\ttriggers=[",
-                i, tracks[i].instrument_id, tracks[i].volume, tracks[i].muted
+                "Track %d: (instrument=%d, vol=%f, muted: %d, %d x 1/%d, pitch %+d cents, effects %d live %d)\ttriggers=[",
+                i, tracks[i].instrument_id, tracks[i].volume, tracks[i].muted, tracks[i].n_steps, tracks[i].step_division,
+                tracks[i].pitch_cents, tracks[i].activeEffects(), tracks[i].liveActiveEffects()
             );
 
-            for (unsigned char j = 0; j < N_TRACK_SUBDIVISIONS; j++) {
-                printf("%d", tracks[i].triggers[j]);
-                if (j < N_TRACK_SUBDIVISIONS - 1) {
+            // Triggering steps print their velocity level + 1
+            for (unsigned char j = 0; j < tracks[i].n_steps; j++) {
+                printf("%d", tracks[i].hasTrigger(j) ? tracks[i].velocity(j) + 1 : 0);
+                if (j < tracks[i].n_steps - 1) {
                     printf(", ");
                 }
             }
@@ -69,65 +373,24 @@ struct SequenceData {
         }
     }
 
-    // #ifndef ARDUINO
-    // void prettyPrint() const {
-    //     printf("BPM: %d\n", bpm);
-
-    //     for (unsigned char i = 0; i < N_TRACKS; i++) {
-    //         printf("Track %d: instrument_id=%d, triggers=[", i, tracks[i].instrument_id);
-    //         for (unsigned char j = 0; j < N_TRACK_SUBDIVISIONS; j++) {
-    //             printf("%d", tracks[i].triggers[j]);
-    //             if (j < N_TRACK_SUBDIVISIONS - 1) {
-    //                 printf(", ");
-    //             }
-    //         }
-    //         printf("]\n");
-    //     }
-    // }
-    // #endif
-
-    // size_t numBytes() const {
-    //     return sizeof(unsigned char) + N_TRACKS * sizeof(TrackData);
-    // }
-
-    // size_t serialize(unsigned char *buffer, size_t buffer_size) const {
-    //     size_t offset = 0;
-
-    //     // Serialize bpm
-    //     buffer[offset++] = bpm;
-
-    //     // Serialize each TrackData
-    //     for (unsigned char i = 0; i < N_TRACKS; i++) {
-    //         // Serialize instrument_id
-    //         buffer[offset++] = tracks[i].instrument_id;
-
-    //         // Serialize triggers
-    //         memcpy(buffer + offset, tracks[i].triggers, sizeof(tracks[i].triggers));
-    //         offset += sizeof(tracks[i].triggers);
-    //     }
-
-    //     return offset; // Return total serialized size
-    // }
-
-    // static SequenceData deserialize(const unsigned char *buffer) {
-    //     size_t offset = 0;
-    //     SequenceData data;
-
-    //     // Deserialize bpm
-    //     data.bpm = buffer[offset++];
-
-    //     // Deserialize each TrackData
-    //     for (unsigned char i = 0; i < N_TRACKS; i++) {
-    //         // Deserialize instrument_id
-    //         data.tracks[i].instrument_id = buffer[offset++];
-
-    //         // Deserialize triggers
-    //         memcpy(data.tracks[i].triggers, buffer + offset, sizeof(data.tracks[i].triggers));
-    //         offset += sizeof(data.tracks[i].triggers);
-    //     }
-
-    //     return data;
-    // }
+private:
+    static uint8_t writeMask(unsigned char *buffer, step_mask_t mask) {
+        for (unsigned char b = 0; b < sizeof(step_mask_t); b++) {
+            buffer[b] = static_cast<unsigned char>(mask >> (8 * b));
+        }
+        return sizeof(step_mask_t);
+    }
+
+    static uint8_t readMask(const unsigned char *buffer, step_mask_t &mask) {
+        mask = 0;
+        for (unsigned char b = 0; b < sizeof(step_mask_t); b++) {
+            mask |= static_cast<step_mask_t>(static_cast<step_mask_t>(buffer[b]) << (8 * b));
+        }
+        return sizeof(step_mask_t);
+    }
 };
 
+typedef BasicTrackData<N_TRACK_SUBDIVISIONS> TrackData;
+typedef BasicSequenceData<N_TRACKS, N_TRACK_SUBDIVISIONS> SequenceData;
+
 #endif
\ No newline at end of file
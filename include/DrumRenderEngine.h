@@ -0,0 +1,461 @@
+#ifndef DRUM_RENDER_ENGINE_H
+#define DRUM_RENDER_ENGINE_H
+
+#include <AudioUtils.h>
+#include <DrumMachineTrackData.h>
+#include <InstrumentLUT.h>
+#include <MasterLimiter.h>
+#include <RenderCache.h>
+#include <SampleBank.h>
+#include <TrackEffects.h>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// Compile-time shape of an engine build. Every loop over tracks, steps and channels in the render
+// and mix core has a constant trip count, so each configuration is unrolled and vectorized separately.
+template <uint8_t NTracks, uint8_t NSteps, int Channels, typename SampleT>
+struct EngineConfig {
+    static constexpr uint8_t n_tracks = NTracks;
+    static constexpr uint8_t n_steps = NSteps;
+    static constexpr int n_channels = Channels;
+
+    typedef SampleT sample_t;
+    typedef std::vector<SampleT> Buffer;
+    typedef BasicTrackData<NSteps> Track;
+    typedef BasicSequenceData<NTracks, NSteps> Sequence;
+    typedef BasicLoopingStatistics<NSteps> Stats;
+    typedef LoopingStatisticsTable<NSteps> StatsTable;
+};
+
+typedef EngineConfig<N_TRACKS, N_TRACK_SUBDIVISIONS, AUDIO_CHANNELS, sf::Int16> DefaultEngineConfig;
+
+// Stems bounded below this level (full scale = 1.0) cannot clip, with room left for each hit's rounding
+#define STEM_UNCLIPPED_BOUND 0.99f
+
+// Per-track stems and the mix built from them, for one sequence at one tempo. Stems are immutable once
+// rendered and shared with the (optional) render cache, so repeated states are served without rendering.
+template <typename Config>
+class DrumRenderEngine {
+public:
+    typedef typename Config::sample_t sample_t;
+    typedef typename Config::Buffer Buffer;
+    typedef typename Config::Track Track;
+    typedef typename Config::Sequence Sequence;
+    typedef typename Config::Stats Stats;
+    typedef std::shared_ptr<const Buffer> SharedBuffer;
+    typedef typename SampleBank<sample_t, Config::n_channels>::SharedInstrument SharedInstrument;
+
+    explicit DrumRenderEngine(SampleBank<sample_t, Config::n_channels> &bank, bpm_t bpm = 120, RenderCache<Config> *cache = nullptr) :
+        bank(bank),
+        cache(cache),
+        looping_stats(Config::StatsTable::forBPM(bpm)) {}
+
+    const Stats &stats() const {
+        return looping_stats;
+    }
+
+    // The track's stem as it is heard, with its render-time effects; null when the track has no triggers
+    const SharedBuffer &track(track_id_t track_id) const {
+        return processed_tracks[track_id];
+    }
+
+    // True when the track's (pitched) samples can be rendered without waiting for the resampler; otherwise
+    // the missing variant is queued
+    bool samplesReady(const Track &track_data) {
+        return bank.variantReady(track_data.instrument_id, track_data.pitch_cents);
+    }
+
+    // The same for every track that would be rendered; all missing variants are queued at once
+    bool samplesReady(const Sequence &sequence_data) {
+        bool ready = true;
+        for (int j = 0; j < Config::n_tracks; ++j) {
+            const Track &track_data = sequence_data.tracks[j];
+            if (track_data.activeTriggers() != 0 && !samplesReady(track_data)) ready = false;
+        }
+        return ready;
+    }
+
+    // Looping statistics for the sequence's tempo, fractional BPM and swing
+    static Stats statsFor(const Sequence &sequence_data) {
+        return Config::StatsTable::forTempo(sequence_data.bpm, sequence_data.bpm_fraction, sequence_data.swing);
+    }
+
+    // Exact length of one cycle of the track, in 32.32 fixed point frames
+    uint64_t cycleLengthQ32(const Track &track_data) const {
+        if (track_data.hasFullBarCycle()) return looping_stats.bar_length_q32;
+        return looping_stats.cycleLengthQ32(track_data.n_steps, track_data.step_division);
+    }
+
+    // Frames in the track's stem: the longest its cycle ever plays for
+    int cycleFrames(const Track &track_data) const {
+        return static_cast<int>((cycleLengthQ32(track_data) + Q32_FRACTION_MASK) >> 32);
+    }
+
+    // True when some audible track cycles on a period other than the bar
+    bool isPolymetric(const Sequence &sequence_data) const {
+        for (int j = 0; j < Config::n_tracks; ++j) {
+            const Track &track_data = sequence_data.tracks[j];
+            if (track_data.isActive() && !track_data.hasFullBarCycle()) return true;
+        }
+        return false;
+    }
+
+    // Changes tempo and re-renders every track of `sequence_data` on the new grid
+    void setTempo(const Sequence &sequence_data) {
+        looping_stats = statsFor(sequence_data);
+
+        for (int j = 0; j < Config::n_tracks; ++j) {
+            renderTrack(sequence_data, j);
+        }
+    }
+
+    void renderTrack(const Sequence &sequence_data, track_id_t track_id) {
+        const Track &track_data = sequence_data.tracks[track_id];
+
+        if (track_data.activeTriggers() == 0) {
+            individual_tracks[track_id] = nullptr;
+            processed_tracks[track_id] = nullptr;
+            return;
+        }
+
+        uint64_t key = RenderCache<Config>::stemKey(track_data, looping_stats);
+        if (!findStem(key, individual_tracks[track_id])) {
+            individual_tracks[track_id] = storeStem(key, populateFromTrackData(track_data));
+        }
+
+        applyEffects(track_data, track_id);
+    }
+
+    // Re-derives the heard stem from the dry one after the track's effects changed. Stems with no render-time
+    // effects are shared as they are; processed stems are cached like dry ones.
+    void applyEffects(const Track &track_data, track_id_t track_id) {
+        const SharedBuffer &dry = individual_tracks[track_id];
+        SharedBuffer &processed = processed_tracks[track_id];
+
+        uint8_t effects = track_data.renderedEffects();
+        if (!dry || effects == 0) {
+            processed = dry;
+            return;
+        }
+
+        uint64_t key = RenderCache<Config>::processedStemKey(track_data, looping_stats);
+        if (findStem(key, processed)) return;
+
+        EffectSettings settings = effectSettings(track_data, looping_stats, effects);
+        TrackEffectChain<Config::n_channels> chain(settings.delay_frames);
+        processed = storeStem(key, chain.processLoop(*dry, settings));
+    }
+
+    void clear(const Sequence &sequence_data) {
+        looping_stats = statsFor(sequence_data);
+
+        for (int j = 0; j < Config::n_tracks; ++j) {
+            individual_tracks[j] = nullptr;
+            processed_tracks[j] = nullptr;
+        }
+    }
+
+    // Applies a step that has already been toggled in `track_data` to the track's stem. A cached stem for the
+    // resulting state is reused as-is; otherwise the current stem is copied and edited incrementally when that
+    // is exact (see editIsExact()), and rendered from scratch when it is not.
+    void applyStepToggle(const Track &track_data, track_id_t track_id, unsigned char beat_idx) {
+        SharedBuffer &stem = individual_tracks[track_id];
+
+        if (track_data.activeTriggers() == 0) {
+            stem = nullptr;
+            processed_tracks[track_id] = nullptr;
+            return;
+        }
+
+        // Steps past the end of the cycle are stored but never played
+        if (beat_idx >= track_data.n_steps) return;
+
+        uint64_t key = RenderCache<Config>::stemKey(track_data, looping_stats);
+        if (!findStem(key, stem)) {
+            Track before = track_data;
+            before.toggleTrigger(beat_idx);
+
+            if (!stem || !editIsExact(before, track_data)) {
+                stem = storeStem(key, populateFromTrackData(track_data));
+            } else {
+                Buffer edited = *stem;
+
+                // Neither stem can clip, so the sums need no saturation
+                if (track_data.hasTrigger(beat_idx)) {
+                    addSampleToTrackByIndex(edited, track_data, beat_idx, track_data.velocity(beat_idx), false);
+                } else {
+                    eraseSampleFromTrackByIndex(edited, track_data, beat_idx, track_data.velocity(beat_idx), false);
+                }
+
+                stem = storeStem(key, std::move(edited));
+            }
+        }
+
+        // Effects are not linear, so the dry edit is re-processed as a whole
+        applyEffects(track_data, track_id);
+    }
+
+    // Applies a step whose velocity has already been changed in `track_data` (from `old_velocity`) by
+    // removing the hit at its old gain and adding it at the new one, or by rendering the stem from scratch when
+    // that would not be exact
+    void applyStepVelocity(const Track &track_data, track_id_t track_id, unsigned char beat_idx, uint8_t old_velocity) {
+        SharedBuffer &stem = individual_tracks[track_id];
+
+        // Untriggered steps keep their velocity for later but sound the same
+        if (!stem || beat_idx >= track_data.n_steps || !track_data.hasTrigger(beat_idx)) return;
+
+        uint64_t key = RenderCache<Config>::stemKey(track_data, looping_stats);
+        if (!findStem(key, stem)) {
+            Track before = track_data;
+            before.setVelocity(beat_idx, old_velocity);
+
+            if (!editIsExact(before, track_data)) {
+                stem = storeStem(key, populateFromTrackData(track_data));
+            } else {
+                Buffer edited = *stem;
+                eraseSampleFromTrackByIndex(edited, track_data, beat_idx, old_velocity, false);
+                addSampleToTrackByIndex(edited, track_data, beat_idx, track_data.velocity(beat_idx), false);
+
+                stem = storeStem(key, std::move(edited));
+            }
+        }
+
+        applyEffects(track_data, track_id);
+    }
+
+    // True when editing the stem of `before` into that of `after` leaves exactly the samples a render of
+    // `after` from scratch would: integer samples, and neither stem can clip. Only then may an edited stem be
+    // cached under the content key, which every later visit to the state is served from.
+    bool editIsExact(const Track &before, const Track &after) const {
+        return SampleTraits<sample_t>::exact_sums && dryStemPeakBound(before) <= STEM_UNCLIPPED_BOUND &&
+               dryStemPeakBound(after) <= STEM_UNCLIPPED_BOUND;
+    }
+
+    Buffer populateFromTrackData(const Track &data) {
+        Buffer track = {};
+
+        // Sums are only saturated when the stem might clip
+        bool saturate = dryStemPeakBound(data) > STEM_UNCLIPPED_BOUND;
+        forEachStep(data.activeTriggers(), [&](uint8_t i) {
+            addSampleToTrackByIndex(track, data, i, data.velocity(i), saturate);
+        });
+
+        return track;
+    }
+
+    // Upper bound on the track's stem level (full scale = 1.0), with its render-time effects
+    float stemPeakBound(const Track &track_data, track_id_t track_id) const {
+        // Effects can raise the level (resonance, echoes), so processed stems are measured instead
+        if (track_data.renderedEffects() && processed_tracks[track_id]) {
+            float peak = 0.0f;
+            for (sample_t v : *processed_tracks[track_id]) {
+                peak = std::max(peak, std::fabs(SampleTraits<sample_t>::toUnit(v)));
+            }
+            return peak;
+        }
+
+        return dryStemPeakBound(track_data);
+    }
+
+    // Upper bound on the level of the track's dry stem (full scale = 1.0): its sample's peak times the most hits
+    // that can ring at once, given the non-silent span and the shortest gap between steps
+    float dryStemPeakBound(const Track &track_data) const {
+        const SampleAnalysis &analysis = bank.pitched(track_data.instrument_id, track_data.pitch_cents)->analysis;
+
+        // One frame less than the grid's shortest gap, as the gap across the loop point may round shorter
+        size_t span_frames = analysis.activeFrames();
+        size_t min_gap_frames = std::max(1, std::min(
+            looping_stats.stepFrame(1, track_data.step_division) - looping_stats.stepFrame(0, track_data.step_division),
+            looping_stats.stepFrame(2, track_data.step_division) - looping_stats.stepFrame(1, track_data.step_division)
+        ) - 1);
+
+        size_t overlapping_hits = (span_frames + min_gap_frames - 1) / min_gap_frames;
+        if (span_frames <= static_cast<size_t>(cycleFrames(track_data))) {
+            overlapping_hits = std::min(overlapping_hits, static_cast<size_t>(popCount(track_data.activeTriggers())));
+        }
+
+        float loudest_velocity_gain = 0.0f;
+        for (uint8_t level = 0; level < VELOCITY_LEVELS; ++level) {
+            if (track_data.triggersAtVelocity(level)) loudest_velocity_gain = VELOCITY_GAINS[level];
+        }
+
+        return analysis.peak * track_data.volume * loudest_velocity_gain * static_cast<float>(overlapping_hits);
+    }
+
+    // Upper bound on the master bus level before limiting (full scale = 1.0)
+    float busPeakBound(const Sequence &sequence_data) const {
+        float peak_sum = 0.0f;
+        for (int j = 0; j < Config::n_tracks; ++j) {
+            if (sequence_data.tracks[j].isActive()) peak_sum += stemPeakBound(sequence_data.tracks[j], j);
+        }
+
+        return peak_sum * TRACK_BUS_GAIN;
+    }
+
+    // Sums every audible stem at the fixed bus gain and limits the bar as a loop, so the limiter's gain is
+    // continuous across the bar line. Bars that provably stay under the ceiling skip the limiter.
+    Buffer mixTracksTogether(const Sequence &sequence_data, float *gain_reduction_db = nullptr) {
+        typedef SampleTraits<sample_t> Traits;
+        const int channels = Config::n_channels;
+        size_t total_samples = static_cast<size_t>(looping_stats.bar_length_frames) * channels;
+        std::vector<float> bus(total_samples, 0.0f);
+
+        for (int j = 0; j < Config::n_tracks; ++j) {
+            if (!sequence_data.tracks[j].isActive() || !processed_tracks[j]) continue;
+
+            const Buffer &track = *processed_tracks[j];
+            size_t n = std::min(track.size(), total_samples);
+            float *out = bus.data();
+            const sample_t *in = track.data();
+
+            for (size_t i = 0; i < n; ++i) {
+                out[i] += Traits::toUnit(in[i]) * TRACK_BUS_GAIN;
+            }
+        }
+
+        float reduction_db = 0.0f;
+        if (busPeakBound(sequence_data) > LIMITER_CEILING) {
+            reduction_db = limiter.processLoop(bus.data(), total_samples / channels);
+        }
+        if (gain_reduction_db) *gain_reduction_db = reduction_db;
+
+        Buffer mix_buffer(total_samples);
+        for (size_t i = 0; i < total_samples; ++i) {
+            mix_buffer[i] = Traits::fromUnit(bus[i]);
+        }
+
+        return mix_buffer;
+    }
+
+    // True when some audible track has effects the stream applies as it plays
+    bool hasLiveEffects(const Sequence &sequence_data) const {
+        for (int j = 0; j < Config::n_tracks; ++j) {
+            const Track &track_data = sequence_data.tracks[j];
+            if (track_data.isActive() && track_data.liveActiveEffects()) return true;
+        }
+        return false;
+    }
+
+    // The mix in the output stream's format, from the cache when this exact state was mixed before.
+    // Polymetric states, and states with live effects, are handed to the stream as per-track loops instead,
+    // each one cycle long.
+    StreamMix renderMix(const Sequence &sequence_data) {
+        if (isPolymetric(sequence_data) || hasLiveEffects(sequence_data)) {
+            return trackLoops(sequence_data);
+        }
+
+        uint64_t key = RenderCache<Config>::mixKey(sequence_data);
+
+        std::shared_ptr<const RenderedMix> rendered;
+        if (cache) rendered = cache->mixes.find(key);
+
+        if (!rendered) {
+            std::shared_ptr<RenderedMix> mixed = std::make_shared<RenderedMix>();
+            mixed->samples = toStreamBuffer(mixTracksTogether(sequence_data, &mixed->gain_reduction_db));
+            rendered = mixed;
+
+            if (cache) cache->mixes.insert(key, rendered);
+        }
+
+        // The stream holds the samples; the aliasing pointer keeps the whole entry alive
+        StreamMix mix(SharedStreamBuffer(rendered, &rendered->samples));
+        mix.gain_reduction_db = rendered->gain_reduction_db;
+        return mix;
+    }
+
+    StreamMix trackLoops(const Sequence &sequence_data) const {
+        StreamMix loops;
+
+        for (int j = 0; j < Config::n_tracks; ++j) {
+            const Track &track_data = sequence_data.tracks[j];
+            if (!track_data.isActive() || !processed_tracks[j]) continue;
+
+            loops.track_loops.push_back(TrackLoop{
+                static_cast<track_id_t>(j),
+                toSharedStreamBuffer(processed_tracks[j]),
+                TRACK_BUS_GAIN,
+                cycleLengthQ32(track_data),
+                effectSettings(track_data, looping_stats, track_data.liveActiveEffects())
+            });
+        }
+
+        return loops;
+    }
+
+private:
+    SampleBank<sample_t, Config::n_channels> &bank;
+    RenderCache<Config> *cache;
+
+    // Audio buffers for each track, each with a length of one cycle of the track. Edits are applied to the dry
+    // stems; the processed ones add the render-time effects (and are the dry ones when there are none).
+    SharedBuffer individual_tracks[Config::n_tracks];
+    SharedBuffer processed_tracks[Config::n_tracks];
+
+    // Looping statistics for the current sequence
+    Stats looping_stats;
+
+    // Limits bar-length mixes; polymetric loops are limited by the stream as they play
+    MasterLimiter<Config::n_channels> limiter;
+
+    bool findStem(uint64_t key, SharedBuffer &stem) {
+        if (!cache) return false;
+
+        SharedBuffer cached = cache->stems.find(key);
+        if (!cached) return false;
+
+        stem = std::move(cached);
+        return true;
+    }
+
+    SharedBuffer storeStem(uint64_t key, Buffer &&rendered) {
+        SharedBuffer stem = std::make_shared<const Buffer>(std::move(rendered));
+        if (cache) cache->stems.insert(key, stem);
+
+        return stem;
+    }
+
+    // Modify the track's audio buffer to remove all sound at the given beat index. The track's volume and
+    // `velocity` must be the ones the sample was added with. `saturate` may only be false when the stem cannot clip.
+    void eraseSampleFromTrackByIndex(
+        Buffer &track, const Track &track_data, unsigned char beat_idx, uint8_t velocity, bool saturate
+    ) {
+        SharedInstrument instrument = bank.pitched(track_data.instrument_id, track_data.pitch_cents);
+        if (instrument->sample.empty()) {
+            std::cerr << "Error: samples failed to load.\n";
+            return;
+        }
+
+        int frame_start_idx = looping_stats.stepFrame(beat_idx, track_data.step_division);
+        float gain = track_data.volume * VELOCITY_GAINS[velocity];
+        unmixSample<sample_t, Config::n_channels>(
+            track, instrument->sample, instrument->analysis, frame_start_idx, gain, saturate
+        );
+    }
+
+    // Velocity is just part of the hit's gain, so accents cost the same as plain hits
+    void addSampleToTrackByIndex(
+        Buffer &track, const Track &track_data, unsigned char beat_idx, uint8_t velocity, bool saturate
+    ) {
+        // Resize the track if it is empty
+        if (track.empty()) {
+            track.resize(static_cast<size_t>(cycleFrames(track_data)) * Config::n_channels, 0);
+        }
+
+        SharedInstrument instrument = bank.pitched(track_data.instrument_id, track_data.pitch_cents);
+        if (instrument->sample.empty()) {
+            std::cerr << "Error: samples failed to load.\n";
+            return;
+        }
+
+        // Only the non-silent span is mixed
+        int frame_start_idx = looping_stats.stepFrame(beat_idx, track_data.step_division);
+        float gain = track_data.volume * VELOCITY_GAINS[velocity];
+        mixSample<sample_t, Config::n_channels>(
+            track, instrument->sample, instrument->analysis, frame_start_idx, gain, saturate
+        );
+    }
+};
+
+#endif // DRUM_RENDER_ENGINE_H
@@ -0,0 +1,205 @@
+#ifndef MASTER_LIMITER_H
+#define MASTER_LIMITER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Highest level the master bus may reach, relative to full scale (about -0.2 dBFS)
+#define LIMITER_CEILING 0.98f
+
+// The limiter decides its gain once per block and ramps linearly across it
+#define LIMITER_BLOCK_FRAMES 32
+
+// Blocks the limiter sees ahead of the one it is processing (about 2.9 ms at 44.1 kHz); gain reduction
+// starts this early so peaks are caught without clipping or an audible attack click
+#define LIMITER_LOOKAHEAD_BLOCKS 4
+
+// Time for the gain to recover most of the way to unity after a peak
+#define LIMITER_RELEASE_MS 80.0f
+
+struct LimiterStatistics {
+    float last_gain_reduction_db = 0.0f;  // Deepest reduction in the last processed chunk or loop
+    float max_gain_reduction_db = 0.0f;
+    size_t frames = 0;
+    double seconds = 0.0;                 // Time spent limiting, filled in by callers that measure it
+
+    // Share of one core used, as the processing time over the duration of the audio processed
+    double cpuShare(unsigned int sample_rate) const {
+        return frames > 0 ? seconds * sample_rate / frames : 0.0;
+    }
+};
+
+// Block-based look-ahead peak limiter for the master bus, on interleaved float frames. Each block's peak gives
+// the gain it needs; the gain at the end of a block never exceeds what that block or the next one needs, and
+// is ramped linearly in between, so no frame exceeds the ceiling. Inner loops run over whole blocks with no
+// branches, so the compiler vectorizes them.
+template <int Channels>
+class MasterLimiter {
+public:
+    // `full_scale` is the bus value that corresponds to 0 dBFS (1.0 for float buses, 32767 for int16 ones)
+    explicit MasterLimiter(float full_scale = 1.0f, unsigned int sample_rate = 44100, size_t max_frames = 0) :
+        ceiling(LIMITER_CEILING * full_scale) {
+        float release_blocks = LIMITER_RELEASE_MS * 0.001f * sample_rate / LIMITER_BLOCK_FRAMES;
+        release_coefficient = 1.0f - std::exp(-1.0f / release_blocks);
+
+        // Stream callers process at most `max_frames` plus the look-ahead, so they never allocate here
+        required.reserve(blockCount(max_frames) + LIMITER_LOOKAHEAD_BLOCKS + 1);
+    }
+
+    // Frames past the chunk that processStream() needs to see
+    static constexpr size_t lookaheadFrames() {
+        return static_cast<size_t>(LIMITER_BLOCK_FRAMES) * LIMITER_LOOKAHEAD_BLOCKS;
+    }
+
+    // Limits the first `n_frames` frames of `bus` in place. The `lookahead_frames` frames that follow them are
+    // read but left untouched; they are the start of the next chunk. The gain carries over between calls.
+    void processStream(float *bus, size_t n_frames, size_t lookahead_frames) {
+        size_t n_blocks = blockCount(n_frames);
+        size_t n_seen = blockCount(n_frames + lookahead_frames);
+        measureBlocks(bus, n_frames + lookahead_frames, n_seen);
+
+        // Only after a reset can the first block need more than the carried gain allows; it then starts reduced
+        if (n_seen > 0) gain = std::min(gain, required[0]);
+
+        float lowest = 1.0f;
+        for (size_t k = 0; k < n_blocks; ++k) {
+            float target = nextGain(k, n_seen, false);
+            size_t frames = std::min(static_cast<size_t>(LIMITER_BLOCK_FRAMES), n_frames - k * LIMITER_BLOCK_FRAMES);
+
+            applyRamp(bus + k * LIMITER_BLOCK_FRAMES * Channels, frames, gain, target);
+            gain = target;
+            lowest = std::min(lowest, target);
+        }
+
+        record(lowest, n_frames);
+    }
+
+    // Limits a whole loop in place, as it sounds when repeated: the look-ahead wraps to the loop's start, and
+    // the gain entering the loop is the one it leaves with. Returns the deepest gain reduction in dB.
+    float processLoop(float *bus, size_t n_frames) {
+        size_t n_blocks = blockCount(n_frames);
+        if (n_blocks == 0) return 0.0f;
+
+        measureBlocks(bus, n_frames, n_blocks);
+
+        // One silent pass settles the gain the loop wraps around with
+        gain = 1.0f;
+        for (size_t k = 0; k < n_blocks; ++k) {
+            gain = nextGain(k, n_blocks, true);
+        }
+
+        float lowest = 1.0f;
+        for (size_t k = 0; k < n_blocks; ++k) {
+            float target = nextGain(k, n_blocks, true);
+            size_t frames = std::min(static_cast<size_t>(LIMITER_BLOCK_FRAMES), n_frames - k * LIMITER_BLOCK_FRAMES);
+
+            applyRamp(bus + k * LIMITER_BLOCK_FRAMES * Channels, frames, gain, target);
+            gain = target;
+            lowest = std::min(lowest, target);
+        }
+
+        record(lowest, n_frames);
+        return stats.last_gain_reduction_db;
+    }
+
+    // Back to unity gain, e.g. when playback jumps to unrelated audio
+    void reset() {
+        gain = 1.0f;
+    }
+
+    LimiterStatistics &statistics() {
+        return stats;
+    }
+
+    static float toGainReductionDb(float gain) {
+        return gain < 1.0f ? -20.0f * std::log10(gain) : 0.0f;
+    }
+
+private:
+    float ceiling;
+    float release_coefficient;
+    float gain = 1.0f;             // Gain at the end of the last processed block
+    std::vector<float> required;   // Gain each block needs to stay under the ceiling
+    LimiterStatistics stats;
+
+    static size_t blockCount(size_t n_frames) {
+        return (n_frames + LIMITER_BLOCK_FRAMES - 1) / LIMITER_BLOCK_FRAMES;
+    }
+
+    // Fills `required` for the first `n_blocks` blocks of `bus`; the last one may be partial
+    void measureBlocks(const float *bus, size_t n_frames, size_t n_blocks) {
+        required.resize(n_blocks);
+
+        for (size_t k = 0; k < n_blocks; ++k) {
+            size_t frames = std::min(static_cast<size_t>(LIMITER_BLOCK_FRAMES), n_frames - k * LIMITER_BLOCK_FRAMES);
+            float peak = blockPeak(bus + k * LIMITER_BLOCK_FRAMES * Channels, frames * Channels);
+            required[k] = peak > ceiling ? ceiling / peak : 1.0f;
+        }
+    }
+
+    // Largest absolute sample, reduced in eight independent lanes so it maps onto vector max instructions
+    static float blockPeak(const float *x, size_t n_samples) {
+        float lanes[8] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        size_t i = 0;
+
+        for (; i + 8 <= n_samples; i += 8) {
+            for (int l = 0; l < 8; ++l) {
+                float v = std::fabs(x[i + l]);
+                lanes[l] = v > lanes[l] ? v : lanes[l];
+            }
+        }
+
+        float peak = 0.0f;
+        for (int l = 0; l < 8; ++l) {
+            peak = std::max(peak, lanes[l]);
+        }
+        for (; i < n_samples; ++i) {
+            peak = std::max(peak, std::fabs(x[i]));
+        }
+
+        return peak;
+    }
+
+    // Gain at the end of block `k`: released towards unity, or moved a share of the way down towards the
+    // lowest requirement in the look-ahead window, and never above what block `k` or block `k + 1` needs
+    float nextGain(size_t k, size_t n_blocks, bool wrap) const {
+        float window_min = 1.0f;
+        for (size_t j = k; j <= k + LIMITER_LOOKAHEAD_BLOCKS; ++j) {
+            if (j >= n_blocks && !wrap) break;
+            window_min = std::min(window_min, required[j % n_blocks]);
+        }
+
+        float next = gain;
+        if (window_min < gain) {
+            next = gain - (gain - window_min) / LIMITER_LOOKAHEAD_BLOCKS;
+        } else {
+            next = std::min(window_min, gain + (1.0f - gain) * release_coefficient);
+        }
+
+        next = std::min(next, required[k]);
+        if (k + 1 < n_blocks || wrap) next = std::min(next, required[(k + 1) % n_blocks]);
+
+        return next;
+    }
+
+    static void applyRamp(float *block, size_t frames, float from, float to) {
+        float step = (to - from) / frames;
+
+        for (size_t f = 0; f < frames; ++f) {
+            float g = from + step * (f + 1);
+            for (int c = 0; c < Channels; ++c) {
+                block[f * Channels + c] *= g;
+            }
+        }
+    }
+
+    void record(float lowest_gain, size_t n_frames) {
+        stats.last_gain_reduction_db = toGainReductionDb(lowest_gain);
+        stats.max_gain_reduction_db = std::max(stats.max_gain_reduction_db, stats.last_gain_reduction_db);
+        stats.frames += n_frames;
+    }
+};
+
+#endif // MASTER_LIMITER_H
@@ -10,7 +10,14 @@ enum MessageType {
     MSG_TYPE_MUTE_TRACK = 4,
     MSG_TYPE_BPM_SELECT = 5,
     MSG_TYPE_CHANGE_TRACK_INSTRUMENT_ID = 6,
-    MSG_TYPE_CLEAR_ALL = 7
+    MSG_TYPE_CLEAR_ALL = 7,
+    MSG_TYPE_SEQUENCE_SNAPSHOT = 8,
+    MSG_TYPE_SELECT_PATTERN = 9,
+    MSG_TYPE_TRACK_LENGTH = 10,
+    MSG_TYPE_GROOVE = 11,
+    MSG_TYPE_TRACK_PITCH = 12,
+    MSG_TYPE_STEP_VELOCITY = 13,
+    MSG_TYPE_TRACK_EFFECT = 14
 };
 
 #ifdef ARDUINO
@@ -29,6 +36,81 @@ void sendMessage(const unsigned char *msg, unsigned char payload_size, const Mes
     Serial.write(msg, payload_size);
 }
 
+// Frames from the host, in the same format, read without blocking as bytes arrive. Payloads longer than
+// MaxPayload are skipped.
+template <uint8_t MaxPayload>
+class MessageReader {
+public:
+    // Consumes what Serial has received; true once a whole frame is in type(), payload() and size()
+    bool poll() {
+        while (Serial.available() > 0) {
+            uint8_t byte = static_cast<uint8_t>(Serial.read());
+
+            switch (stage) {
+                case START:
+                    if (byte == MSG_START_BYTE) stage = TYPE;
+                    break;
+
+                case TYPE:
+                    msg_type = byte;
+                    stage = SIZE;
+                    break;
+
+                case SIZE:
+                    payload_size = byte;
+                    received = 0;
+                    stage = payload_size > MaxPayload ? SKIP : PAYLOAD;
+                    if (payload_size == 0) {
+                        stage = START;
+                        return true;
+                    }
+                    break;
+
+                case PAYLOAD:
+                    buffer[received++] = byte;
+                    if (received == payload_size) {
+                        stage = START;
+                        return true;
+                    }
+                    break;
+
+                case SKIP:
+                    if (++received == payload_size) stage = START;
+                    break;
+            }
+        }
+
+        return false;
+    }
+
+    MessageType type() const {
+        return static_cast<MessageType>(msg_type);
+    }
+
+    const unsigned char *payload() const {
+        return buffer;
+    }
+
+    uint8_t size() const {
+        return payload_size;
+    }
+
+private:
+    enum Stage {
+        START,
+        TYPE,
+        SIZE,
+        PAYLOAD,
+        SKIP
+    };
+
+    Stage stage = START;
+    uint8_t msg_type = 0;
+    uint8_t payload_size = 0;
+    uint8_t received = 0;
+    unsigned char buffer[MaxPayload];
+};
+
 #endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+#ifndef MIDI_ACTION_MAP_H
+#define MIDI_ACTION_MAP_H
+
+#include <DrumMachineState.h>
+#include <cstdint>
+
+// Channels are numbered 1-16, as printed on controllers
+#define MIDI_TRIGGER_CHANNEL 10
+
+// Lowest note of the pad and step ranges (the General MIDI kick, and the first pad on most controllers)
+#define MIDI_FIRST_NOTE 36
+
+// Controller that sets the tempo, MIN_BPM at 0 to MAX_BPM at 127
+#define MIDI_BPM_CC 14
+
+// Controllers MIDI_FIRST_MUTE_CC + i toggle the mute of track i when pressed (value rising past 63)
+#define MIDI_FIRST_MUTE_CC 102
+
+#define MIDI_NOTE_OFF 0x80
+#define MIDI_NOTE_ON 0x90
+#define MIDI_CONTROL_CHANGE 0xB0
+
+// Turns MIDI channel messages into actions:
+//
+//   - on MIDI_TRIGGER_CHANNEL, note MIDI_FIRST_NOTE + i plays track i once at the note's velocity (LIVE_TRIGGER)
+//   - on the other channels, note MIDI_FIRST_NOTE + s toggles step s of a track: channels 1-9 address tracks
+//     0-8 and channels 11-16 tracks 9-14
+//   - MIDI_BPM_CC sets the tempo and MIDI_FIRST_MUTE_CC + i toggles track i's mute, on any channel
+//
+// Note-offs (and note-ons with velocity 0) are ignored.
+template <typename Sequence>
+class MidiActionMap {
+public:
+    // Returns false if the message maps to nothing
+    bool map(uint8_t status, uint8_t data1, uint8_t data2, Action &action) {
+        uint8_t kind = status & 0xF0;
+        int channel = (status & 0x0F) + 1;
+
+        if (kind == MIDI_NOTE_ON && data2 > 0) {
+            if (data1 < MIDI_FIRST_NOTE) return false;
+            int index = data1 - MIDI_FIRST_NOTE;
+
+            if (channel == MIDI_TRIGGER_CHANNEL) {
+                if (index >= Sequence::n_tracks) return false;
+                action = Action::create_LiveTrigger(static_cast<track_id_t>(index), data2);
+                return true;
+            }
+
+            int track = channel < MIDI_TRIGGER_CHANNEL ? channel - 1 : channel - 2;
+            if (track >= Sequence::n_tracks || index >= Sequence::n_steps) return false;
+
+            action = Action::create_TrackBeatToggle(static_cast<track_id_t>(track), static_cast<unsigned char>(index));
+            return true;
+        }
+
+        if (kind == MIDI_CONTROL_CHANGE) {
+            if (data1 == MIDI_BPM_CC) {
+                int bpm = MIN_BPM + (MAX_BPM - MIN_BPM) * data2 / 127;
+                if (bpm == last_bpm) return false;
+
+                last_bpm = bpm;
+                action = Action::create_BPMSelect(static_cast<bpm_t>(bpm));
+                return true;
+            }
+
+            if (data1 >= MIDI_FIRST_MUTE_CC && data1 < MIDI_FIRST_MUTE_CC + Sequence::n_tracks) {
+                int track = data1 - MIDI_FIRST_MUTE_CC;
+                bool pressed = data2 >= 64;
+                bool was_pressed = mute_pressed[track];
+                mute_pressed[track] = pressed;
+
+                if (!pressed || was_pressed) return false;
+
+                action = Action::create_TrackMuteToggle(static_cast<track_id_t>(track));
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    // Momentary buttons send 127 then 0; only the press toggles
+    bool mute_pressed[Sequence::n_tracks] = {};
+
+    // A knob sends many values per tempo step; repeats would each re-render every track
+    int last_bpm = -1;
+};
+
+#endif // MIDI_ACTION_MAP_H
@@ -0,0 +1,302 @@
+#ifndef MIDI_CLOCK_H
+#define MIDI_CLOCK_H
+
+#include <AudioUtils.h>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <thread>
+
+#define MIDI_CLOCK_PPQN 24
+#define MIDI_CLOCKS_PER_BAR (4 * MIDI_CLOCK_PPQN)
+#define MIDI_CLOCKS_PER_SONG_POSITION 6  // Song position counts sixteenth notes
+
+// MIDI system real-time and common messages
+#define MIDI_TIMING_CLOCK 0xF8
+#define MIDI_START 0xFA
+#define MIDI_CONTINUE 0xFB
+#define MIDI_STOP 0xFC
+#define MIDI_SONG_POSITION 0xF2
+
+// The sender sleeps until this long before a message is due and spins for the rest, since sleeps overshoot by
+// tens of microseconds
+#define MIDI_CLOCK_SPIN_US 200
+
+// How long the sender sleeps when nothing is queued or transport is stopped
+#define MIDI_CLOCK_IDLE_US 500
+
+// The device clock and the steady clock drift apart by parts per million; each chunk moves the frame-to-time
+// anchor this fraction of the way toward the callback's own estimate, which jitters by the callback period
+#define MIDI_CLOCK_DRIFT_SMOOTHING 256
+
+// Send lateness is also counted in 10 us bins for percentiles; the last bin holds anything longer
+#define MIDI_CLOCK_HISTOGRAM_BINS 200
+#define MIDI_CLOCK_HISTOGRAM_BIN_US 10
+
+struct MidiClockEvent {
+    uint8_t status = 0;
+    uint16_t song_position = 0;  // Sixteenth notes, for MIDI_SONG_POSITION
+    std::chrono::steady_clock::time_point due;
+};
+
+struct MidiClockStatistics {
+    size_t n_clocks = 0;
+    size_t n_dropped = 0;       // Events that did not fit in the queue
+    double max_late_us = 0.0;   // Furthest a message went out after its due time
+    double total_late_us = 0.0;
+    size_t n_sent = 0;
+    size_t histogram[MIDI_CLOCK_HISTOGRAM_BINS] = {};
+
+    double averageLateUs() const {
+        return n_sent > 0 ? total_late_us / n_sent : 0.0;
+    }
+
+    void add(double late_us) {
+        max_late_us = std::max(max_late_us, late_us);
+        total_late_us += late_us;
+        n_sent++;
+
+        size_t bin = late_us > 0.0 ? static_cast<size_t>(late_us / MIDI_CLOCK_HISTOGRAM_BIN_US) : 0;
+        histogram[std::min(bin, static_cast<size_t>(MIDI_CLOCK_HISTOGRAM_BINS - 1))]++;
+    }
+
+    // Upper edge of the bin holding the `percentile`-th lateness, capped at the max
+    double percentileUs(double percentile) const {
+        if (n_sent == 0) return 0.0;
+
+        size_t rank = static_cast<size_t>(percentile / 100.0 * n_sent + 0.5);
+        rank = std::max(static_cast<size_t>(1), std::min(n_sent, rank));
+
+        size_t seen = 0;
+        for (size_t bin = 0; bin < MIDI_CLOCK_HISTOGRAM_BINS; ++bin) {
+            seen += histogram[bin];
+            if (seen >= rank) return std::min(max_late_us, static_cast<double>((bin + 1) * MIDI_CLOCK_HISTOGRAM_BIN_US));
+        }
+        return max_late_us;
+    }
+};
+
+// MIDI clock (24 PPQN), start, stop, continue and song position for gear that follows the drum machine.
+//
+// The stream calls advance() for every chunk it hands out, on the audio thread. Clock positions are exact
+// fractions of the bar in 32.32 fixed point, counted in frames of the stream's own frame counter and restarted
+// on every downbeat, so they stay locked to the audio whatever the tempo. Each frame position is turned into
+// the time the frame reaches the output from a single anchor (the output time of frame 0), not from the
+// callback's arrival time, which jitters by the device's buffer period. The events go through a lock-free queue
+// to a sender thread that waits for each one's due time and hands it to `send`.
+class MidiClockOutput {
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::function<void(uint8_t status, uint16_t song_position)> Sender;
+
+    explicit MidiClockOutput(unsigned int sample_rate) : sample_rate(sample_rate) {}
+
+    ~MidiClockOutput() {
+        stop();
+    }
+
+    MidiClockOutput(const MidiClockOutput &) = delete;
+    MidiClockOutput &operator=(const MidiClockOutput &) = delete;
+
+    // Starts the sender thread; `init` runs on it first (real-time policy, for example)
+    void start(Sender send, std::function<void()> init = nullptr) {
+        if (sender_thread.joinable()) return;
+
+        this->send = std::move(send);
+        sending = true;
+        sender_thread = std::thread(&MidiClockOutput::senderThread, this, std::move(init));
+    }
+
+    // Sends MIDI_STOP and joins the sender
+    void stop() {
+        if (!sender_thread.joinable()) return;
+
+        sending = false;
+        sender_thread.join();
+    }
+
+    // Audio thread: `n_frames` frames starting at frame `first_frame` of the stream are about to be handed out,
+    // and `bar_start` if they start a bar of `bar_length_q32` frames. `estimated_output_time` is when the
+    // stream expects the first of them to reach the output.
+    void advance(bool bar_start, uint64_t first_frame, size_t n_frames, uint64_t bar_length_q32, Clock::time_point estimated_output_time) {
+        // Pauses shift every later frame; the estimate includes them, the anchor does not
+        Clock::duration paused = Clock::duration(paused_total.load(std::memory_order_acquire));
+        Clock::time_point estimate = estimated_output_time - paused;
+
+        if (!started) {
+            started = true;
+            anchor = estimate - framesToDuration(first_frame);
+            bar_first_frame = first_frame;
+            next_clock_q32 = 0;
+            clocks_in_bar = 0;
+            push(MIDI_START, 0, frameTime(first_frame));
+        } else {
+            Clock::duration error = estimate - frameTime(first_frame);
+            anchor += error / MIDI_CLOCK_DRIFT_SMOOTHING;
+        }
+
+        // Clock 0 of every bar lands exactly on the downbeat; a bar shortened by a tempo change mid-bar may
+        // leave a few clocks out
+        if (bar_start) {
+            bar_first_frame = first_frame;
+            next_clock_q32 = 0;
+            clocks_in_bar = 0;
+        }
+
+        uint64_t clock_q32 = bar_length_q32 / MIDI_CLOCKS_PER_BAR;
+        uint64_t end_frame = first_frame + n_frames;
+
+        while (clocks_in_bar < MIDI_CLOCKS_PER_BAR && nextClockFrame() < end_frame) {
+            push(MIDI_TIMING_CLOCK, 0, frameTime(nextClockFrame()));
+            next_clock_q32 += clock_q32;
+            clocks_in_bar++;
+        }
+    }
+
+    // Consumer thread: transport stops with the output and continues with it. Clocks queued for audio that
+    // had not played yet go out after the pause, moved by its length.
+    void pause() {
+        if (paused.load(std::memory_order_acquire)) return;
+
+        pause_start = Clock::now();
+        paused.store(true, std::memory_order_release);
+    }
+
+    void resume() {
+        if (!paused.load(std::memory_order_acquire)) return;
+
+        paused_total.fetch_add((Clock::now() - pause_start).count(), std::memory_order_acq_rel);
+        continue_pending.store(true, std::memory_order_release);
+        paused.store(false, std::memory_order_release);
+    }
+
+    // Read once the sender has stopped
+    MidiClockStatistics statistics() const {
+        MidiClockStatistics result = stats;
+        result.n_dropped = n_dropped.load(std::memory_order_relaxed);
+        return result;
+    }
+
+    void printStatistics() const {
+        MidiClockStatistics result = statistics();
+        printf(
+            "MIDI clock: %zu clocks (24 PPQN), %zu messages sent, late by avg %.0f us, p99 %.0f us, max %.0f us; %zu dropped\n",
+            result.n_clocks, result.n_sent, result.averageLateUs(), result.percentileUs(99.0), result.max_late_us, result.n_dropped
+        );
+    }
+
+private:
+    unsigned int sample_rate;
+    Sender send;
+
+    // Audio thread
+    bool started = false;
+    Clock::time_point anchor;      // Output time of frame 0, without pauses
+    uint64_t bar_first_frame = 0;
+    uint64_t next_clock_q32 = 0;   // Frames from the bar's first frame to the next clock, 32.32 fixed point
+    int clocks_in_bar = 0;
+    std::atomic<size_t> n_dropped{0};
+
+    boost::lockfree::spsc_queue<MidiClockEvent, boost::lockfree::capacity<1024>> events;
+
+    // Transport, set by the consumer thread
+    std::atomic<bool> paused{false};
+    std::atomic<bool> continue_pending{false};
+    std::atomic<Clock::rep> paused_total{0};
+    Clock::time_point pause_start;
+
+    // Sender thread
+    std::thread sender_thread;
+    std::atomic<bool> sending{false};
+    MidiClockStatistics stats;
+    size_t clocks_sent = 0;
+
+    Clock::duration framesToDuration(uint64_t frames) const {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(static_cast<double>(frames) / sample_rate));
+    }
+
+    Clock::time_point frameTime(uint64_t frame) const {
+        return anchor + framesToDuration(frame);
+    }
+
+    // Stream frame of the next clock, rounded. Clocks are counted from the bar's first frame, as the stream
+    // frame itself in 32.32 would overflow after 2^32 frames (27 hours at 44.1 kHz).
+    uint64_t nextClockFrame() const {
+        return bar_first_frame + ((next_clock_q32 + Q32_HALF) >> 32);
+    }
+
+    void push(uint8_t status, uint16_t song_position, Clock::time_point due) {
+        MidiClockEvent event;
+        event.status = status;
+        event.song_position = song_position;
+        event.due = due;
+
+        if (!events.push(event)) n_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void senderThread(std::function<void()> init) {
+        if (init) init();
+
+        MidiClockEvent event;
+        bool holding = false;
+        bool stopped = false;
+
+        while (sending.load(std::memory_order_acquire)) {
+            if (paused.load(std::memory_order_acquire)) {
+                if (!stopped) {
+                    send(MIDI_STOP, 0);
+                    stopped = true;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(MIDI_CLOCK_IDLE_US));
+                continue;
+            }
+
+            if (continue_pending.exchange(false, std::memory_order_acq_rel)) {
+                // Followers resume from the last whole sixteenth that was sent
+                send(MIDI_SONG_POSITION, static_cast<uint16_t>(clocks_sent / MIDI_CLOCKS_PER_SONG_POSITION));
+                send(MIDI_CONTINUE, 0);
+                stopped = false;
+            }
+
+            if (!holding && !events.pop(event)) {
+                std::this_thread::sleep_for(std::chrono::microseconds(MIDI_CLOCK_IDLE_US));
+                continue;
+            }
+            holding = true;
+
+            Clock::time_point due = event.due + Clock::duration(paused_total.load(std::memory_order_acquire));
+            if (!waitUntil(due)) continue;
+
+            send(event.status, event.song_position);
+            stats.add(std::chrono::duration<double, std::micro>(Clock::now() - due).count());
+            holding = false;
+
+            if (event.status == MIDI_TIMING_CLOCK) {
+                clocks_sent++;
+                stats.n_clocks++;
+            }
+        }
+
+        if (!stopped) send(MIDI_STOP, 0);
+    }
+
+    // Sleeps, then spins, until `due`; false if transport stopped or the sender was asked to stop meanwhile
+    bool waitUntil(Clock::time_point due) {
+        std::chrono::microseconds spin(MIDI_CLOCK_SPIN_US);
+        std::chrono::microseconds slice(MIDI_CLOCK_IDLE_US);
+
+        while (Clock::now() < due - spin) {
+            if (paused.load(std::memory_order_acquire) || !sending.load(std::memory_order_acquire)) return false;
+            std::this_thread::sleep_until(std::min(due - spin, Clock::now() + slice));
+        }
+
+        while (Clock::now() < due) {}
+        return true;
+    }
+};
+
+#endif // MIDI_CLOCK_H
@@ -0,0 +1,236 @@
+#ifndef MIX_PLAYHEAD_H
+#define MIX_PLAYHEAD_H
+
+#include <AudioUtils.h>
+#include <DrumMachineTrackData.h>
+#include <MasterLimiter.h>
+#include <TrackEffects.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// Turns the published StreamMix into the chunks the device plays, bar by bar: premixed bars are served straight
+// from the mix, polymetric states are summed, run through their live effects and limited chunk by chunk. It
+// owns no device state, so an offline renderer using the same chunk sizes produces exactly what the stream plays.
+class MixPlayhead {
+public:
+    typedef MasterLimiter<AUDIO_CHANNELS> LoopLimiter;
+
+    MixPlayhead(unsigned int sample_rate, unsigned int channels, size_t max_chunk_frames) :
+        sample_rate(sample_rate),
+        channels(channels),
+        max_chunk_frames(max_chunk_frames),
+        loop_limiter(32767.0f, sample_rate, max_chunk_frames) {
+        // Polymetric chunks (plus the limiter's look-ahead) are summed here, so the audio thread never allocates
+        loop_accumulator.resize((max_chunk_frames + LoopLimiter::lookaheadFrames()) * channels);
+        loop_chunk.resize(max_chunk_frames * channels);
+        live_track_frames.resize((max_chunk_frames + LoopLimiter::lookaheadFrames()) * channels);
+
+        // One effect chain per track, with its delay line allocated up front
+        live_chains.resize(N_TRACKS);
+        live_chain_last_chunk.assign(N_TRACKS, 0);
+    }
+
+    // Plays `mix` on the grid of `stats` from the current position on; both must stay valid until the next
+    // call. After a tempo change the loop clock is re-based onto the bar position, so full-bar tracks stay on
+    // the downbeat, and the current bar is re-timed.
+    void setMix(const StreamMix *mix, const LoopingStatistics *stats) {
+        bool tempo_changed = !curr_stats || curr_stats->bar_length_q32 != stats->bar_length_q32;
+        bool was_polymetric = curr_mix && curr_mix->isPolymetric();
+
+        curr_mix = mix;
+        curr_stats = stats;
+
+        if (tempo_changed) {
+            loop_clock_frames = position / channels;
+            timeCurrentBar();
+        }
+
+        if (!curr_mix->isPolymetric()) {
+            noteGainReduction(curr_mix->gain_reduction_db);
+        } else if (!was_polymetric) {
+            // The limiter's gain belongs to whatever loops played last
+            loop_limiter.reset();
+        }
+    }
+
+    bool atBarStart() const {
+        return position == 0;
+    }
+
+    // Hands out the next chunk of at most `max_frames` frames (and at most the constructor's `max_chunk_frames`)
+    // of the current bar. Returns false, and moves on to the next bar, once the bar has been played out.
+    bool nextChunk(size_t max_frames, const sf::Int16 *&samples, size_t &sample_count) {
+        max_frames = std::min(max_frames, max_chunk_frames);
+
+        if (position == 0) {
+            timeCurrentBar();
+        }
+
+        // Polymetric states have no bar-length buffer; the bar is then only a clock for bar-synchronized switches
+        size_t bar_samples = curr_bar_frames * channels;
+        if (!curr_mix->isPolymetric()) {
+            bar_samples = std::min(bar_samples, curr_mix->mix->size());
+        }
+
+        if (position >= bar_samples) {
+            finishBar();
+            position = 0;
+            return false;
+        }
+
+        sample_count = std::min(max_frames * channels, bar_samples - position);
+
+        if (curr_mix->isPolymetric()) {
+            samples = renderTrackLoops(sample_count / channels);
+        } else {
+            samples = &(*curr_mix->mix)[position];
+        }
+
+        position += sample_count;
+        loop_clock_frames += sample_count / channels;
+
+        return true;
+    }
+
+    void seek(size_t frame) {
+        position = frame * channels;
+    }
+
+    // Master limiter activity: bar-length mixes are limited when rendered and report their reduction when they
+    // start playing; polymetric loops are limited chunk by chunk here, which is what is timed
+    const LimiterStatistics &limiterStatistics() const {
+        return limiter_stats;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    unsigned int sample_rate;
+    unsigned int channels;
+    size_t max_chunk_frames;  // What the chunk buffers below are sized for
+
+    const StreamMix *curr_mix = nullptr;
+    const LoopingStatistics *curr_stats = nullptr;
+
+    size_t position = 0;  // Samples into the current bar
+
+    // Bars alternate between the floor and ceiling of the exact bar length: the fractional frame left over
+    // by each bar (32.32 fixed point) is carried into the next, so playback never drifts from the tempo
+    uint64_t bar_phase_q32 = Q32_HALF;
+    size_t curr_bar_frames = 0;
+
+    // Polymetric playback: each track loop plays at (loop_clock_frames mod its own exact length)
+    uint64_t loop_clock_frames = 0;
+    std::vector<float> loop_accumulator;
+    AudioStreamBuffer loop_chunk;
+
+    // Master limiter for polymetric playback; its stereo layout matches AUDIO_CHANNELS
+    LoopLimiter loop_limiter;
+    LimiterStatistics limiter_stats;
+
+    // Live effects: each track loop with live effects is summed alone into live_track_frames and run through
+    // its track's chain. A chain not used in the previous chunk starts clean.
+    std::vector<TrackEffectChain<AUDIO_CHANNELS>> live_chains;
+    std::vector<size_t> live_chain_last_chunk;
+    std::vector<float> live_track_frames;
+    size_t loop_chunks_rendered = 0;
+
+    // Length of the bar that starts (or, after a tempo change, continues) at the carried phase
+    void timeCurrentBar() {
+        curr_bar_frames = static_cast<size_t>((bar_phase_q32 + curr_stats->bar_length_q32) >> 32);
+    }
+
+    void finishBar() {
+        bar_phase_q32 = (bar_phase_q32 + curr_stats->bar_length_q32) & Q32_FRACTION_MASK;
+    }
+
+    // Sums every track loop (through its live effects, if any) for the next `n_frames` plus the limiter's
+    // look-ahead, then limits the chunk. The look-ahead frames are summed again by the next chunk.
+    const sf::Int16 *renderTrackLoops(size_t n_frames) {
+        size_t lookahead_frames = LoopLimiter::lookaheadFrames();
+        size_t n_summed = n_frames + lookahead_frames;
+        std::fill(loop_accumulator.begin(), loop_accumulator.begin() + n_summed * channels, 0.0f);
+
+        loop_chunks_rendered++;
+
+        for (const TrackLoop &loop : curr_mix->track_loops) {
+            if (loop.live_effects.effects == 0 || loop.track_id >= live_chains.size()) {
+                sumTrackLoop(loop, loop_accumulator.data(), n_summed, loop.gain);
+                continue;
+            }
+
+            std::fill(live_track_frames.begin(), live_track_frames.begin() + n_summed * channels, 0.0f);
+            sumTrackLoop(loop, live_track_frames.data(), n_summed, 1.0f / 32767.0f);
+
+            TrackEffectChain<AUDIO_CHANNELS> &chain = live_chains[loop.track_id];
+            chain.setSettings(loop.live_effects);
+            if (live_chain_last_chunk[loop.track_id] + 1 != loop_chunks_rendered) chain.reset();
+            live_chain_last_chunk[loop.track_id] = loop_chunks_rendered;
+
+            chain.processStream(live_track_frames.data(), n_frames, lookahead_frames);
+
+            float gain = loop.gain * 32767.0f;
+            for (size_t i = 0; i < n_summed * channels; ++i) {
+                loop_accumulator[i] += live_track_frames[i] * gain;
+            }
+        }
+
+        Clock::time_point limit_start = Clock::now();
+        loop_limiter.processStream(loop_accumulator.data(), n_frames, lookahead_frames);
+        limiter_stats.seconds += std::chrono::duration<double>(Clock::now() - limit_start).count();
+        limiter_stats.frames += n_frames;
+        noteGainReduction(loop_limiter.statistics().last_gain_reduction_db);
+
+        size_t n_samples = n_frames * channels;
+        for (size_t i = 0; i < n_samples; ++i) {
+            loop_chunk[i] = SampleTraits<sf::Int16>::saturate(loop_accumulator[i]);
+        }
+
+        return loop_chunk.data();
+    }
+
+    // Adds `n_frames` of the loop, starting at the loop clock, into `out` at `gain`. Each loop wraps at its own
+    // length in whole segments.
+    void sumTrackLoop(const TrackLoop &loop, float *out, size_t n_frames, float gain) {
+        const AudioStreamBuffer &buffer = *loop.buffer;
+        size_t loop_frames = buffer.size() / channels;
+        if (loop_frames == 0) return;
+
+        size_t written = 0;
+
+        while (written < n_frames) {
+            // Phase within the cycle, rounded to the nearest frame; the cycle restarts where it crosses the length
+            uint64_t phase_q32 = loopPhase(loop_clock_frames + written, loop.length_q32);
+            size_t loop_position = static_cast<size_t>(phase_q32 >> 32);
+            size_t frames_to_wrap = static_cast<size_t>((loop.length_q32 - phase_q32 + Q32_FRACTION_MASK) >> 32);
+
+            size_t segment = std::min(n_frames - written, std::min(frames_to_wrap, loop_frames - loop_position));
+            const sf::Int16 *in = buffer.data() + loop_position * channels;
+            float *segment_out = out + written * channels;
+
+            for (size_t i = 0; i < segment * channels; ++i) {
+                segment_out[i] += in[i] * gain;
+            }
+
+            written += segment;
+        }
+    }
+
+    // (clock_frames in 32.32, plus half a frame) mod length_q32. Shifting the clock up in one step would overflow
+    // after 2^32 frames (27 hours at 44.1 kHz), so it is reduced first and doubled a bit at a time.
+    static uint64_t loopPhase(uint64_t clock_frames, uint64_t length_q32) {
+        uint64_t phase = clock_frames % length_q32;
+        for (int bit = 0; bit < 32; ++bit) {
+            phase = phase >= length_q32 - phase ? phase - (length_q32 - phase) : phase << 1;
+        }
+        return phase >= length_q32 - Q32_HALF ? phase - (length_q32 - Q32_HALF) : phase + Q32_HALF;
+    }
+
+    void noteGainReduction(float gain_reduction_db) {
+        limiter_stats.last_gain_reduction_db = gain_reduction_db;
+        limiter_stats.max_gain_reduction_db = std::max(limiter_stats.max_gain_reduction_db, gain_reduction_db);
+    }
+};
+
+#endif // MIX_PLAYHEAD_H
@@ -0,0 +1,174 @@
+#ifndef MIXED_BUS_STREAM_H
+#define MIXED_BUS_STREAM_H
+
+#include <SFML/Audio.hpp>
+#include <AudioUtils.h>
+#include <MasterLimiter.h>
+#include <SwitchingSoundStream.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Each session enters the shared bus at this fixed gain, so starting or stopping one session never changes
+// the level of the others; the bus limiter catches what the sum still overshoots
+#define SESSION_BUS_GAIN 0.5f
+
+struct BusStatistics {
+    size_t frames = 0;
+    double seconds = 0.0;        // Time spent mixing, including every source's own chunk work
+    double max_chunk_us = 0.0;
+
+    double cpuShare(unsigned int sample_rate) const {
+        return frames > 0 ? seconds * sample_rate / frames : 0.0;
+    }
+};
+
+// Plays several SwitchingSoundStreams through one device: each callback pulls the same number of frames from
+// every source, sums them at SESSION_BUS_GAIN and limits the sum. The limiter looks LIMITER_LOOKAHEAD_BLOCKS
+// blocks ahead, so the bus runs that many frames behind its sources. Sources must not be played themselves.
+class MixedBusStream : public sf::SoundStream {
+public:
+    typedef MasterLimiter<AUDIO_CHANNELS> BusLimiter;
+
+    MixedBusStream(unsigned int sample_rate, unsigned int channels) :
+        channels(channels),
+        limiter(32767.0f, sample_rate, MAX_CHUNK_FRAMES) {
+        initialize(channels, sample_rate);
+
+        bus.resize((MAX_CHUNK_FRAMES + BusLimiter::lookaheadFrames()) * channels);
+        out.resize(MAX_CHUNK_FRAMES * channels);
+    }
+
+    // Sources are added before the bus starts playing and must outlive it
+    void addSource(SwitchingSoundStream *source) {
+        std::lock_guard<std::mutex> lock(mtx);
+        sources.push_back(source);
+    }
+
+    size_t sourceCount() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return sources.size();
+    }
+
+    void setChunkFrames(size_t frames) {
+        std::lock_guard<std::mutex> lock(mtx);
+        chunk_frames = std::max(static_cast<size_t>(MIN_CHUNK_FRAMES), std::min(static_cast<size_t>(MAX_CHUNK_FRAMES), frames));
+    }
+
+    // Runs once on the audio thread, before it produces its first chunk
+    void setAudioThreadInit(std::function<void()> init) {
+        std::lock_guard<std::mutex> lock(mtx);
+        audio_thread_init = std::move(init);
+    }
+
+    // Mixes the next `n_frames` (at most MAX_CHUNK_FRAMES) of every source. The samples stay valid until the
+    // next call. Used by the device callback, and directly by benchmarks.
+    const sf::Int16 *mixChunk(size_t n_frames) {
+        std::lock_guard<std::mutex> lock(mtx);
+        return mixChunkLocked(std::min(n_frames, static_cast<size_t>(MAX_CHUNK_FRAMES)));
+    }
+
+    BusStatistics getStatistics() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return stats;
+    }
+
+    LimiterStatistics getLimiterStatistics() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return limiter.statistics();
+    }
+
+protected:
+    virtual bool onGetData(Chunk &data) override {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        if (audio_thread_init) {
+            audio_thread_init();
+            audio_thread_init = nullptr;
+        }
+
+        data.samples = mixChunkLocked(chunk_frames);
+        data.sampleCount = chunk_frames * channels;
+        return true;
+    }
+
+    virtual void onSeek(sf::Time) override {
+        // The bus has no position of its own; every source keeps its place
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    unsigned int channels;
+    std::mutex mtx;
+
+    std::vector<SwitchingSoundStream *> sources;
+    size_t chunk_frames = DEFAULT_CHUNK_FRAMES;
+    std::function<void()> audio_thread_init;
+
+    // Summed frames not handed out yet: the limiter's look-ahead, carried into the next chunk
+    std::vector<float> bus;
+    size_t bus_frames = 0;
+    AudioStreamBuffer out;
+
+    BusLimiter limiter;
+    BusStatistics stats;
+
+    const sf::Int16 *mixChunkLocked(size_t n_frames) {
+        Clock::time_point start = Clock::now();
+
+        size_t lookahead_frames = BusLimiter::lookaheadFrames();
+        size_t needed = n_frames + lookahead_frames;
+        std::fill(bus.begin() + bus_frames * channels, bus.begin() + needed * channels, 0.0f);
+
+        for (SwitchingSoundStream *source : sources) {
+            sumSource(*source, bus.data() + bus_frames * channels, needed - bus_frames);
+        }
+
+        limiter.processStream(bus.data(), n_frames, lookahead_frames);
+
+        for (size_t i = 0; i < n_frames * channels; ++i) {
+            out[i] = SampleTraits<sf::Int16>::saturate(bus[i]);
+        }
+
+        // The look-ahead frames become the start of the next chunk
+        std::memmove(bus.data(), bus.data() + n_frames * channels, lookahead_frames * channels * sizeof(float));
+        bus_frames = lookahead_frames;
+
+        double chunk_us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        stats.seconds += chunk_us * 1e-6;
+        stats.max_chunk_us = std::max(stats.max_chunk_us, chunk_us);
+        stats.frames += n_frames;
+
+        return out.data();
+    }
+
+    // Adds the source's next `n_frames` into `dest`, across bar boundaries; a held source adds nothing
+    void sumSource(SwitchingSoundStream &source, float *dest, size_t n_frames) {
+        size_t written = 0;
+        int misses = 0;
+
+        while (written < n_frames && misses < 2) {
+            const sf::Int16 *samples = nullptr;
+            size_t sample_count = 0;
+
+            // A bar boundary costs one empty call; two in a row mean the source is held
+            if (!source.pullChunk(n_frames - written, samples, sample_count) || sample_count == 0) {
+                misses++;
+                continue;
+            }
+            misses = 0;
+
+            float *segment = dest + written * channels;
+            for (size_t i = 0; i < sample_count; ++i) {
+                segment[i] += samples[i] * SESSION_BUS_GAIN;
+            }
+            written += sample_count / channels;
+        }
+    }
+};
+
+#endif // MIXED_BUS_STREAM_H
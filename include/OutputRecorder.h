@@ -0,0 +1,356 @@
+#ifndef OUTPUT_RECORDER_H
+#define OUTPUT_RECORDER_H
+
+#include <WavFile.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#ifdef RECORDER_USE_IO_URING
+#include <liburing.h>
+#endif
+
+// Audio the ring holds before the writer falls behind (rounded up to a power of two samples)
+#define RECORDER_RING_SECONDS 4
+
+// The writer hands the disk blocks of this size, at offsets aligned to RECORDER_WRITE_ALIGN; the WAV header
+// is padded to one alignment unit so the samples start on a boundary too
+#define RECORDER_BLOCK_BYTES (256 * 1024)
+#define RECORDER_WRITE_ALIGN 4096
+
+// How long the writer sleeps when less than a block is waiting
+#define RECORDER_POLL_MS 10
+
+struct RecorderStatistics {
+    size_t frames_recorded = 0;  // Frames that reached the ring
+    size_t frames_dropped = 0;   // Frames of chunks that did not fit in the ring
+    size_t n_overruns = 0;       // Chunks dropped
+    double max_push_us = 0.0;    // Longest time the audio thread spent handing over a chunk
+    size_t bytes_written = 0;
+    size_t n_write_errors = 0;
+};
+
+// Records what the stream hands to the device. The audio thread copies each chunk into a preallocated
+// single-producer/single-consumer ring and never waits: a chunk that does not fit is dropped and counted.
+// A writer thread drains the ring into a WAV file in large aligned blocks, with pwrite() or, in builds with
+// RECORDER_USE_IO_URING (Linux, liburing), io_uring with one block in flight while the next is filled.
+class OutputRecorder {
+public:
+    OutputRecorder(unsigned int sample_rate, unsigned int channels) :
+        sample_rate(sample_rate),
+        channels(channels) {
+        size_t wanted = static_cast<size_t>(RECORDER_RING_SECONDS) * sample_rate * channels;
+        ring_capacity = 1;
+        while (ring_capacity < wanted) ring_capacity <<= 1;
+
+        ring = new int16_t[ring_capacity]();
+        for (int i = 0; i < 2; ++i) {
+            if (posix_memalign(reinterpret_cast<void **>(&blocks[i]), RECORDER_WRITE_ALIGN, RECORDER_BLOCK_BYTES) != 0) {
+                blocks[i] = nullptr;
+            }
+        }
+    }
+
+    ~OutputRecorder() {
+        stop();
+
+        delete[] ring;
+        free(blocks[0]);
+        free(blocks[1]);
+    }
+
+    OutputRecorder(const OutputRecorder &) = delete;
+    OutputRecorder &operator=(const OutputRecorder &) = delete;
+
+    // Creates `path` and starts the writer thread; false if the file cannot be created
+    bool start(const std::string &path) {
+        if (recording() || !blocks[0] || !blocks[1]) return false;
+
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::cerr << "Error: cannot record to " << path << ": " << strerror(errno) << "\n";
+            return false;
+        }
+
+#ifdef RECORDER_USE_IO_URING
+        uring_ready = io_uring_queue_init(2, &uring, 0) == 0;
+        if (!uring_ready) std::cerr << "io_uring unavailable, recording with pwrite\n";
+#endif
+
+        this->path = path;
+        file_offset = RECORDER_WRITE_ALIGN;
+        data_bytes = 0;
+        stopping.store(false, std::memory_order_relaxed);
+        active.store(true, std::memory_order_release);
+
+        writer_thread = std::thread(&OutputRecorder::writerThread, this);
+        return true;
+    }
+
+    // Writes out what is left in the ring, finalizes the header and closes the file
+    void stop() {
+        if (!recording()) return;
+
+        active.store(false, std::memory_order_release);
+        stopping.store(true, std::memory_order_release);
+        if (writer_thread.joinable()) writer_thread.join();
+
+        ::close(fd);
+        fd = -1;
+    }
+
+    bool recording() const {
+        return fd >= 0;
+    }
+
+    // Audio thread: copies `n_samples` interleaved samples into the ring, or drops them if they do not fit.
+    // Never blocks and never allocates.
+    void push(const int16_t *samples, size_t n_samples) {
+        if (!active.load(std::memory_order_acquire)) return;
+
+        Clock::time_point start = Clock::now();
+
+        size_t head = ring_head.load(std::memory_order_relaxed);
+        size_t tail = ring_tail.load(std::memory_order_acquire);
+        size_t n_frames = n_samples / channels;
+
+        if (ring_capacity - (head - tail) < n_samples) {
+            overruns.fetch_add(1, std::memory_order_relaxed);
+            frames_dropped.fetch_add(n_frames, std::memory_order_relaxed);
+        } else {
+            size_t offset = head & (ring_capacity - 1);
+            size_t first = std::min(n_samples, ring_capacity - offset);
+            memcpy(ring + offset, samples, first * sizeof(int16_t));
+            memcpy(ring, samples + first, (n_samples - first) * sizeof(int16_t));
+
+            ring_head.store(head + n_samples, std::memory_order_release);
+            frames_recorded.fetch_add(n_frames, std::memory_order_relaxed);
+        }
+
+        // Only the audio thread writes this, so a plain compare-and-store is enough
+        double push_us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        if (push_us > max_push_us.load(std::memory_order_relaxed)) {
+            max_push_us.store(push_us, std::memory_order_relaxed);
+        }
+    }
+
+    RecorderStatistics statistics() const {
+        RecorderStatistics stats;
+        stats.frames_recorded = frames_recorded.load(std::memory_order_relaxed);
+        stats.frames_dropped = frames_dropped.load(std::memory_order_relaxed);
+        stats.n_overruns = overruns.load(std::memory_order_relaxed);
+        stats.max_push_us = max_push_us.load(std::memory_order_relaxed);
+        stats.bytes_written = bytes_written.load(std::memory_order_relaxed);
+        stats.n_write_errors = write_errors.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void printStatistics() const {
+        RecorderStatistics stats = statistics();
+        printf(
+            "Recording %s: %.1f s, %zu overruns (%zu frames dropped), %.1f MB written, %zu write errors, max %.1f us per chunk on the audio thread\n",
+            path.c_str(), static_cast<double>(stats.frames_recorded) / sample_rate, stats.n_overruns, stats.frames_dropped,
+            stats.bytes_written / 1048576.0, stats.n_write_errors, stats.max_push_us
+        );
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    unsigned int sample_rate;
+    unsigned int channels;
+    std::string path;
+
+    // Ring of interleaved samples; head and tail only grow and are masked into it
+    int16_t *ring = nullptr;
+    size_t ring_capacity = 0;
+    std::atomic<size_t> ring_head{0};  // Written by the audio thread
+    std::atomic<size_t> ring_tail{0};  // Written by the writer thread
+
+    std::atomic<bool> active{false};
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> frames_recorded{0};
+    std::atomic<size_t> frames_dropped{0};
+    std::atomic<size_t> overruns{0};
+    std::atomic<double> max_push_us{0.0};
+    std::atomic<size_t> bytes_written{0};
+    std::atomic<size_t> write_errors{0};
+
+    // Writer side: two aligned blocks, so one can be filled while the other is being written
+    std::thread writer_thread;
+    unsigned char *blocks[2] = {nullptr, nullptr};
+    int fd = -1;
+    size_t file_offset = 0;  // Where the next block goes
+    size_t data_bytes = 0;
+
+#ifdef RECORDER_USE_IO_URING
+    struct io_uring uring;
+    bool uring_ready = false;
+    bool write_in_flight = false;
+
+    // What the write in flight still has to write; a short write is resubmitted from where it stopped
+    const unsigned char *flight_data = nullptr;
+    size_t flight_bytes = 0;
+    size_t flight_offset = 0;
+    size_t flight_done = 0;  // Bytes of the block already written
+#endif
+
+    void writerThread() {
+        size_t block_samples = RECORDER_BLOCK_BYTES / sizeof(int16_t);
+        int next_block = 0;
+
+        // An empty header first, so an interrupted recording is still a readable file up to its last block
+        writeHeader();
+
+        while (true) {
+            bool finishing = stopping.load(std::memory_order_acquire);
+            size_t tail = ring_tail.load(std::memory_order_relaxed);
+            size_t available = ring_head.load(std::memory_order_acquire) - tail;
+
+            if (available < block_samples && !finishing) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(RECORDER_POLL_MS));
+                continue;
+            }
+
+            size_t n_samples = std::min(available, block_samples);
+            if (n_samples == 0) break;
+
+            // Copying out frees the ring right away, before the disk is touched
+            unsigned char *block = blocks[next_block];
+            size_t offset = tail & (ring_capacity - 1);
+            size_t first = std::min(n_samples, ring_capacity - offset);
+            memcpy(block, ring + offset, first * sizeof(int16_t));
+            memcpy(block + first * sizeof(int16_t), ring, (n_samples - first) * sizeof(int16_t));
+            ring_tail.store(tail + n_samples, std::memory_order_release);
+
+            writeBlock(block, n_samples * sizeof(int16_t));
+            next_block = 1 - next_block;
+        }
+
+        finishWrites();
+        writeHeader();
+
+#ifdef RECORDER_USE_IO_URING
+        if (uring_ready) io_uring_queue_exit(&uring);
+        uring_ready = false;
+#endif
+    }
+
+    void writeBlock(const unsigned char *block, size_t n_bytes) {
+#ifdef RECORDER_USE_IO_URING
+        if (uring_ready) {
+            // The block written before this one used the other buffer; it must land before that buffer is refilled
+            finishWrites();
+
+            // The block is counted once it has landed (see finishWrites())
+            flight_data = block;
+            flight_bytes = n_bytes;
+            flight_offset = file_offset;
+            flight_done = 0;
+            submitWrite();
+            return;
+        }
+#endif
+
+        size_t done = 0;
+        while (done < n_bytes) {
+            ssize_t written = pwrite(fd, block + done, n_bytes - done, static_cast<off_t>(file_offset + done));
+            if (written <= 0) {
+                if (written < 0 && errno == EINTR) continue;
+                write_errors.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            done += static_cast<size_t>(written);
+        }
+
+        advance(done);
+    }
+
+#ifdef RECORDER_USE_IO_URING
+    // Queues what is left of the write in flight
+    void submitWrite() {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&uring);
+        if (!sqe) {
+            write_errors.fetch_add(1, std::memory_order_relaxed);
+            write_in_flight = false;
+            return;
+        }
+
+        io_uring_prep_write(
+            sqe, fd, flight_data, static_cast<unsigned>(flight_bytes), static_cast<off_t>(flight_offset)
+        );
+        io_uring_submit(&uring);
+        write_in_flight = true;
+    }
+#endif
+
+    // Waits until the io_uring write in flight, if any, has been written in full. Like the pwrite path, a short
+    // write is continued from where it stopped and an interrupted one is retried; a failed or empty write counts
+    // as an error and the rest of the block is dropped. Only what was written is counted.
+    void finishWrites() {
+#ifdef RECORDER_USE_IO_URING
+        if (!uring_ready || !write_in_flight) return;
+
+        while (write_in_flight) {
+            struct io_uring_cqe *cqe = nullptr;
+            int waited = io_uring_wait_cqe(&uring, &cqe);
+            if (waited == -EINTR) continue;
+            if (waited < 0) {
+                write_errors.fetch_add(1, std::memory_order_relaxed);
+                write_in_flight = false;
+                break;
+            }
+
+            int res = cqe->res;
+            io_uring_cqe_seen(&uring, cqe);
+            write_in_flight = false;
+
+            if (res == -EINTR || res == -EAGAIN) {
+                submitWrite();
+            } else if (res <= 0) {
+                write_errors.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                flight_done += static_cast<size_t>(res);
+                if (static_cast<size_t>(res) < flight_bytes) {
+                    flight_data += res;
+                    flight_bytes -= static_cast<size_t>(res);
+                    flight_offset += static_cast<size_t>(res);
+                    submitWrite();
+                }
+            }
+        }
+
+        advance(flight_done);
+#endif
+    }
+
+    // Counts `n_bytes` written at the end of the data. A block cut short by a failed write is counted up to
+    // its last whole frame, so the next block starts on a frame and the header covers only written audio.
+    void advance(size_t n_bytes) {
+        n_bytes -= n_bytes % (channels * sizeof(int16_t));
+        file_offset += n_bytes;
+        data_bytes += n_bytes;
+        bytes_written.fetch_add(n_bytes, std::memory_order_relaxed);
+    }
+
+    void writeHeader() {
+        unsigned char header[RECORDER_WRITE_ALIGN];
+        WavWriter::fillHeader(header, sample_rate, channels, data_bytes, RECORDER_WRITE_ALIGN);
+
+        if (pwrite(fd, header, RECORDER_WRITE_ALIGN, 0) != RECORDER_WRITE_ALIGN) {
+            write_errors.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
+
+#endif // OUTPUT_RECORDER_H
@@ -0,0 +1,197 @@
+#ifndef PATTERN_BANK_H
+#define PATTERN_BANK_H
+
+#include <DrumRenderEngine.h>
+#include <WorkStealingPool.h>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// A bank of patterns that share one tempo. Edits go to the active pattern; every other pattern is kept
+// rendered in the background, so selecting one only has to publish a mix that already exists. Background
+// renders run on the bank's own thread, or on a pool shared with other banks when one is given.
+template <typename Config>
+class PatternBank {
+public:
+    typedef DrumRenderEngine<Config> Engine;
+    typedef typename Config::Sequence Sequence;
+
+    struct Pattern {
+        // Held while the pattern's sequence, stems or mix are read or modified
+        std::mutex mtx;
+
+        Sequence sequence_data;
+        Engine engine;
+        StreamMix mix;
+
+        // Set when the sequence changed without re-rendering the mix
+        bool stale = true;
+
+        Pattern(SampleBank<typename Config::sample_t, Config::n_channels> &bank, RenderCache<Config> *cache) :
+            engine(bank, sequence_data.bpm, cache) {}
+
+        void render() {
+            engine.setTempo(sequence_data);
+            mix = engine.renderMix(sequence_data);
+            stale = false;
+        }
+    };
+
+    PatternBank(
+        SampleBank<typename Config::sample_t, Config::n_channels> &bank,
+        RenderCache<Config> *cache,
+        WorkStealingPool *render_pool = nullptr
+    ) :
+        render_pool(render_pool) {
+        for (int i = 0; i < N_PATTERNS; ++i) {
+            patterns[i].reset(new Pattern(bank, cache));
+        }
+
+        if (!render_pool) {
+            render_thread = std::thread(&PatternBank::renderThread, this);
+        }
+        requestRender();
+    }
+
+    ~PatternBank() {
+        {
+            std::unique_lock<std::mutex> lock(worker_mtx);
+            stopping = true;
+
+            // A render already queued on the shared pool still refers to this bank
+            worker_cv.wait(lock, [this]() { return !render_scheduled; });
+        }
+        worker_cv.notify_one();
+
+        if (render_thread.joinable()) {
+            render_thread.join();
+        }
+    }
+
+    pattern_id_t activeId() const {
+        return active_id;
+    }
+
+    // Only the consumer thread edits the active pattern, and it must hold the pattern's mutex while doing so
+    Pattern &active() {
+        return *patterns[active_id];
+    }
+
+    // Makes `pattern_id` the pattern that receives edits and returns its mix and looping statistics.
+    // Renders here only if the background thread has not caught up with the pattern yet. Returns false, and
+    // leaves the active pattern as it is, for ids of patterns the bank does not have.
+    bool select(pattern_id_t pattern_id, StreamMix &mix, typename Config::Stats &stats) {
+        if (pattern_id >= N_PATTERNS) {
+            std::cerr << "Error: pattern " << static_cast<int>(pattern_id) << " is out of range.\n";
+            return false;
+        }
+
+        Pattern &pattern = *patterns[pattern_id];
+        std::lock_guard<std::mutex> lock(pattern.mtx);
+
+        if (pattern.stale) {
+            printf("Pattern %d was not pre-rendered yet, rendering now\n", pattern_id);
+            pattern.render();
+        }
+
+        active_id = pattern_id;
+        stats = pattern.engine.stats();
+        mix = pattern.mix;
+        return true;
+    }
+
+    // Moves every inactive pattern to the tempo and swing of `source`; they are re-rendered in the background
+    void setTempo(const Sequence &source) {
+        for (int i = 0; i < N_PATTERNS; ++i) {
+            if (i == active_id) continue;
+
+            Pattern &pattern = *patterns[i];
+            std::lock_guard<std::mutex> lock(pattern.mtx);
+            Sequence &sequence_data = pattern.sequence_data;
+
+            if (sequence_data.bpm != source.bpm || sequence_data.bpm_fraction != source.bpm_fraction ||
+                sequence_data.swing != source.swing) {
+                sequence_data.bpm = source.bpm;
+                sequence_data.bpm_fraction = source.bpm_fraction;
+                sequence_data.swing = source.swing;
+                pattern.stale = true;
+            }
+        }
+
+        requestRender();
+    }
+
+    // Wakes the background thread (or queues a task on the shared pool) to render every stale pattern,
+    // including the active one
+    void requestRender() {
+        {
+            std::lock_guard<std::mutex> lock(worker_mtx);
+            render_requested = true;
+
+            if (render_pool) {
+                // At most one task per bank is queued; it keeps going while new requests arrive
+                if (!render_scheduled && !stopping) {
+                    render_scheduled = true;
+                    render_pool->submit([this]() { renderOnPool(); });
+                }
+                return;
+            }
+        }
+        worker_cv.notify_one();
+    }
+
+private:
+    std::unique_ptr<Pattern> patterns[N_PATTERNS];
+    pattern_id_t active_id = 0;
+
+    WorkStealingPool *render_pool;
+    std::thread render_thread;
+    std::mutex worker_mtx;
+    std::condition_variable worker_cv;
+    bool render_requested = false;
+    bool render_scheduled = false;  // A task for this bank is queued or running on the pool
+    bool stopping = false;
+
+    void renderThread() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(worker_mtx);
+                worker_cv.wait(lock, [this]() { return stopping || render_requested; });
+
+                if (stopping) return;
+                render_requested = false;
+            }
+
+            renderStalePatterns();
+        }
+    }
+
+    void renderOnPool() {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(worker_mtx);
+                if (!render_requested || stopping) {
+                    render_scheduled = false;
+                    worker_cv.notify_all();
+                    return;
+                }
+                render_requested = false;
+            }
+
+            renderStalePatterns();
+        }
+    }
+
+    void renderStalePatterns() {
+        for (int i = 0; i < N_PATTERNS; ++i) {
+            Pattern &pattern = *patterns[i];
+            std::lock_guard<std::mutex> lock(pattern.mtx);
+
+            if (pattern.stale) pattern.render();
+        }
+    }
+};
+
+#endif // PATTERN_BANK_H
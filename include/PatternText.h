@@ -0,0 +1,255 @@
+#ifndef PATTERN_TEXT_H
+#define PATTERN_TEXT_H
+
+#include <DrumMachineTrackData.h>
+#include <InstrumentLUT.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Text description of a batch of patterns, one setting per line ('#' starts a comment):
+//
+//   pattern four_on_the_floor       starts a pattern; the name becomes the output file name
+//   bpm 124.5                       tempo with up to two decimals
+//   swing 56                        50 (straight) to 75
+//   bars 4                          bars to render (overrides the command line)
+//   track 0 instrument 3 steps x...x...x...x...
+//   track 1 steps ..2...3. length 7/8 volume 0.6 pitch -300 muted
+//   track 2 effect cutoff=60 effect resonance=40 live filter,delay
+//   snapshot 78003214...            a whole sequence as the hex of its serialized snapshot
+//
+// Steps are '.' for a rest, 'x' for a normal hit or 0-3 for a hit at that velocity level. Effect names are
+// cutoff, resonance, drive, delay, feedback and mix; `live` takes effect names or `none`.
+template <typename Sequence>
+struct PatternDescription {
+    std::string name;
+    Sequence sequence_data;
+    size_t bars = 0;  // 0 keeps the renderer's default
+};
+
+template <typename Sequence>
+class PatternTextParser {
+public:
+    typedef typename Sequence::step_mask_t step_mask_t;
+    typedef PatternDescription<Sequence> Description;
+
+    // Appends the patterns in `path` to `patterns`; reports the first error with its line and returns false
+    static bool parseFile(const std::string &path, std::vector<Description> &patterns) {
+        std::ifstream in(path);
+        if (!in) {
+            std::cerr << "Error: cannot open " << path << "\n";
+            return false;
+        }
+
+        std::string line;
+        size_t line_number = 0;
+        Description *current = nullptr;
+
+        while (std::getline(in, line)) {
+            line_number++;
+
+            size_t comment = line.find('#');
+            if (comment != std::string::npos) line.erase(comment);
+
+            std::istringstream words(line);
+            std::string keyword;
+            if (!(words >> keyword)) continue;
+
+            std::string error;
+            if (keyword == "pattern") {
+                patterns.emplace_back();
+                current = &patterns.back();
+                if (!(words >> current->name)) error = "pattern needs a name";
+            } else if (!current) {
+                error = "setting before the first `pattern` line";
+            } else {
+                error = parseSetting(keyword, words, *current);
+            }
+
+            if (!error.empty()) {
+                std::cerr << "Error: " << path << ":" << line_number << ": " << error << "\n";
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    static std::string parseSetting(const std::string &keyword, std::istringstream &words, Description &pattern) {
+        Sequence &sequence_data = pattern.sequence_data;
+        std::string value;
+
+        if (keyword == "bpm") {
+            if (!(words >> value) || !parseTempo(value, sequence_data)) return "invalid tempo";
+        } else if (keyword == "swing") {
+            int swing;
+            if (!(words >> swing) || !Sequence::isValidGroove(sequence_data.bpm_fraction, swing)) return "invalid swing";
+            sequence_data.swing = static_cast<uint8_t>(swing);
+        } else if (keyword == "bars") {
+            long bars;
+            if (!(words >> bars) || bars < 1) return "invalid bar count";
+            pattern.bars = static_cast<size_t>(bars);
+        } else if (keyword == "track") {
+            int track_id;
+            if (!(words >> track_id) || track_id < 0 || track_id >= Sequence::n_tracks) return "invalid track";
+            return parseTrack(words, sequence_data.tracks[track_id]);
+        } else if (keyword == "snapshot") {
+            if (!(words >> value) || !parseSnapshot(value, sequence_data)) {
+                return "snapshot must be " + std::to_string(2 * Sequence::serialized_size) + " hex digits";
+            }
+        } else {
+            return "unknown setting `" + keyword + "`";
+        }
+
+        return "";
+    }
+
+    static std::string parseTrack(std::istringstream &words, BasicTrackData<Sequence::n_steps> &track) {
+        typedef BasicTrackData<Sequence::n_steps> Track;
+        std::string key;
+
+        while (words >> key) {
+            if (key == "muted") {
+                track.muted = true;
+                continue;
+            }
+
+            std::string value;
+            if (!(words >> value)) return "`" + key + "` needs a value";
+
+            if (key == "instrument") {
+                int instrument_id = atoi(value.c_str());
+                if (instrument_id < 0 || instrument_id >= NUM_INSTRUMENTS) return "invalid instrument";
+                track.instrument_id = static_cast<instrument_id_t>(instrument_id);
+            } else if (key == "steps") {
+                if (!parseSteps(value, track)) return "invalid steps `" + value + "`";
+            } else if (key == "volume") {
+                float volume = static_cast<float>(atof(value.c_str()));
+                if (volume < 0.0f || volume > 1.0f) return "volume must be 0-1";
+                track.volume = volume;
+            } else if (key == "length") {
+                int n_steps = 0, step_division = 0;
+                if (sscanf(value.c_str(), "%d/%d", &n_steps, &step_division) != 2 || n_steps > 255 || step_division > 255 ||
+                    !Track::isValidLength(static_cast<uint8_t>(n_steps), static_cast<uint8_t>(step_division))) {
+                    return "invalid length `" + value + "`";
+                }
+                track.n_steps = static_cast<uint8_t>(n_steps);
+                track.step_division = static_cast<uint8_t>(step_division);
+            } else if (key == "pitch") {
+                int cents = atoi(value.c_str());
+                if (cents < -MAX_PITCH_CENTS || cents > MAX_PITCH_CENTS) return "invalid pitch";
+                track.pitch_cents = static_cast<int16_t>(cents);
+            } else if (key == "effect") {
+                size_t equals = value.find('=');
+                int param = equals == std::string::npos ? -1 : effectParam(value.substr(0, equals));
+                int param_value = equals == std::string::npos ? -1 : atoi(value.c_str() + equals + 1);
+                if (param < 0 || param_value < 0 || param_value > 255 ||
+                    !Track::isValidEffectParam(static_cast<uint8_t>(param), static_cast<uint8_t>(param_value))) {
+                    return "invalid effect `" + value + "`";
+                }
+                track.setEffectParam(static_cast<uint8_t>(param), static_cast<uint8_t>(param_value));
+            } else if (key == "live") {
+                if (!parseLiveEffects(value, track.live_effects)) return "invalid live effects `" + value + "`";
+            } else {
+                return "unknown track setting `" + key + "`";
+            }
+        }
+
+        return "";
+    }
+
+    // "124.5" is 124 BPM plus 50 hundredths
+    static bool parseTempo(const std::string &value, Sequence &sequence_data) {
+        int bpm = 0, hundredths = 0;
+        size_t dot = value.find('.');
+
+        bpm = atoi(value.substr(0, dot).c_str());
+        if (dot != std::string::npos) {
+            std::string fraction = value.substr(dot + 1);
+            if (fraction.empty() || fraction.size() > 2 || fraction.find_first_not_of("0123456789") != std::string::npos) {
+                return false;
+            }
+            hundredths = atoi(fraction.c_str()) * (fraction.size() == 1 ? 10 : 1);
+        }
+
+        if (bpm < MIN_BPM || bpm > MAX_BPM || (bpm == MAX_BPM && hundredths > 0)) return false;
+
+        sequence_data.bpm = static_cast<bpm_t>(bpm);
+        sequence_data.bpm_fraction = static_cast<uint8_t>(hundredths);
+        return true;
+    }
+
+    static bool parseSteps(const std::string &value, BasicTrackData<Sequence::n_steps> &track) {
+        if (value.empty() || value.size() > Sequence::n_steps) return false;
+
+        track.triggers = 0;
+        track.resetVelocities();
+
+        for (size_t i = 0; i < value.size(); ++i) {
+            char c = value[i];
+            uint8_t step = static_cast<uint8_t>(i);
+
+            if (c == '.') continue;
+            if (c == 'x') {
+                track.triggers |= track.stepBit(step);
+            } else if (c >= '0' && c < '0' + VELOCITY_LEVELS) {
+                track.triggers |= track.stepBit(step);
+                track.setVelocity(step, static_cast<uint8_t>(c - '0'));
+            } else {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static int effectParam(const std::string &name) {
+        static const char *names[N_EFFECT_PARAMS] = {"cutoff", "resonance", "drive", "delay", "feedback", "mix"};
+
+        for (int p = 0; p < N_EFFECT_PARAMS; ++p) {
+            if (name == names[p]) return p;
+        }
+        return -1;
+    }
+
+    static bool parseLiveEffects(const std::string &value, uint8_t &live_effects) {
+        static const char *names[N_TRACK_EFFECTS] = {"filter", "drive", "delay"};
+        live_effects = 0;
+        if (value == "none") return true;
+
+        std::istringstream list(value);
+        std::string name;
+        while (std::getline(list, name, ',')) {
+            int effect = -1;
+            for (int e = 0; e < N_TRACK_EFFECTS; ++e) {
+                if (name == names[e]) effect = e;
+            }
+            if (effect < 0) return false;
+            live_effects |= static_cast<uint8_t>(1 << effect);
+        }
+
+        return true;
+    }
+
+    static bool parseSnapshot(const std::string &hex, Sequence &sequence_data) {
+        if (hex.size() != 2u * Sequence::serialized_size) return false;
+
+        std::vector<unsigned char> snapshot(Sequence::serialized_size);
+        for (size_t i = 0; i < snapshot.size(); ++i) {
+            char digits[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+            char *end = nullptr;
+            snapshot[i] = static_cast<unsigned char>(strtoul(digits, &end, 16));
+            if (end != digits + 2) return false;
+        }
+
+        sequence_data.deserialize(snapshot.data());
+        return true;
+    }
+};
+
+#endif // PATTERN_TEXT_H
@@ -0,0 +1,142 @@
+#ifndef REALTIME_THREADS_H
+#define REALTIME_THREADS_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#define RT_AUDIO_PRIORITY 80
+#define RT_CONSUMER_PRIORITY 70
+#define RT_SERIAL_PRIORITY 60
+
+// How long the busy loops back off when idle in real-time mode, so a SCHED_FIFO thread never starves its core
+#define RT_IDLE_BACKOFF_US 250
+
+enum class ThreadRole {
+    AUDIO,
+    CONSUMER,
+    SERIAL,
+};
+
+struct RealtimeConfig {
+    bool enabled = false;
+    bool lock_memory = true;
+
+    // Core each role is pinned to, or -1 to leave it unpinned
+    int audio_core = -1;
+    int consumer_core = -1;
+    int serial_core = -1;
+
+    // Spread the three roles over the highest-numbered cores, keeping core 0 for the rest of the system
+    static RealtimeConfig withDefaultCores() {
+        RealtimeConfig config;
+        int n_cores = static_cast<int>(std::thread::hardware_concurrency());
+
+        if (n_cores >= 4) {
+            config.audio_core = n_cores - 1;
+            config.consumer_core = n_cores - 2;
+            config.serial_core = n_cores - 3;
+        } else if (n_cores >= 2) {
+            config.audio_core = n_cores - 1;
+        }
+
+        return config;
+    }
+
+    int priorityFor(ThreadRole role) const {
+        switch (role) {
+            case ThreadRole::AUDIO: return RT_AUDIO_PRIORITY;
+            case ThreadRole::CONSUMER: return RT_CONSUMER_PRIORITY;
+            case ThreadRole::SERIAL: return RT_SERIAL_PRIORITY;
+        }
+        return 0;
+    }
+
+    int coreFor(ThreadRole role) const {
+        switch (role) {
+            case ThreadRole::AUDIO: return audio_core;
+            case ThreadRole::CONSUMER: return consumer_core;
+            case ThreadRole::SERIAL: return serial_core;
+        }
+        return -1;
+    }
+};
+
+const char *threadRoleName(ThreadRole role) {
+    switch (role) {
+        case ThreadRole::AUDIO: return "audio";
+        case ThreadRole::CONSUMER: return "consumer";
+        case ThreadRole::SERIAL: return "serial";
+    }
+    return "unknown";
+}
+
+// Applies the scheduling policy and core affinity for `role` to the calling thread, printing what took effect.
+// Returns true only if everything requested was applied.
+bool applyRealtimePolicy(ThreadRole role, const RealtimeConfig &config) {
+    if (!config.enabled) return false;
+
+    std::string report;
+    bool ok = true;
+
+    sched_param param;
+    param.sched_priority = config.priorityFor(role);
+
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err == 0) {
+        report += "SCHED_FIFO priority " + std::to_string(param.sched_priority);
+    } else {
+        report += std::string("default scheduling (SCHED_FIFO failed: ") + strerror(err) + ")";
+        ok = false;
+    }
+
+    int core = config.coreFor(role);
+    if (core >= 0) {
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core, &cpus);
+
+        err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err == 0) {
+            report += ", pinned to core " + std::to_string(core);
+        } else {
+            report += ", unpinned (affinity to core " + std::to_string(core) + " failed: " + strerror(err) + ")";
+            ok = false;
+        }
+#else
+        report += ", unpinned (core affinity is not supported on this platform)";
+        ok = false;
+#endif
+    } else {
+        report += ", unpinned";
+    }
+
+    printf("[realtime] %s thread: %s\n", threadRoleName(role), report.c_str());
+    return ok;
+}
+
+// Locks current and future pages into RAM so the audio path never takes a major page fault
+bool lockProcessMemory(const RealtimeConfig &config) {
+    if (!config.enabled || !config.lock_memory) return false;
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+        printf("[realtime] memory: locked (mlockall)\n");
+        return true;
+    }
+
+    printf("[realtime] memory: not locked (mlockall failed: %s)\n", strerror(errno));
+    return false;
+}
+
+// Parses "audio,consumer,serial" core indices, e.g. "3,2,1" or "3,-1,-1"
+bool parseRealtimeCores(const char *arg, RealtimeConfig &config) {
+    return sscanf(arg, "%d,%d,%d", &config.audio_core, &config.consumer_core, &config.serial_core) == 3;
+}
+
+#endif // REALTIME_THREADS_H
@@ -0,0 +1,190 @@
+#ifndef RENDER_CACHE_H
+#define RENDER_CACHE_H
+
+#include <AudioUtils.h>
+#include <DrumMachineTrackData.h>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#define DEFAULT_RENDER_CACHE_MB 64
+
+// 64-bit FNV-1a, used to key rendered buffers by the content that produced them
+struct ContentHash {
+    uint64_t value = 1469598103934665603ULL;
+
+    ContentHash &add(const void *data, size_t size) {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; ++i) {
+            value ^= bytes[i];
+            value *= 1099511628211ULL;
+        }
+        return *this;
+    }
+
+    template <typename T>
+    ContentHash &add(const T &v) {
+        return add(&v, sizeof(T));
+    }
+};
+
+struct RenderCacheStatistics {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+// Memory held by a cached entry; types other than plain vectors provide their own overload
+template <typename T>
+size_t cachedBytes(const std::vector<T> &buffer) {
+    return buffer.size() * sizeof(T);
+}
+
+// A finished bar-length mix, with the master limiter's deepest gain reduction over it
+struct RenderedMix {
+    AudioStreamBuffer samples;
+    float gain_reduction_db = 0.0f;
+};
+
+size_t cachedBytes(const RenderedMix &mix) {
+    return cachedBytes(mix.samples);
+}
+
+// Least-recently-used map from content hash to an immutable rendered buffer, bounded by a byte budget.
+// Buffers are shared, so a hit can be published by pointer without copying.
+template <typename Buffer>
+class LruBufferCache {
+public:
+    typedef std::shared_ptr<const Buffer> SharedBuffer;
+
+    explicit LruBufferCache(size_t budget_bytes) : budget_bytes(budget_bytes) {}
+
+    SharedBuffer find(uint64_t key) {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        auto it = index.find(key);
+        if (it == index.end()) {
+            stats.misses++;
+            return nullptr;
+        }
+
+        // Move to the front (most recently used)
+        entries.splice(entries.begin(), entries, it->second);
+        stats.hits++;
+        return it->second->buffer;
+    }
+
+    void insert(uint64_t key, SharedBuffer buffer) {
+        size_t bytes = cachedBytes(*buffer);
+        std::lock_guard<std::mutex> lock(mtx);
+
+        if (bytes > budget_bytes || index.count(key)) return;
+
+        entries.push_front(Entry{key, std::move(buffer), bytes});
+        index[key] = entries.begin();
+        stats.bytes += bytes;
+
+        while (stats.bytes > budget_bytes) {
+            Entry &oldest = entries.back();
+            stats.bytes -= oldest.bytes;
+            stats.evictions++;
+            index.erase(oldest.key);
+            entries.pop_back();
+        }
+
+        stats.entries = entries.size();
+    }
+
+    RenderCacheStatistics statistics() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return stats;
+    }
+
+private:
+    struct Entry {
+        uint64_t key;
+        SharedBuffer buffer;
+        size_t bytes;
+    };
+
+    size_t budget_bytes;
+    std::list<Entry> entries;
+    std::unordered_map<uint64_t, typename std::list<Entry>::iterator> index;
+    RenderCacheStatistics stats;
+    std::mutex mtx;
+};
+
+// Rendered per-track stems and finished mixes, sharing one memory budget
+template <typename Config>
+class RenderCache {
+public:
+    typedef typename Config::Buffer Buffer;
+    typedef typename Config::Track Track;
+    typedef typename Config::Sequence Sequence;
+
+    explicit RenderCache(size_t budget_bytes = static_cast<size_t>(DEFAULT_RENDER_CACHE_MB) << 20) :
+        stems(budget_bytes / 2),
+        mixes(budget_bytes / 2) {}
+
+    LruBufferCache<Buffer> stems;
+    LruBufferCache<RenderedMix> mixes;
+
+    typedef typename Config::Stats Stats;
+
+    static uint64_t stemKey(const Track &track, const Stats &stats) {
+        ContentHash hash;
+        hash.add(stats.bpm).add(stats.bpm_fraction).add(stats.swing).add(track.instrument_id).add(track.volume).add(track.activeTriggers());
+        hash.add(track.n_steps).add(track.step_division).add(track.pitch_cents);
+
+        // Velocities only matter where the track triggers
+        hash.add(track.velocity_lo & track.activeTriggers()).add(track.velocity_hi & track.activeTriggers());
+        return hash.value;
+    }
+
+    // The stem with its render-time effects applied; the same as stemKey() when it has none
+    static uint64_t processedStemKey(const Track &track, const Stats &stats) {
+        uint8_t effects = track.renderedEffects();
+        if (effects == 0) return stemKey(track, stats);
+
+        ContentHash hash;
+        hash.add(stemKey(track, stats)).add(effects).add(track.effect_params);
+        return hash.value;
+    }
+
+    // A mix depends on which (processed) stems are audible and where; muted and empty tracks contribute nothing
+    static uint64_t mixKey(const Sequence &sequence_data) {
+        Stats stats = Config::StatsTable::forTempo(sequence_data.bpm, sequence_data.bpm_fraction, sequence_data.swing);
+
+        ContentHash hash;
+        hash.add(stats.bpm).add(stats.bpm_fraction).add(stats.swing);
+
+        for (int j = 0; j < Config::n_tracks; ++j) {
+            const Track &track = sequence_data.tracks[j];
+            uint64_t stem_key = track.isActive() ? processedStemKey(track, stats) : 0;
+            hash.add(stem_key);
+        }
+
+        return hash.value;
+    }
+
+    void printStatistics() {
+        printStatistics("stems", stems.statistics());
+        printStatistics("mixes", mixes.statistics());
+    }
+
+private:
+    static void printStatistics(const char *name, const RenderCacheStatistics &stats) {
+        printf(
+            "Render cache (%s): %zu hits, %zu misses, %zu evictions, %zu entries, %.1f MB\n",
+            name, stats.hits, stats.misses, stats.evictions, stats.entries, stats.bytes / (1024.0 * 1024.0)
+        );
+    }
+};
+
+#endif // RENDER_CACHE_H
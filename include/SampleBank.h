@@ -0,0 +1,257 @@
+#ifndef SAMPLE_BANK_H
+#define SAMPLE_BANK_H
+
+#include <AudioUtils.h>
+#include <DrumMachineTrackData.h>
+#include <InstrumentLUT.h>
+#include <RenderCache.h>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define DEFAULT_PITCH_CACHE_MB 32
+
+template <typename SampleT>
+struct InstrumentSample {
+    std::vector<SampleT> sample;
+    SampleAnalysis analysis;
+};
+
+template <typename SampleT>
+size_t cachedBytes(const InstrumentSample<SampleT> &instrument) {
+    return cachedBytes(instrument.sample);
+}
+
+// Plays `sample` `cents` away from its recorded pitch by reading it at a different rate, with cubic
+// Hermite interpolation between frames. Raising the pitch shortens the sample.
+template <typename SampleT, int Channels>
+std::vector<SampleT> resampleForPitch(const std::vector<SampleT> &sample, int16_t cents) {
+    typedef SampleTraits<SampleT> Traits;
+
+    size_t in_frames = sample.size() / Channels;
+    if (in_frames < 2) return sample;
+
+    double ratio = std::pow(2.0, cents / 1200.0);
+    size_t out_frames = static_cast<size_t>((in_frames - 1) / ratio) + 1;
+    std::vector<SampleT> out(out_frames * Channels);
+
+    auto at = [&](long frame, int c) -> float {
+        frame = std::max(0L, std::min(static_cast<long>(in_frames) - 1, frame));
+        return static_cast<float>(sample[frame * Channels + c]);
+    };
+
+    for (size_t f = 0; f < out_frames; ++f) {
+        double position = f * ratio;
+        long i = static_cast<long>(position);
+        float t = static_cast<float>(position - i);
+
+        for (int c = 0; c < Channels; ++c) {
+            float y0 = at(i - 1, c), y1 = at(i, c), y2 = at(i + 1, c), y3 = at(i + 2, c);
+            float a = -0.5f * y0 + 1.5f * y1 - 1.5f * y2 + 0.5f * y3;
+            float b = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+            float d = -0.5f * y0 + 0.5f * y2;
+
+            out[f * Channels + c] = Traits::saturate(((a * t + b) * t + d) * t + y1);
+        }
+    }
+
+    return out;
+}
+
+// Instrument samples, loaded lazily from ABSOLUTE_PATHS and converted to the engine's sample format. Each
+// sample is analyzed once on load. Pitched variants are resampled on a background thread and kept in an LRU
+// cache, so a pitch costs one resample the first time it is used. Safe to share between engines on different
+// threads; references to base samples stay valid for the bank's lifetime.
+template <typename SampleT, int Channels = AUDIO_CHANNELS>
+class SampleBank {
+public:
+    typedef std::vector<SampleT> Buffer;
+    typedef InstrumentSample<SampleT> Instrument;
+    typedef std::shared_ptr<const Instrument> SharedInstrument;
+
+    explicit SampleBank(size_t pitch_cache_bytes = static_cast<size_t>(DEFAULT_PITCH_CACHE_MB) << 20) :
+        variants(pitch_cache_bytes) {
+        resample_thread = std::thread(&SampleBank::resampleThread, this);
+    }
+
+    ~SampleBank() {
+        {
+            std::lock_guard<std::mutex> lock(worker_mtx);
+            stopping = true;
+        }
+        worker_cv.notify_all();
+        done_cv.notify_all();
+
+        if (resample_thread.joinable()) {
+            resample_thread.join();
+        }
+    }
+
+    // Uses `sample` (interleaved, in the bank's format) for the instrument instead of its file, e.g. generated
+    // test sounds. Only for instruments not used yet, as references to the old samples would dangle.
+    void setInstrument(instrument_id_t instrument_id, Buffer sample) {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        Instrument &entry = instruments[instrument_id];
+        entry.sample = std::move(sample);
+        entry.analysis = analyzeSample<SampleT, Channels>(entry.sample);
+    }
+
+    // Returns the instrument's samples, loading them on first use; empty if the file failed to load
+    const Buffer &get(instrument_id_t instrument_id) {
+        return instrument(instrument_id).sample;
+    }
+
+    const SampleAnalysis &analysis(instrument_id_t instrument_id) {
+        return instrument(instrument_id).analysis;
+    }
+
+    const Instrument &instrument(instrument_id_t instrument_id) {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        auto loaded = instruments.find(instrument_id);
+        if (loaded != instruments.end()) {
+            return loaded->second;
+        }
+
+        Instrument &entry = instruments[instrument_id];
+        if (instrument_id >= NUM_INSTRUMENTS) {
+            std::cerr << "Error: instrument " << static_cast<int>(instrument_id) << " is out of range.\n";
+            return entry;
+        }
+
+        AudioStreamBuffer raw;
+        int sample_rate, channels;
+        loadWavFile(ABSOLUTE_PATHS[instrument_id], raw, sample_rate, channels);
+
+        entry.sample.resize(raw.size());
+        for (size_t i = 0; i < raw.size(); ++i) {
+            entry.sample[i] = SampleTraits<SampleT>::fromInt16(raw[i]);
+        }
+
+        entry.analysis = analyzeSample<SampleT, Channels>(entry.sample);
+
+        return entry;
+    }
+
+    // The instrument played `cents` away from its recorded pitch. Waits for the resampler if the variant
+    // is not cached yet; use variantReady() first where waiting is not acceptable.
+    SharedInstrument pitched(instrument_id_t instrument_id, int16_t cents) {
+        if (cents == 0) {
+            // Non-owning: base samples live as long as the bank
+            return SharedInstrument(SharedInstrument(), &instrument(instrument_id));
+        }
+
+        uint64_t key = variantKey(instrument_id, cents);
+        SharedInstrument variant = variants.find(key);
+        if (variant) return variant;
+
+        requestVariant(instrument_id, cents);
+        {
+            std::unique_lock<std::mutex> lock(worker_mtx);
+            done_cv.wait(lock, [&]() { return stopping || pending.count(key) == 0; });
+        }
+
+        variant = variants.find(key);
+        if (variant) return variant;
+
+        // Already evicted, or larger than the whole cache
+        return makeVariant(instrument_id, cents);
+    }
+
+    // True when pitched() would return without waiting; otherwise queues the variant for the resampler
+    bool variantReady(instrument_id_t instrument_id, int16_t cents) {
+        if (cents == 0) return true;
+
+        if (variants.find(variantKey(instrument_id, cents))) return true;
+
+        requestVariant(instrument_id, cents);
+        return false;
+    }
+
+    void printStatistics() {
+        RenderCacheStatistics stats = variants.statistics();
+        printf(
+            "Pitch cache: %zu hits, %zu misses, %zu evictions, %zu entries, %.1f MB\n",
+            stats.hits, stats.misses, stats.evictions, stats.entries, stats.bytes / (1024.0 * 1024.0)
+        );
+    }
+
+private:
+    std::unordered_map<instrument_id_t, Instrument> instruments;
+    std::mutex mtx;
+
+    LruBufferCache<Instrument> variants;
+
+    struct VariantRequest {
+        instrument_id_t instrument_id;
+        int16_t cents;
+    };
+
+    std::thread resample_thread;
+    std::mutex worker_mtx;
+    std::condition_variable worker_cv;
+    std::condition_variable done_cv;
+    std::deque<VariantRequest> queue;
+    std::unordered_set<uint64_t> pending;
+    bool stopping = false;
+
+    static uint64_t variantKey(instrument_id_t instrument_id, int16_t cents) {
+        ContentHash hash;
+        hash.add(instrument_id).add(cents);
+        return hash.value;
+    }
+
+    SharedInstrument makeVariant(instrument_id_t instrument_id, int16_t cents) {
+        const Instrument &base = instrument(instrument_id);
+
+        std::shared_ptr<Instrument> variant = std::make_shared<Instrument>();
+        variant->sample = resampleForPitch<SampleT, Channels>(base.sample, cents);
+        variant->analysis = analyzeSample<SampleT, Channels>(variant->sample);
+
+        return variant;
+    }
+
+    void requestVariant(instrument_id_t instrument_id, int16_t cents) {
+        {
+            std::lock_guard<std::mutex> lock(worker_mtx);
+            if (!pending.insert(variantKey(instrument_id, cents)).second) return;
+
+            queue.push_back(VariantRequest{instrument_id, cents});
+        }
+        worker_cv.notify_one();
+    }
+
+    void resampleThread() {
+        while (true) {
+            VariantRequest request;
+            {
+                std::unique_lock<std::mutex> lock(worker_mtx);
+                worker_cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+
+                if (stopping) return;
+                request = queue.front();
+                queue.pop_front();
+            }
+
+            uint64_t key = variantKey(request.instrument_id, request.cents);
+            variants.insert(key, makeVariant(request.instrument_id, request.cents));
+
+            {
+                std::lock_guard<std::mutex> lock(worker_mtx);
+                pending.erase(key);
+            }
+            done_cv.notify_all();
+        }
+    }
+};
+
+#endif // SAMPLE_BANK_H
@@ -0,0 +1,138 @@
+#ifndef SERIAL_CAPTURE_H
+#define SERIAL_CAPTURE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// First line of every capture file
+#define SERIAL_CAPTURE_HEADER "# drum machine serial capture v1"
+
+// A capture is a text file with one received frame per line: the microseconds since capture started, then
+// the raw frame bytes (start byte, type, payload size, payload) in hex:
+//
+//   # drum machine serial capture v1
+//   1503127 aa0c03021c00
+//   1688410 aa0b02a138
+//
+// Lines starting with '#' are comments.
+struct CapturedFrame {
+    uint64_t time_us = 0;
+    std::vector<uint8_t> bytes;
+};
+
+// Appends frames as they are received. Not thread safe; each serial reader owns its own writer.
+class SerialCaptureWriter {
+public:
+    SerialCaptureWriter() {}
+
+    ~SerialCaptureWriter() {
+        close();
+    }
+
+    SerialCaptureWriter(const SerialCaptureWriter &) = delete;
+    SerialCaptureWriter &operator=(const SerialCaptureWriter &) = delete;
+
+    bool open(const std::string &path) {
+        close();
+
+        file = fopen(path.c_str(), "w");
+        if (!file) return false;
+
+        this->path = path;
+        start = Clock::now();
+        n_frames = 0;
+        fprintf(file, "%s\n", SERIAL_CAPTURE_HEADER);
+
+        return true;
+    }
+
+    void write(const uint8_t *bytes, size_t n_bytes) {
+        uint64_t time_us = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count()
+        );
+        writeAt(time_us, bytes, n_bytes);
+    }
+
+    // For frames that carry their own (e.g. simulated) time
+    void writeAt(uint64_t time_us, const uint8_t *bytes, size_t n_bytes) {
+        if (!file) return;
+
+        fprintf(file, "%llu ", static_cast<unsigned long long>(time_us));
+        for (size_t i = 0; i < n_bytes; ++i) {
+            fprintf(file, "%02x", bytes[i]);
+        }
+        fputc('\n', file);
+
+        n_frames++;
+    }
+
+    void close() {
+        if (!file) return;
+
+        fclose(file);
+        file = nullptr;
+        printf("Serial capture %s: %zu frames\n", path.c_str(), n_frames);
+    }
+
+    // Reads a whole capture into `frames`; reports the first malformed line and returns false
+    static bool readFile(const std::string &path, std::vector<CapturedFrame> &frames) {
+        std::ifstream in(path);
+        if (!in) {
+            std::cerr << "Error: cannot open " << path << "\n";
+            return false;
+        }
+
+        std::string line;
+        size_t line_number = 0;
+
+        while (std::getline(in, line)) {
+            line_number++;
+            if (line.empty() || line[0] == '#') continue;
+
+            std::istringstream words(line);
+            unsigned long long time_us;
+            std::string hex;
+            CapturedFrame frame;
+
+            if (!(words >> time_us >> hex) || !parseHex(hex, frame.bytes)) {
+                std::cerr << "Error: " << path << ":" << line_number << ": expected `MICROSECONDS HEXBYTES`\n";
+                return false;
+            }
+
+            frame.time_us = time_us;
+            frames.push_back(std::move(frame));
+        }
+
+        return true;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    FILE *file = nullptr;
+    std::string path;
+    Clock::time_point start;
+    size_t n_frames = 0;
+
+    static bool parseHex(const std::string &hex, std::vector<uint8_t> &bytes) {
+        if (hex.empty() || hex.size() % 2 != 0) return false;
+
+        for (size_t i = 0; i < hex.size(); i += 2) {
+            char digits[3] = {hex[i], hex[i + 1], '\0'};
+            char *end = nullptr;
+            bytes.push_back(static_cast<uint8_t>(strtoul(digits, &end, 16)));
+            if (end != digits + 2) return false;
+        }
+
+        return true;
+    }
+};
+
+#endif // SERIAL_CAPTURE_H
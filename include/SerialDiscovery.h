@@ -0,0 +1,95 @@
+#ifndef SERIAL_DISCOVERY_H
+#define SERIAL_DISCOVERY_H
+
+#include <dirent.h>
+#include <glob.h>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// USB vendor IDs of Arduino boards and of the USB-serial chips on common clones: Arduino, Arduino.org,
+// WCH (CH340), FTDI, Silicon Labs (CP210x)
+#define SERIAL_ARDUINO_VENDOR_IDS {"2341", "2a03", "1a86", "0403", "10c4"}
+
+struct SerialDevice {
+    std::string path;     // e.g. /dev/ttyACM0
+    std::string usb_id;   // VENDOR:PRODUCT:SERIAL, the same whatever name the device gets; empty if unknown
+    bool arduino = false; // A board, or a USB-serial chip boards use
+};
+
+namespace serial_discovery {
+
+inline std::string readSysfsValue(const std::string &path) {
+    std::ifstream file(path);
+    std::string value;
+    std::getline(file, value);
+    return value;
+}
+
+// The USB device above a tty's sysfs node, up a few levels (interface, then device); empty if it is not USB
+inline std::string usbDeviceDir(const std::string &tty_device_link) {
+    char resolved[PATH_MAX];
+    if (!realpath(tty_device_link.c_str(), resolved)) return "";
+
+    std::string dir = resolved;
+    for (int level = 0; level < 4 && !dir.empty(); ++level) {
+        if (!readSysfsValue(dir + "/idVendor").empty()) return dir;
+        dir = dir.substr(0, dir.find_last_of('/'));
+    }
+    return "";
+}
+
+} // namespace serial_discovery
+
+// USB serial devices present now, boards first. On Linux every tty in /sys/class/tty with a USB device above it
+// (what udev would enumerate), with its vendor, product and serial number; elsewhere (macOS) the usbmodem and
+// usbserial call-out devices, without IDs.
+inline std::vector<SerialDevice> discoverSerialDevices() {
+    std::vector<SerialDevice> devices;
+
+    DIR *ttys = opendir("/sys/class/tty");
+    if (ttys) {
+        static const char *arduino_vendors[] = SERIAL_ARDUINO_VENDOR_IDS;
+
+        while (struct dirent *entry = readdir(ttys)) {
+            std::string name = entry->d_name;
+            if (name[0] == '.') continue;
+
+            std::string usb_dir = serial_discovery::usbDeviceDir("/sys/class/tty/" + name + "/device");
+            if (usb_dir.empty()) continue;
+
+            std::string vendor = serial_discovery::readSysfsValue(usb_dir + "/idVendor");
+            SerialDevice device;
+            device.path = "/dev/" + name;
+            device.usb_id = vendor + ":" + serial_discovery::readSysfsValue(usb_dir + "/idProduct") + ":" +
+                            serial_discovery::readSysfsValue(usb_dir + "/serial");
+            device.arduino = std::find(std::begin(arduino_vendors), std::end(arduino_vendors), vendor) != std::end(arduino_vendors);
+            devices.push_back(device);
+        }
+        closedir(ttys);
+    } else {
+        // The tty.* twin of each call-out device is the same device
+        for (const char *pattern : {"/dev/cu.usbmodem*", "/dev/cu.usbserial*"}) {
+            glob_t matches;
+            if (glob(pattern, 0, nullptr, &matches) == 0) {
+                for (size_t i = 0; i < matches.gl_pathc; ++i) {
+                    SerialDevice device;
+                    device.path = matches.gl_pathv[i];
+                    device.arduino = true;
+                    devices.push_back(device);
+                }
+            }
+            globfree(&matches);
+        }
+    }
+
+    std::sort(devices.begin(), devices.end(), [](const SerialDevice &a, const SerialDevice &b) {
+        return a.arduino != b.arduino ? a.arduino : a.path < b.path;
+    });
+    return devices;
+}
+
+#endif // SERIAL_DISCOVERY_H
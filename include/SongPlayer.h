@@ -0,0 +1,132 @@
+#ifndef SONG_PLAYER_H
+#define SONG_PLAYER_H
+
+#include <PatternBank.h>
+#include <SwitchingSoundStream.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+struct SongEntry {
+    pattern_id_t pattern_id;
+    unsigned char repeats;  // Number of bars the pattern plays for
+};
+
+// Parses a chain like "0x4,1x2,3" (pattern 0 for four bars, pattern 1 for two, pattern 3 for one)
+bool parseSongChain(const std::string &text, std::vector<SongEntry> &chain) {
+    chain.clear();
+    size_t pos = 0;
+
+    while (pos < text.size()) {
+        size_t end = text.find(',', pos);
+        if (end == std::string::npos) end = text.size();
+
+        std::string item = text.substr(pos, end - pos);
+        int pattern_id = 0, repeats = 1;
+        int n_parsed = sscanf(item.c_str(), "%dx%d", &pattern_id, &repeats);
+
+        if (n_parsed < 1 || pattern_id < 0 || pattern_id >= N_PATTERNS || repeats < 1 || repeats > 255) {
+            return false;
+        }
+
+        chain.push_back(SongEntry{static_cast<pattern_id_t>(pattern_id), static_cast<unsigned char>(repeats)});
+        pos = end + 1;
+    }
+
+    return !chain.empty();
+}
+
+// Plays a chain of pattern references by queueing each pattern's (already rendered) mix for the bar after
+// the current entry's last one. Only the playing and the queued mix are ever held by the stream, so memory
+// does not depend on song length. All methods run on the consumer thread.
+template <typename Config>
+class SongPlayer {
+public:
+    SongPlayer(PatternBank<Config> &bank, SwitchingSoundStream &stream) : bank(bank), stream(stream) {}
+
+    bool playing() const {
+        return !chain.empty();
+    }
+
+    void start(const std::vector<SongEntry> &song_chain, bool loop_song) {
+        chain = song_chain;
+        loop = loop_song;
+        entry_idx = 0;
+        bars_into_entry = 0;
+        last_seen_bar = stream.barsStarted();
+
+        printf("Starting song with %zu entries%s\n", chain.size(), loop ? " (looping)" : "");
+        queueEntry(0);
+    }
+
+    void stop() {
+        chain.clear();
+    }
+
+    // Advances through the chain as bars start and queues the next entry during the current entry's last bar
+    void poll() {
+        if (chain.empty()) return;
+
+        size_t bar = stream.barsStarted();
+        while (last_seen_bar != bar) {
+            last_seen_bar++;
+            advanceOneBar();
+            if (chain.empty()) return;
+        }
+    }
+
+private:
+    PatternBank<Config> &bank;
+    SwitchingSoundStream &stream;
+
+    std::vector<SongEntry> chain;
+    bool loop = false;
+
+    size_t entry_idx = 0;
+    unsigned int bars_into_entry = 0;  // 0 until the queued first entry starts
+    size_t last_seen_bar = 0;
+    bool next_queued = false;
+
+    void advanceOneBar() {
+        if (bars_into_entry == 0 || bars_into_entry >= chain[entry_idx].repeats) {
+            // Either the first entry or the entry queued during the previous bar has just started
+            if (bars_into_entry != 0) {
+                if (!next_queued) {
+                    stop();
+                    printf("Song finished\n");
+                    return;
+                }
+                entry_idx = nextEntry();
+            }
+
+            bars_into_entry = 1;
+            next_queued = false;
+        } else {
+            bars_into_entry++;
+        }
+
+        if (bars_into_entry == chain[entry_idx].repeats && hasNextEntry()) {
+            queueEntry(nextEntry());
+            next_queued = true;
+        }
+    }
+
+    bool hasNextEntry() const {
+        return loop || entry_idx + 1 < chain.size();
+    }
+
+    size_t nextEntry() const {
+        return (entry_idx + 1) % chain.size();
+    }
+
+    // Edits apply to the queued pattern from here on, matching what the bar-boundary switch will play
+    void queueEntry(size_t idx) {
+        // Chains are checked when parsed, so every entry names a pattern the bank has
+        StreamMix mix;
+        typename Config::Stats stats;
+        if (bank.select(chain[idx].pattern_id, mix, stats)) stream.queueAtBarBoundary(mix, stats);
+    }
+};
+
+#endif // SONG_PLAYER_H
@@ -1,3 +1,6 @@
+#ifndef SWITCHING_SOUND_STREAM_H
+#define SWITCHING_SOUND_STREAM_H
+
 #include <SFML/Audio.hpp>
 #include <iostream>
 #include <vector>
@@ -6,118 +9,485 @@
 #include <chrono>
 #include <regex>
 #include <mutex>
+#include <functional>
+#include <atomic>
+#include <memory>
 #include <DrumMachineTrackData.h>
+#include <AudioUtils.h>
+#include <MixPlayhead.h>
+#include <OutputRecorder.h>
+#include <MidiClock.h>
 
-#define AUDIO_SAMPLE_RATE 44100
-#define AUDIO_CHANNELS 2
 
-typedef std::vector<sf::Int16> AudioStreamBuffer;
+// Chunk sizing (in frames), independent of the step grid
+#define DEFAULT_CHUNK_FRAMES 1024
+#define MIN_CHUNK_FRAMES 64
+#define MAX_CHUNK_FRAMES 16384
 
+// Number of underrun-free chunks before the adaptive mode tries a smaller chunk
+#define ADAPTIVE_SHRINK_AFTER_CHUNKS 512
 
-struct LoopingStatistics {
-    bpm_t bpm;
-    int beat_interval_frames;
-    int bar_length_frames;
-    int n_frames_subdivision;
+// sf::SoundStream keeps this many chunks queued on the device. SFML does not report how much of them is still
+// unplayed, so latencies assume all but the chunk being played (SFML_STREAM_BUFFER_COUNT - 1) are waiting.
+#define SFML_STREAM_BUFFER_COUNT 3
 
-    static LoopingStatistics fromBPM(bpm_t bpm) {
-        LoopingStatistics stats;
-        stats.bpm = bpm;
-        stats.beat_interval_frames = AUDIO_SAMPLE_RATE * 60 / bpm;
-        stats.bar_length_frames = stats.beat_interval_frames * 4;
-        stats.n_frames_subdivision = stats.bar_length_frames / N_TRACK_SUBDIVISIONS;
+// Edit-to-output latencies are also counted in 1 ms bins for percentiles; the last bin holds anything longer
+#define LATENCY_HISTOGRAM_MS 1000
 
-        return stats;
+// Live hits (see triggerOneShot()) play on this many voices over the loop; the oldest is cut when all are busy
+#define MAX_ONE_SHOT_VOICES 8
+
+// Estimates, not measurements: each latency is the measured time from the event until its first frame is
+// handed to the device, plus the audio assumed queued ahead of it (SFML_STREAM_BUFFER_COUNT - 1 chunks).
+// Underruns are inferred from gaps between the device's callbacks, as SFML does not report them.
+struct StreamLatencyStatistics {
+    double last_latency_ms = 0.0;
+    double max_latency_ms = 0.0;
+    double total_latency_ms = 0.0;
+    size_t n_swaps = 0;
+    size_t n_underruns = 0;
+    size_t chunk_frames = 0;
+    size_t histogram[LATENCY_HISTOGRAM_MS] = {};
+
+    double averageLatencyMs() const {
+        return n_swaps > 0 ? total_latency_ms / n_swaps : 0.0;
+    }
+
+    void add(double latency_ms) {
+        last_latency_ms = latency_ms;
+        max_latency_ms = std::max(max_latency_ms, latency_ms);
+        total_latency_ms += latency_ms;
+        n_swaps++;
+
+        size_t bin = latency_ms > 0.0 ? static_cast<size_t>(latency_ms) : 0;
+        histogram[std::min(bin, static_cast<size_t>(LATENCY_HISTOGRAM_MS - 1))]++;
+    }
+
+    // Upper edge of the bin holding the `percentile`-th latency (to the nearest millisecond, capped at the max)
+    double percentileMs(double percentile) const {
+        if (n_swaps == 0) return 0.0;
+
+        size_t rank = static_cast<size_t>(percentile / 100.0 * n_swaps + 0.5);
+        rank = std::max(static_cast<size_t>(1), std::min(n_swaps, rank));
+
+        size_t seen = 0;
+        for (size_t bin = 0; bin < LATENCY_HISTOGRAM_MS; ++bin) {
+            seen += histogram[bin];
+            if (seen >= rank) return std::min(max_latency_ms, static_cast<double>(bin + 1));
+        }
+        return max_latency_ms;
     }
 };
 
 
 class SwitchingSoundStream : public sf::SoundStream {
 public:
+    typedef std::chrono::steady_clock Clock;
+
     SwitchingSoundStream(int sampleRate, int channels) :
         m_sampleRate(sampleRate),
         m_channels(channels),
         curr_buffer_index(0),
-        dirty(false) {
+        dirty(false),
+        playhead(sampleRate, channels, MAX_CHUNK_FRAMES),
+        voice_mix(MAX_CHUNK_FRAMES * channels) {
         // Initialize the stream
         initialize(m_channels, m_sampleRate);
 
         // Create the initial (silent) mix buffer
         looping_stats_A = LoopingStatistics::fromBPM(120);
         int total_frames = looping_stats_A.bar_length_frames;
-        mix_buffer_A.resize(total_frames * m_channels, 0);
+        mix_buffer_A = StreamMix(std::make_shared<const AudioStreamBuffer>(total_frames * m_channels, 0));
 
         curr_mix_buffer = &mix_buffer_A;
         curr_looping_stats = &looping_stats_A;
+        playhead.setMix(curr_mix_buffer, curr_looping_stats);
     }
 
-    void populateIntermetideBuffer(const AudioStreamBuffer& mix, const LoopingStatistics& stats) {
+    // Publishes `mix` by pointer; the buffer must not be modified afterwards. The previously published
+    // buffer is released here, on the caller's thread, never on the audio thread. While a bar-synchronized
+    // switch is pending, the mix replaces the queued one instead of playing immediately.
+    void populateIntermetideBuffer(
+        StreamMix mix,
+        const LoopingStatistics& stats,
+        Clock::time_point edit_time = Clock::now()
+    ) {
         std::lock_guard<std::mutex> lock(mtx);
 
-        if (curr_buffer_index == 0) {
-            mix_buffer_B = std::move(mix);
-            looping_stats_B = stats;
-        } else {
-            mix_buffer_A = std::move(mix);
-            looping_stats_A = stats;
+        if (bar_switch_pending) {
+            bar_mix_buffer = std::move(mix);
+            bar_looping_stats = stats;
+            return;
         }
 
+        intermediateBuffer() = std::move(mix);
+        intermediateStats() = stats;
+
+        // Keep the oldest pending edit so coalesced edits report their full latency
+        if (!dirty) pending_edit_time = edit_time;
         dirty = true;
     }
 
+    // Publishes `mix` at the start of the next bar instead of mid-bar
+    void queueAtBarBoundary(
+        StreamMix mix,
+        const LoopingStatistics& stats,
+        Clock::time_point edit_time = Clock::now()
+    ) {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        bar_mix_buffer = std::move(mix);
+        bar_looping_stats = stats;
+        bar_edit_time = edit_time;
+        bar_switch_pending = true;
+    }
+
+    // Fixed chunk size in frames, used as the starting point when adaptive sizing is enabled
+    void setChunkFrames(size_t frames) {
+        std::lock_guard<std::mutex> lock(mtx);
+        chunk_frames = std::max(static_cast<size_t>(MIN_CHUNK_FRAMES), std::min(static_cast<size_t>(MAX_CHUNK_FRAMES), frames));
+        adaptive_floor_frames = MIN_CHUNK_FRAMES;
+        stable_chunks = 0;
+    }
+
+    // Adaptive mode shrinks the chunk until an underrun is seen, then backs off and stays above that size
+    void setAdaptiveChunking(bool enabled) {
+        std::lock_guard<std::mutex> lock(mtx);
+        adaptive_chunking = enabled;
+        adaptive_floor_frames = MIN_CHUNK_FRAMES;
+        stable_chunks = 0;
+    }
+
+    // Runs once on the audio thread, before it produces its first chunk
+    void setAudioThreadInit(std::function<void()> init) {
+        std::lock_guard<std::mutex> lock(mtx);
+        audio_thread_init = std::move(init);
+    }
+
+    // Copies every chunk handed to the device into `recorder` (null stops copying); the recorder must outlive
+    // its use here
+    void setRecorder(OutputRecorder *recorder) {
+        std::lock_guard<std::mutex> lock(mtx);
+        this->recorder = recorder;
+    }
+
+    // Plays `samples` (interleaved, at the stream's rate and channel count) once from the next chunk, over the
+    // loop and scaled by `gain`. The buffer must stay alive and unmodified while it plays. Its first chunk is
+    // counted in the trigger latency statistics, measured from `event_time`.
+    void triggerOneShot(const AudioStreamBuffer *samples, float gain, Clock::time_point event_time = Clock::now()) {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        OneShotVoice *voice = &voices[0];
+        for (OneShotVoice &candidate : voices) {
+            if (!candidate.samples) {
+                voice = &candidate;
+                break;
+            }
+            if (candidate.serial < voice->serial) voice = &candidate;
+        }
+
+        voice->samples = samples;
+        voice->position = 0;
+        voice->gain = gain;
+        voice->event_time = event_time;
+        voice->serial = ++n_one_shots;
+    }
+
+    // Event-to-output latency of the hits played by triggerOneShot()
+    StreamLatencyStatistics getTriggerLatencyStatistics() {
+        std::lock_guard<std::mutex> lock(mtx);
+        StreamLatencyStatistics stats = trigger_latency_stats;
+        stats.chunk_frames = chunk_frames;
+        return stats;
+    }
+
+    // Derives MIDI clock and transport from every chunk handed out (null stops it); the clock must outlive its
+    // use here
+    void setMidiClock(MidiClockOutput *midi_clock) {
+        std::lock_guard<std::mutex> lock(mtx);
+        this->midi_clock = midi_clock;
+    }
+
+    // Number of times playback has started a bar (including the first), readable from any thread
+    size_t barsStarted() const {
+        return bars_started.load(std::memory_order_acquire);
+    }
+
+    // Mixes swapped in so far and the estimated latency of the last one, readable from any thread. The audio
+    // thread only counts events; whoever wants them logged polls these.
+    size_t swapsDone() const {
+        return swaps_done.load(std::memory_order_acquire);
+    }
+
+    double lastSwapLatencyMs() const {
+        return last_swap_latency_ms.load(std::memory_order_relaxed);
+    }
+
+    // Adaptive back-offs after inferred underruns, and the chunk size the last one backed off to
+    size_t chunkBackoffs() const {
+        return chunk_backoffs.load(std::memory_order_acquire);
+    }
+
+    size_t backoffChunkFrames() const {
+        return backoff_chunk_frames.load(std::memory_order_relaxed);
+    }
+
+    StreamLatencyStatistics getLatencyStatistics() {
+        std::lock_guard<std::mutex> lock(mtx);
+        StreamLatencyStatistics stats = latency_stats;
+        stats.chunk_frames = chunk_frames;
+        return stats;
+    }
+
+    // Master limiter activity (see MixPlayhead::limiterStatistics())
+    LimiterStatistics getLimiterStatistics() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return playhead.limiterStatistics();
+    }
+
+    // For a bus that mixes several streams instead of playing this one: hands out the next chunk of at most
+    // `max_frames` frames, exactly as onGetData() would. Returns false at the end of each bar (the next call
+    // starts the following bar) and while the stream is held. The samples stay valid until the next call.
+    bool pullChunk(size_t max_frames, const sf::Int16 *&samples, size_t &sample_count) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (held) return false;
+
+        // The playhead's buffers hold at most MAX_CHUNK_FRAMES; a bus may ask for its look-ahead on top
+        return nextChunk(std::min(max_frames, static_cast<size_t>(MAX_CHUNK_FRAMES)), Clock::now(), samples, sample_count);
+    }
+
+    // Freezes a stream that is pulled by a bus, the equivalent of pause() for one that plays itself
+    void setHeld(bool held) {
+        std::lock_guard<std::mutex> lock(mtx);
+        this->held = held;
+    }
+
 protected:
     virtual bool onGetData(Chunk& data) override {
         // Provide the next chunk of samples
         std::lock_guard<std::mutex> lock(mtx);
 
-        if (dirty) {
-            printf("Noticed dirty buffer, swapping...\n");
-            swapIntermediateIntoCurrentBuffer();
-            CHUNK_SIZE = curr_looping_stats->n_frames_subdivision;
+        if (audio_thread_init) {
+            audio_thread_init();
+            audio_thread_init = nullptr;
         }
 
-        if (m_playbackPosition < curr_mix_buffer->size()) {
-            data.samples = &(*curr_mix_buffer)[m_playbackPosition];
-            data.sampleCount = std::min(static_cast<size_t>(CHUNK_SIZE), curr_mix_buffer->size() - m_playbackPosition);
+        Clock::time_point now = Clock::now();
+        trackUnderruns(now);
 
-            m_playbackPosition += data.sampleCount;
-            m_totalFramesElapsed += data.sampleCount / m_channels;
-
-            return true;
-        } else {
-            m_playbackPosition = 0;
+        if (!nextChunk(chunk_frames, now, data.samples, data.sampleCount)) {
             return false;
         }
+
+        last_chunk_frames = data.sampleCount / m_channels;
+
+        return true;
     }
 
     virtual void onSeek(sf::Time timeOffset) override {
         // Seek to a specific position
         size_t targetFrame = static_cast<size_t>(timeOffset.asSeconds() * m_sampleRate);
-        m_playbackPosition = targetFrame * m_channels;
+        playhead.seek(targetFrame);
     }
 
 private:
-    AudioStreamBuffer mix_buffer_A;
+    StreamMix mix_buffer_A;
     LoopingStatistics looping_stats_A;
 
-    AudioStreamBuffer mix_buffer_B;
+    StreamMix mix_buffer_B;
     LoopingStatistics looping_stats_B;
 
-    const AudioStreamBuffer* curr_mix_buffer; // Pointer to the active buffer (either A or B)
+    // Mix waiting for the next bar boundary
+    StreamMix bar_mix_buffer;
+    LoopingStatistics bar_looping_stats;
+    Clock::time_point bar_edit_time;
+    bool bar_switch_pending = false;
+    std::atomic<size_t> bars_started{0};
+    std::atomic<size_t> swaps_done{0};
+    std::atomic<double> last_swap_latency_ms{0.0};
+    std::atomic<size_t> chunk_backoffs{0};
+    std::atomic<size_t> backoff_chunk_frames{0};
+
+    const StreamMix* curr_mix_buffer; // Pointer to the active buffer (either A or B)
     const LoopingStatistics* curr_looping_stats;
 
     unsigned int m_sampleRate = 44100; // Audio sample rate
     unsigned int m_channels = 2;   // Number of channels
 
-    size_t m_playbackPosition = 0; // Current position in the active buffer
-    size_t m_totalFramesElapsed = 0;  // Total frames elapsed in the current interval since last switch
+    size_t m_totalFramesElapsed = 0;  // Frames handed out since the stream started; the MIDI clock's time base
 
     std::mutex mtx;
     int curr_buffer_index = 0;
     bool dirty = false;
 
     LoopingStatistics looping_stats;
-    size_t CHUNK_SIZE; // Number of samples per chunk
+
+    // Chunk sizing
+    size_t chunk_frames = DEFAULT_CHUNK_FRAMES; // Number of frames per chunk
+    size_t last_chunk_frames = 0;
+    bool adaptive_chunking = false;
+    size_t adaptive_floor_frames = MIN_CHUNK_FRAMES;
+    size_t stable_chunks = 0;
+    Clock::time_point last_callback_time;
+    bool has_last_callback = false;
+
+    std::function<void()> audio_thread_init;
+
+    // Produces every chunk from the current mix
+    MixPlayhead playhead;
+
+    OutputRecorder *recorder = nullptr;
+    MidiClockOutput *midi_clock = nullptr;
+    bool held = false;
+
+    struct OneShotVoice {
+        const AudioStreamBuffer *samples = nullptr;  // Null when the voice is free
+        size_t position = 0;
+        float gain = 1.0f;
+        Clock::time_point event_time;
+        uint64_t serial = 0;  // Trigger order, to find the oldest voice
+    };
+    OneShotVoice voices[MAX_ONE_SHOT_VOICES];
+    uint64_t n_one_shots = 0;
+
+    // The playhead's chunk with the voices added; allocated up front so the audio thread never allocates
+    AudioStreamBuffer voice_mix;
+    StreamLatencyStatistics trigger_latency_stats;
+
+    // Latency reporting
+    Clock::time_point pending_edit_time;
+    StreamLatencyStatistics latency_stats;
+
+    double framesToMs(size_t frames) const {
+        return 1000.0 * static_cast<double>(frames) / static_cast<double>(m_sampleRate);
+    }
+
+    // The device asks for a new chunk each time one of its queued chunks finishes. If the gap since the
+    // previous request exceeds the audio assumed still queued at that point, the device probably ran dry.
+    void trackUnderruns(Clock::time_point now) {
+        if (has_last_callback && last_chunk_frames > 0) {
+            double gap_ms = std::chrono::duration<double, std::milli>(now - last_callback_time).count();
+            double queued_ms = framesToMs(last_chunk_frames * (SFML_STREAM_BUFFER_COUNT - 1));
+
+            // Gaps longer than a second are pauses, not underruns
+            bool underrun = gap_ms > queued_ms && gap_ms < 1000.0;
+
+            if (underrun) {
+                latency_stats.n_underruns++;
+                stable_chunks = 0;
+
+                if (adaptive_chunking) {
+                    // Back off to twice the size that underran and never probe below it again
+                    chunk_frames = std::min(static_cast<size_t>(MAX_CHUNK_FRAMES), chunk_frames * 2);
+                    adaptive_floor_frames = chunk_frames;
+                    backoff_chunk_frames.store(chunk_frames, std::memory_order_relaxed);
+                    chunk_backoffs.fetch_add(1, std::memory_order_release);
+                }
+            } else if (adaptive_chunking && ++stable_chunks >= ADAPTIVE_SHRINK_AFTER_CHUNKS) {
+                stable_chunks = 0;
+
+                size_t smaller = chunk_frames * 3 / 4;
+                if (smaller >= adaptive_floor_frames && smaller >= MIN_CHUNK_FRAMES) {
+                    chunk_frames = smaller;
+                }
+            }
+        }
+
+        last_callback_time = now;
+        has_last_callback = true;
+    }
+
+    // The first frame of the new mix is output once the chunks already queued ahead of it have played
+    // Shared by onGetData() and pullChunk(); called with the mutex held
+    bool nextChunk(size_t max_frames, Clock::time_point now, const sf::Int16 *&samples, size_t &sample_count) {
+        bool bar_start = playhead.atBarStart();
+        if (bar_start) {
+            bars_started.fetch_add(1, std::memory_order_release);
+        }
+
+        if (bar_switch_pending && playhead.atBarStart()) {
+            // Swap rather than assign, so the buffer being replaced is released by the next publisher
+            std::swap(intermediateBuffer(), bar_mix_buffer);
+            intermediateStats() = bar_looping_stats;
+            pending_edit_time = bar_edit_time;
+            bar_switch_pending = false;
+            dirty = true;
+        }
+
+        if (dirty) {
+            swapIntermediateIntoCurrentBuffer();
+            recordSwapLatency(now);
+        }
+
+        if (!playhead.nextChunk(max_frames, samples, sample_count)) {
+            return false;
+        }
+
+        mixOneShots(now, samples, sample_count);
+
+        if (midi_clock) {
+            Clock::duration queued = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double, std::milli>(framesToMs(chunk_frames * (SFML_STREAM_BUFFER_COUNT - 1)))
+            );
+            midi_clock->advance(bar_start, m_totalFramesElapsed, sample_count / m_channels, curr_looping_stats->bar_length_q32, now + queued);
+        }
+
+        if (recorder) {
+            recorder->push(samples, sample_count);
+        }
+
+        m_totalFramesElapsed += sample_count / m_channels;
+        return true;
+    }
+
+    // Adds the playing voices on top of the playhead's chunk
+    void mixOneShots(Clock::time_point now, const sf::Int16 *&samples, size_t sample_count) {
+        bool any_playing = false;
+        for (const OneShotVoice &voice : voices) {
+            any_playing |= voice.samples != nullptr;
+        }
+        if (!any_playing) return;
+
+        std::copy(samples, samples + sample_count, voice_mix.begin());
+
+        for (OneShotVoice &voice : voices) {
+            if (!voice.samples) continue;
+
+            if (voice.position == 0) {
+                double queued_ms = framesToMs(chunk_frames * (SFML_STREAM_BUFFER_COUNT - 1));
+                trigger_latency_stats.add(std::chrono::duration<double, std::milli>(now - voice.event_time).count() + queued_ms);
+            }
+
+            size_t n = std::min(sample_count, voice.samples->size() - voice.position);
+            const sf::Int16 *in = voice.samples->data() + voice.position;
+            for (size_t i = 0; i < n; ++i) {
+                voice_mix[i] = SampleTraits<sf::Int16>::saturate(static_cast<float>(voice_mix[i]) + in[i] * voice.gain);
+            }
+
+            voice.position += n;
+            if (voice.position >= voice.samples->size()) voice.samples = nullptr;
+        }
+
+        samples = voice_mix.data();
+    }
+
+    void recordSwapLatency(Clock::time_point now) {
+        double queued_ms = framesToMs(chunk_frames * (SFML_STREAM_BUFFER_COUNT - 1));
+        double latency_ms = std::chrono::duration<double, std::milli>(now - pending_edit_time).count() + queued_ms;
+
+        latency_stats.add(latency_ms);
+
+        last_swap_latency_ms.store(latency_ms, std::memory_order_relaxed);
+        swaps_done.fetch_add(1, std::memory_order_release);
+    }
+
+    StreamMix &intermediateBuffer() {
+        return curr_buffer_index == 0 ? mix_buffer_B : mix_buffer_A;
+    }
+
+    LoopingStatistics &intermediateStats() {
+        return curr_buffer_index == 0 ? looping_stats_B : looping_stats_A;
+    }
 
     void swapIntermediateIntoCurrentBuffer() {
         if (curr_buffer_index == 0) {
@@ -128,7 +498,11 @@ private:
             curr_looping_stats = &looping_stats_A;
         }
 
+        playhead.setMix(curr_mix_buffer, curr_looping_stats);
+
         curr_buffer_index = (curr_buffer_index + 1) % 2;
         dirty = false;
     }
-};
\ No newline at end of file
+};
+
+#endif // SWITCHING_SOUND_STREAM_H
@@ -0,0 +1,341 @@
+#ifndef TRACK_EFFECTS_H
+#define TRACK_EFFECTS_H
+
+#include <AudioUtils.h>
+#include <DrumMachineTrackData.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Effects run on planar float blocks of this many frames; parameters are smoothed once per block
+#define EFFECT_BLOCK_FRAMES 64
+
+// Longest echo the delay line holds; longer delay times are shortened to it
+#define EFFECT_MAX_DELAY_SECONDS 2
+
+// Time for a changed parameter to glide most of the way to its new value
+#define EFFECT_SMOOTHING_MS 20.0f
+
+// A render-time loop runs through the chain at most this many times before the pass that is kept
+#define EFFECT_MAX_WARMUP_PASSES 16
+
+// Filter state below this is flushed to zero between blocks
+#define EFFECT_DENORMAL_FLOOR 1e-15f
+
+// Echoes below this level (about -60 dB) count as decayed when warming up a loop
+#define EFFECT_TAIL_THRESHOLD 0.001f
+
+// Physical settings for the `effects` bits of `track`. Cutoff sweeps 20 Hz to 20 kHz and resonance Q 0.7 to 11
+// exponentially, drive adds up to 30 dB in front of the saturator, and the delay time counts 1/16 notes.
+template <typename Track, typename Stats>
+EffectSettings effectSettings(const Track &track, const Stats &stats, uint8_t effects, unsigned int sample_rate = AUDIO_SAMPLE_RATE) {
+    const uint8_t *params = track.effect_params;
+    const float max = EFFECT_PARAM_MAX;
+
+    EffectSettings settings;
+    settings.effects = effects;
+    settings.cutoff_hz = std::min(20.0f * std::pow(1000.0f, params[EFFECT_FILTER_CUTOFF] / max), 0.45f * sample_rate);
+    settings.resonance = 0.7071f * std::pow(16.0f, params[EFFECT_FILTER_RESONANCE] / max);
+    settings.drive = std::pow(10.0f, 1.5f * params[EFFECT_DRIVE] / max);
+
+    uint64_t delay_q32 = stats.bar_length_q32 / 16 * params[EFFECT_DELAY_TIME];
+    settings.delay_frames = std::min(
+        static_cast<size_t>((delay_q32 + Q32_HALF) >> 32), static_cast<size_t>(EFFECT_MAX_DELAY_SECONDS) * sample_rate
+    );
+    settings.feedback = 0.9f * params[EFFECT_DELAY_FEEDBACK] / max;
+    settings.delay_mix = params[EFFECT_DELAY_MIX] / max;
+
+    return settings;
+}
+
+// Low-pass filter, drive and delay for one track, in that order. Audio is processed in planar float blocks:
+// the biquad advances every channel in lockstep (one vector lane per channel; the recursion itself is serial
+// in time), while drive and the delay are per-plane loops with no cross-sample dependency, which the compiler
+// vectorizes. Parameters glide towards new settings, and a new delay time fades from the old echo to the new
+// one over a block, so live edits do not click.
+template <int Channels>
+class TrackEffectChain {
+public:
+    explicit TrackEffectChain(
+        size_t max_delay_frames = static_cast<size_t>(EFFECT_MAX_DELAY_SECONDS) * AUDIO_SAMPLE_RATE,
+        unsigned int sample_rate = AUDIO_SAMPLE_RATE
+    ) :
+        sample_rate(sample_rate),
+        delay_capacity(max_delay_frames + 1),
+        delay_lines(Channels * (max_delay_frames + 1), 0.0f) {
+        float smoothing_blocks = EFFECT_SMOOTHING_MS * 0.001f * sample_rate / EFFECT_BLOCK_FRAMES;
+        smoothing_coefficient = 1.0f - std::exp(-1.0f / smoothing_blocks);
+        reset();
+    }
+
+    // New target settings. Effects that were off start from silence; everything else glides.
+    void setSettings(const EffectSettings &settings) {
+        uint8_t enabled = settings.effects & static_cast<uint8_t>(~state.effects);
+
+        if (enabled & (1 << TRACK_EFFECT_FILTER)) {
+            std::fill(state.z1, state.z1 + Channels, 0.0f);
+            std::fill(state.z2, state.z2 + Channels, 0.0f);
+        }
+        if (enabled & (1 << TRACK_EFFECT_DELAY)) {
+            std::fill(delay_lines.begin(), delay_lines.end(), 0.0f);
+        }
+
+        target = settings;
+        target.delay_frames = std::max(static_cast<size_t>(1), std::min(settings.delay_frames, delay_capacity - 1));
+        state.effects = settings.effects;
+
+        // A silent line has no old echo to fade from
+        if (enabled & (1 << TRACK_EFFECT_DELAY)) state.delay_frames = target.delay_frames;
+    }
+
+    // Clears the filter and delay and jumps every parameter to its target
+    void reset() {
+        state = State();
+        state.effects = target.effects;
+        std::fill(delay_lines.begin(), delay_lines.end(), 0.0f);
+        jumpToTargets();
+    }
+
+    // Processes `n_frames` interleaved frames in place
+    void processInterleaved(float *frames, size_t n_frames) {
+        for (size_t start = 0; start < n_frames; start += EFFECT_BLOCK_FRAMES) {
+            size_t n = std::min(static_cast<size_t>(EFFECT_BLOCK_FRAMES), n_frames - start);
+            float *block = frames + start * Channels;
+
+            for (size_t f = 0; f < n; ++f) {
+                for (int c = 0; c < Channels; ++c) {
+                    planar[c][f] = block[f * Channels + c];
+                }
+            }
+
+            processBlock(n);
+
+            for (size_t f = 0; f < n; ++f) {
+                for (int c = 0; c < Channels; ++c) {
+                    block[f * Channels + c] = planar[c][f];
+                }
+            }
+        }
+    }
+
+    // Live use: processes `n_frames`, then the `lookahead_frames` after them for the master limiter to see,
+    // and rewinds to just after `n_frames`, so the next call continues exactly where the kept audio ends. The
+    // delay line entries written for the look-ahead are rewritten by that call.
+    void processStream(float *frames, size_t n_frames, size_t lookahead_frames) {
+        processInterleaved(frames, n_frames);
+
+        State kept = state;
+        processInterleaved(frames + n_frames * Channels, lookahead_frames);
+        state = kept;
+    }
+
+    // Processes a loop as it sounds when repeated: it runs through the chain until the filter and the echoes
+    // have settled, and only the last pass is kept
+    template <typename SampleT>
+    std::vector<SampleT> processLoop(const std::vector<SampleT> &loop, const EffectSettings &settings) {
+        typedef SampleTraits<SampleT> Traits;
+
+        setSettings(settings);
+        reset();
+
+        size_t n_frames = loop.size() / Channels;
+        std::vector<float> pass(loop.size());
+        size_t warmup_passes = warmupPasses(n_frames);
+
+        for (size_t p = 0; p <= warmup_passes; ++p) {
+            for (size_t i = 0; i < loop.size(); ++i) {
+                pass[i] = Traits::toUnit(loop[i]);
+            }
+            processInterleaved(pass.data(), n_frames);
+        }
+
+        std::vector<SampleT> out(loop.size());
+        for (size_t i = 0; i < loop.size(); ++i) {
+            out[i] = Traits::fromUnit(pass[i]);
+        }
+
+        return out;
+    }
+
+private:
+    struct State {
+        uint8_t effects = 0;
+        float z1[Channels] = {};  // Biquad state, transposed direct form II
+        float z2[Channels] = {};
+        float cutoff_hz = 20000.0f;
+        float resonance = 0.7071f;
+        float drive = 1.0f;
+        float feedback = 0.0f;
+        float delay_mix = 0.0f;
+        size_t delay_frames = 1;  // Where the delay reads; moves to the target's in one crossfaded block
+        size_t write_pos = 0;
+    };
+
+    unsigned int sample_rate;
+    float smoothing_coefficient;
+
+    EffectSettings target;
+    State state;
+
+    size_t delay_capacity;
+    std::vector<float> delay_lines;  // One plane of delay_capacity frames per channel
+
+    float planar[Channels][EFFECT_BLOCK_FRAMES];
+
+    void jumpToTargets() {
+        state.cutoff_hz = target.cutoff_hz;
+        state.resonance = target.resonance;
+        state.drive = target.drive;
+        state.feedback = target.feedback;
+        state.delay_mix = target.delay_mix;
+        state.delay_frames = target.delay_frames;
+    }
+
+    void smoothTowardsTargets() {
+        state.cutoff_hz += (target.cutoff_hz - state.cutoff_hz) * smoothing_coefficient;
+        state.resonance += (target.resonance - state.resonance) * smoothing_coefficient;
+        state.drive += (target.drive - state.drive) * smoothing_coefficient;
+        state.feedback += (target.feedback - state.feedback) * smoothing_coefficient;
+        state.delay_mix += (target.delay_mix - state.delay_mix) * smoothing_coefficient;
+    }
+
+    // Passes before the kept one, enough for the delay's echoes to decay (or the filter to settle)
+    size_t warmupPasses(size_t n_frames) const {
+        if (n_frames == 0) return 0;
+
+        size_t tail_frames = 0;
+        if (target.effects & (1 << TRACK_EFFECT_DELAY)) {
+            size_t echoes = 1;
+            if (target.feedback > 0.0f) {
+                echoes = static_cast<size_t>(std::ceil(std::log(EFFECT_TAIL_THRESHOLD) / std::log(target.feedback)));
+            }
+            tail_frames = target.delay_frames * echoes;
+        } else if (target.effects & (1 << TRACK_EFFECT_FILTER)) {
+            tail_frames = 1;
+        }
+
+        size_t passes = (tail_frames + n_frames - 1) / n_frames;
+        return std::min(passes, static_cast<size_t>(EFFECT_MAX_WARMUP_PASSES));
+    }
+
+    static float softClip(float x) {
+        x = std::min(3.0f, std::max(-3.0f, x));
+        return x * (27.0f + x * x) / (27.0f + 9.0f * x * x);
+    }
+
+    void processBlock(size_t frames) {
+        smoothTowardsTargets();
+
+        if (state.effects & (1 << TRACK_EFFECT_FILTER)) filterBlock(frames);
+        if (state.effects & (1 << TRACK_EFFECT_DRIVE)) driveBlock(frames);
+        if (state.effects & (1 << TRACK_EFFECT_DELAY)) delayBlock(frames);
+    }
+
+    // RBJ low-pass biquad, coefficients recomputed once per block from the smoothed cutoff and resonance
+    void filterBlock(size_t frames) {
+        float w0 = 2.0f * static_cast<float>(M_PI) * state.cutoff_hz / sample_rate;
+        float cos_w0 = std::cos(w0);
+        float alpha = std::sin(w0) / (2.0f * state.resonance);
+        float a0_inv = 1.0f / (1.0f + alpha);
+
+        float b0 = 0.5f * (1.0f - cos_w0) * a0_inv;
+        float b1 = (1.0f - cos_w0) * a0_inv;
+        float a1 = -2.0f * cos_w0 * a0_inv;
+        float a2 = (1.0f - alpha) * a0_inv;
+
+        float z1[Channels], z2[Channels];
+        std::copy(state.z1, state.z1 + Channels, z1);
+        std::copy(state.z2, state.z2 + Channels, z2);
+
+        for (size_t f = 0; f < frames; ++f) {
+            for (int c = 0; c < Channels; ++c) {
+                float x = planar[c][f];
+                float y = b0 * x + z1[c];
+                z1[c] = b1 * x - a1 * y + z2[c];
+                z2[c] = b0 * x - a2 * y;
+                planar[c][f] = y;
+            }
+        }
+
+        // Flush state decaying towards denormals, which are many times slower to process, after every hit
+        for (int c = 0; c < Channels; ++c) {
+            state.z1[c] = std::fabs(z1[c]) < EFFECT_DENORMAL_FLOOR ? 0.0f : z1[c];
+            state.z2[c] = std::fabs(z2[c]) < EFFECT_DENORMAL_FLOOR ? 0.0f : z2[c];
+        }
+    }
+
+    // Saturates, scaled so full scale in stays full scale out
+    void driveBlock(size_t frames) {
+        float drive = state.drive;
+        float makeup = 1.0f / softClip(drive);
+
+        for (int c = 0; c < Channels; ++c) {
+            float *x = planar[c];
+            for (size_t f = 0; f < frames; ++f) {
+                x[f] = softClip(drive * x[f]) * makeup;
+            }
+        }
+    }
+
+    // Feedback delay; the block is split where the read or write position wraps around the line
+    void delayBlock(size_t frames) {
+        if (state.delay_frames != target.delay_frames) {
+            delayCrossfadeBlock(frames);
+            return;
+        }
+
+        float feedback = state.feedback;
+        float mix = state.delay_mix;
+        size_t done = 0;
+
+        while (done < frames) {
+            size_t write_pos = state.write_pos;
+            size_t read_pos = (write_pos + delay_capacity - state.delay_frames) % delay_capacity;
+            size_t n = std::min(frames - done, std::min(delay_capacity - write_pos, delay_capacity - read_pos));
+
+            for (int c = 0; c < Channels; ++c) {
+                float *line = delay_lines.data() + c * delay_capacity;
+                float *x = planar[c] + done;
+
+                for (size_t i = 0; i < n; ++i) {
+                    float wet = line[read_pos + i];
+                    line[write_pos + i] = x[i] + wet * feedback;
+                    x[i] += wet * mix;
+                }
+            }
+
+            state.write_pos = (write_pos + n) % delay_capacity;
+            done += n;
+        }
+    }
+
+    // The block after a delay time change: the echo fades linearly from the old read position to the new one,
+    // as jumping the read position would cut the echo mid-waveform. Only this block wraps sample by sample.
+    void delayCrossfadeBlock(size_t frames) {
+        float feedback = state.feedback;
+        float mix = state.delay_mix;
+        size_t old_offset = delay_capacity - state.delay_frames;
+        size_t new_offset = delay_capacity - target.delay_frames;
+        float fade_step = 1.0f / static_cast<float>(frames);
+
+        for (int c = 0; c < Channels; ++c) {
+            float *line = delay_lines.data() + c * delay_capacity;
+            float *x = planar[c];
+
+            for (size_t i = 0; i < frames; ++i) {
+                size_t write_pos = (state.write_pos + i) % delay_capacity;
+                float fade = static_cast<float>(i + 1) * fade_step;
+                float wet = line[(write_pos + old_offset) % delay_capacity] * (1.0f - fade) +
+                            line[(write_pos + new_offset) % delay_capacity] * fade;
+
+                line[write_pos] = x[i] + wet * feedback;
+                x[i] += wet * mix;
+            }
+        }
+
+        state.write_pos = (state.write_pos + frames) % delay_capacity;
+        state.delay_frames = target.delay_frames;
+    }
+};
+
+#endif // TRACK_EFFECTS_H
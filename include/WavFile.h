@@ -0,0 +1,134 @@
+#ifndef WAV_FILE_H
+#define WAV_FILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Size of the canonical 16-bit PCM header written by WavWriter
+#define WAV_HEADER_BYTES 44
+
+// Writes interleaved 16-bit PCM to a RIFF/WAVE file. The header is written up front with empty sizes and
+// patched by close(), so samples can be appended as they are produced.
+class WavWriter {
+public:
+    WavWriter() {}
+
+    ~WavWriter() {
+        close();
+    }
+
+    WavWriter(const WavWriter &) = delete;
+    WavWriter &operator=(const WavWriter &) = delete;
+
+    bool open(const std::string &path, unsigned int sample_rate, unsigned int channels) {
+        close();
+
+        file = fopen(path.c_str(), "wb");
+        if (!file) return false;
+
+        this->sample_rate = sample_rate;
+        this->channels = channels;
+        data_bytes = 0;
+        failed = false;
+
+        unsigned char header[WAV_HEADER_BYTES];
+        fillHeader(header, sample_rate, channels, 0);
+        failed = fwrite(header, 1, WAV_HEADER_BYTES, file) != WAV_HEADER_BYTES;
+
+        return !failed;
+    }
+
+    bool isOpen() const {
+        return file != nullptr;
+    }
+
+    // Appends `n_samples` interleaved samples (n_samples / channels frames), in host byte order (little endian
+    // on every host this builds for)
+    bool write(const int16_t *samples, size_t n_samples) {
+        if (!file || failed) return false;
+
+        failed = fwrite(samples, sizeof(int16_t), n_samples, file) != n_samples;
+        data_bytes += n_samples * sizeof(int16_t);
+
+        return !failed;
+    }
+
+    // Patches the sizes into the header and closes the file; false if any write failed
+    bool close() {
+        if (!file) return !failed;
+
+        unsigned char header[WAV_HEADER_BYTES];
+        fillHeader(header, sample_rate, channels, data_bytes);
+
+        if (fseek(file, 0, SEEK_SET) != 0 || fwrite(header, 1, WAV_HEADER_BYTES, file) != WAV_HEADER_BYTES) {
+            failed = true;
+        }
+        if (fclose(file) != 0) failed = true;
+
+        file = nullptr;
+        return !failed;
+    }
+
+    size_t bytesWritten() const {
+        return data_bytes;
+    }
+
+    // Header for `data_bytes` of 16-bit PCM (all fields little endian). A `header_bytes` larger than the canonical
+    // 44 pads the header with a JUNK chunk (at least 8 bytes), e.g. so the samples start on a disk-block boundary.
+    static void fillHeader(
+        unsigned char *header,
+        unsigned int sample_rate,
+        unsigned int channels,
+        size_t data_bytes,
+        size_t header_bytes = WAV_HEADER_BYTES
+    ) {
+        uint32_t data_size = static_cast<uint32_t>(data_bytes);
+        uint32_t byte_rate = sample_rate * channels * sizeof(int16_t);
+        uint16_t block_align = static_cast<uint16_t>(channels * sizeof(int16_t));
+        uint32_t padding = static_cast<uint32_t>(header_bytes - WAV_HEADER_BYTES);
+
+        memcpy(header, "RIFF", 4);
+        putLE32(header + 4, static_cast<uint32_t>(header_bytes - 8) + data_size);
+        memcpy(header + 8, "WAVE", 4);
+        memcpy(header + 12, "fmt ", 4);
+        putLE32(header + 16, 16);
+        putLE16(header + 20, 1);  // PCM
+        putLE16(header + 22, static_cast<uint16_t>(channels));
+        putLE32(header + 24, sample_rate);
+        putLE32(header + 28, byte_rate);
+        putLE16(header + 32, block_align);
+        putLE16(header + 34, 16);
+
+        unsigned char *data_chunk = header + 36;
+        if (padding > 0) {
+            memcpy(data_chunk, "JUNK", 4);
+            putLE32(data_chunk + 4, padding - 8);
+            memset(data_chunk + 8, 0, padding - 8);
+            data_chunk += padding;
+        }
+
+        memcpy(data_chunk, "data", 4);
+        putLE32(data_chunk + 4, data_size);
+    }
+
+private:
+    FILE *file = nullptr;
+    unsigned int sample_rate = 0;
+    unsigned int channels = 0;
+    size_t data_bytes = 0;
+    bool failed = false;
+
+    static void putLE16(unsigned char *p, uint16_t v) {
+        p[0] = static_cast<unsigned char>(v);
+        p[1] = static_cast<unsigned char>(v >> 8);
+    }
+
+    static void putLE32(unsigned char *p, uint32_t v) {
+        putLE16(p, static_cast<uint16_t>(v));
+        putLE16(p + 2, static_cast<uint16_t>(v >> 16));
+    }
+};
+
+#endif // WAV_FILE_H
@@ -0,0 +1,159 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct WorkStealingStatistics {
+    size_t tasks = 0;
+    size_t steals = 0;  // Tasks a worker took from another worker's queue
+};
+
+// Fixed set of worker threads, each with its own task queue. A worker runs its own queue newest first (the
+// data it just touched is still in cache) and, once that is empty, steals the oldest task of another worker,
+// so uneven batches still keep every core busy until the end.
+class WorkStealingPool {
+public:
+    typedef std::function<void()> Task;
+
+    // Zero threads uses one per hardware thread
+    explicit WorkStealingPool(size_t n_threads = 0) {
+        if (n_threads == 0) n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+        for (size_t i = 0; i < n_threads; ++i) {
+            queues.emplace_back(new WorkerQueue());
+        }
+        for (size_t i = 0; i < n_threads; ++i) {
+            workers.emplace_back(&WorkStealingPool::workerThread, this, i);
+        }
+    }
+
+    // Runs whatever is still queued, then joins the workers
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(idle_mtx);
+            stopping = true;
+        }
+        idle_cv.notify_all();
+
+        for (std::thread &worker : workers) {
+            if (worker.joinable()) worker.join();
+        }
+    }
+
+    size_t threadCount() const {
+        return workers.size();
+    }
+
+    // Queues `task` on the next worker in turn
+    void submit(Task task) {
+        size_t index = next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+
+        {
+            std::lock_guard<std::mutex> idle_lock(idle_mtx);
+            outstanding++;
+            queued++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mtx);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+
+        idle_cv.notify_one();
+    }
+
+    // Blocks until every submitted task has finished
+    void wait() {
+        std::unique_lock<std::mutex> lock(idle_mtx);
+        done_cv.wait(lock, [&]() { return outstanding == 0; });
+    }
+
+    WorkStealingStatistics statistics() {
+        std::lock_guard<std::mutex> lock(idle_mtx);
+        return stats;
+    }
+
+private:
+    struct WorkerQueue {
+        std::mutex mtx;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next_queue{0};
+
+    // Guards the counts, `stopping` and the statistics; idle workers sleep on it until something is queued
+    std::mutex idle_mtx;
+    std::condition_variable idle_cv;
+    std::condition_variable done_cv;
+    size_t outstanding = 0;  // Submitted and not finished
+    size_t queued = 0;       // Submitted and not taken by a worker
+    bool stopping = false;
+    WorkStealingStatistics stats;
+
+    bool popOwn(size_t index, Task &task) {
+        WorkerQueue &queue = *queues[index];
+        std::lock_guard<std::mutex> lock(queue.mtx);
+        if (queue.tasks.empty()) return false;
+
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t thief, Task &task) {
+        for (size_t k = 1; k < queues.size(); ++k) {
+            WorkerQueue &queue = *queues[(thief + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mtx);
+            if (queue.tasks.empty()) continue;
+
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+
+        return false;
+    }
+
+    void workerThread(size_t index) {
+        while (true) {
+            Task task;
+            bool stolen = false;
+
+            if (!popOwn(index, task)) {
+                stolen = steal(index, task);
+            }
+
+            if (!task) {
+                std::unique_lock<std::mutex> lock(idle_mtx);
+                idle_cv.wait(lock, [&]() { return stopping || queued > 0; });
+                if (stopping && queued == 0) return;
+
+                // A task is counted just before it is pushed, so the scan may briefly come up empty again
+                continue;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(idle_mtx);
+                queued--;
+            }
+
+            task();
+
+            std::lock_guard<std::mutex> lock(idle_mtx);
+            stats.tasks++;
+            if (stolen) stats.steals++;
+            if (--outstanding == 0) done_cv.notify_all();
+        }
+    }
+};
+
+#endif // WORK_STEALING_POOL_H
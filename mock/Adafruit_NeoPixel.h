@@ -0,0 +1,56 @@
+#ifndef MOCK_ADAFRUIT_NEOPIXEL_H
+#define MOCK_ADAFRUIT_NEOPIXEL_H
+
+// A WS2812 strip: the pixels are held on the host and show() charges the time the Uno spends bit-banging them
+
+#include <Arduino.h>
+#include <vector>
+
+#define NEO_GRB 0x52
+#define NEO_KHZ800 0x0000
+
+class Adafruit_NeoPixel {
+public:
+    Adafruit_NeoPixel(uint16_t n_pixels, int16_t pin, uint16_t type) : pin(pin), type(type), pixels(n_pixels, 0) {}
+
+    void begin() {
+        pinMode(static_cast<uint8_t>(pin), OUTPUT);
+    }
+
+    void setBrightness(uint8_t brightness) {
+        this->brightness = brightness;
+    }
+
+    void clear() {
+        std::fill(pixels.begin(), pixels.end(), 0);
+    }
+
+    void setPixelColor(uint16_t n, uint32_t color) {
+        if (n < pixels.size()) pixels[n] = color;
+    }
+
+    uint32_t getPixelColor(uint16_t n) const {
+        return n < pixels.size() ? pixels[n] : 0;
+    }
+
+    uint16_t numPixels() const {
+        return static_cast<uint16_t>(pixels.size());
+    }
+
+    void show() {
+        MockBoard::instance().neopixelShow(pixels.size(), last_show_end);
+    }
+
+    static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) {
+        return (static_cast<uint32_t>(r) << 16) | (static_cast<uint32_t>(g) << 8) | b;
+    }
+
+private:
+    int16_t pin;
+    uint16_t type;
+    uint8_t brightness = 255;
+    std::vector<uint32_t> pixels;
+    uint64_t last_show_end = 0;
+};
+
+#endif // MOCK_ADAFRUIT_NEOPIXEL_H
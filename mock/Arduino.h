@@ -0,0 +1,129 @@
+#ifndef MOCK_ARDUINO_H
+#define MOCK_ARDUINO_H
+
+// The parts of the Arduino core the firmware uses, on top of MockBoard
+
+#include <MockBoard.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define LOW 0
+#define HIGH 1
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+    MockBoard::instance().setPinMode(pin, mode == INPUT_PULLUP);
+}
+
+inline int digitalRead(uint8_t pin) {
+    return MockBoard::instance().read(pin);
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t level) {
+    MockBoard::instance().write(pin, level);
+}
+
+inline void delayMicroseconds(unsigned int us) {
+    MockBoard::instance().spend(MOCK_COST_DELAY, static_cast<uint64_t>(us) * MOCK_CYCLES_PER_US);
+}
+
+inline void delay(unsigned long ms) {
+    MockBoard::instance().spend(MOCK_COST_DELAY, static_cast<uint64_t>(ms) * 1000 * MOCK_CYCLES_PER_US);
+}
+
+inline unsigned long micros() {
+    return static_cast<unsigned long>(MockBoard::instance().now() / MOCK_CYCLES_PER_US);
+}
+
+inline unsigned long millis() {
+    return static_cast<unsigned long>(MockBoard::instance().now() / (MOCK_CYCLES_PER_US * 1000));
+}
+
+// The core's min/max are macros; templates keep them from clashing with the standard library
+template <typename A, typename B>
+inline A min(A a, B b) {
+    return b < a ? static_cast<A>(b) : a;
+}
+
+template <typename A, typename B>
+inline A max(A a, B b) {
+    return a < b ? static_cast<A>(b) : a;
+}
+
+class String {
+public:
+    String(const char *text = "") : text(text) {}
+    String(const std::string &text) : text(text) {}
+    explicit String(int value) : text(std::to_string(value)) {}
+    explicit String(long value) : text(std::to_string(value)) {}
+
+    unsigned int length() const {
+        return static_cast<unsigned int>(text.size());
+    }
+
+    const char *c_str() const {
+        return text.c_str();
+    }
+
+    String &operator+=(const String &other) {
+        text += other.text;
+        return *this;
+    }
+
+    friend String operator+(const String &a, const String &b) {
+        return String(a.text + b.text);
+    }
+
+    friend String operator+(const char *a, const String &b) {
+        return String(std::string(a) + b.text);
+    }
+
+private:
+    std::string text;
+};
+
+class HardwareSerial {
+public:
+    void begin(unsigned long baud) {
+        MockBoard::instance().serialBegin(baud);
+    }
+
+    size_t write(uint8_t value) {
+        MockBoard::instance().serialWrite(value);
+        return 1;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) {
+        for (size_t i = 0; i < size; ++i) write(buffer[i]);
+        return size;
+    }
+
+    int available() {
+        return MockBoard::instance().serialAvailable();
+    }
+
+    int read() {
+        return MockBoard::instance().serialRead();
+    }
+
+    size_t print(const char *text) {
+        return write(reinterpret_cast<const uint8_t *>(text), strlen(text));
+    }
+
+    size_t println(const char *text) {
+        return print(text) + print("\r\n");
+    }
+};
+
+inline HardwareSerial Serial;
+
+#endif // MOCK_ARDUINO_H
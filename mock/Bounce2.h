@@ -0,0 +1,55 @@
+#ifndef MOCK_BOUNCE2_H
+#define MOCK_BOUNCE2_H
+
+// Bounce2's Debouncer in its default stable-interval mode: a new state counts once it has held for interval()
+
+#include <Arduino.h>
+
+class Debouncer {
+public:
+    Debouncer() {}
+    virtual ~Debouncer() {}
+
+    void interval(uint16_t interval_ms) {
+        this->interval_ms = interval_ms;
+    }
+
+    bool update() {
+        changed = false;
+        bool current = readCurrentState();
+
+        if (current != unstable_state) {
+            unstable_state = current;
+            previous_ms = millis();
+        } else if (current != stable_state && millis() - previous_ms >= interval_ms) {
+            stable_state = current;
+            changed = true;
+        }
+
+        return changed;
+    }
+
+    bool read() const {
+        return stable_state;
+    }
+
+    bool rose() const {
+        return changed && stable_state;
+    }
+
+    bool fell() const {
+        return changed && !stable_state;
+    }
+
+protected:
+    virtual bool readCurrentState() = 0;
+
+private:
+    uint16_t interval_ms = 10;
+    unsigned long previous_ms = 0;
+    bool unstable_state = false;
+    bool stable_state = false;
+    bool changed = false;
+};
+
+#endif // MOCK_BOUNCE2_H
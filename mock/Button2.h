@@ -0,0 +1,79 @@
+#ifndef MOCK_BUTTON2_H
+#define MOCK_BUTTON2_H
+
+// Button2's click, double-click and long-click detection for an active-low button, with its default timings
+
+#include <Arduino.h>
+
+#define BUTTON2_LONGCLICK_MS 200
+#define BUTTON2_DOUBLECLICK_MS 300
+
+class Button2 {
+public:
+    typedef void (*CallbackFunction)(Button2 &);
+
+    explicit Button2(uint8_t pin) : pin(pin) {}
+
+    void setDebounceTime(unsigned int ms) {
+        debounce_ms = ms;
+    }
+
+    void setClickHandler(CallbackFunction handler) {
+        click_handler = handler;
+    }
+
+    void setDoubleClickHandler(CallbackFunction handler) {
+        double_click_handler = handler;
+    }
+
+    void setLongClickDetectedHandler(CallbackFunction handler) {
+        long_click_handler = handler;
+    }
+
+    void loop() {
+        unsigned long now = millis();
+        bool down = digitalRead(pin) == LOW;
+
+        if (down != pressed && now - last_change_ms >= debounce_ms) {
+            pressed = down;
+            last_change_ms = now;
+
+            if (pressed) {
+                press_ms = now;
+                long_reported = false;
+            } else if (!long_reported) {
+                clicks++;
+                release_ms = now;
+            }
+        }
+
+        if (pressed && !long_reported && now - press_ms >= BUTTON2_LONGCLICK_MS) {
+            long_reported = true;
+            clicks = 0;
+            if (long_click_handler) long_click_handler(*this);
+        }
+
+        if (!pressed && clicks > 0 && now - release_ms >= BUTTON2_DOUBLECLICK_MS) {
+            CallbackFunction handler = clicks == 1 ? click_handler : double_click_handler;
+            clicks = 0;
+            if (handler) handler(*this);
+        }
+    }
+
+private:
+    uint8_t pin;
+    unsigned int debounce_ms = 50;
+
+    bool pressed = false;
+    bool long_reported = false;
+    unsigned long last_change_ms = 0;
+    unsigned long press_ms = 0;
+    unsigned long release_ms = 0;
+    int clicks = 0;
+
+    CallbackFunction click_handler = nullptr;
+    CallbackFunction double_click_handler = nullptr;
+    CallbackFunction long_click_handler = nullptr;
+};
+
+#endif // MOCK_BUTTON2_H
@@ -0,0 +1,21 @@
+#ifndef MOCK_ENCODER_H
+#define MOCK_ENCODER_H
+
+// A rotary encoder whose position is set through MockBoard::encoder_position (4 counts per detent)
+
+#include <Arduino.h>
+
+class Encoder {
+public:
+    Encoder(uint8_t pin1, uint8_t pin2) {
+        pinMode(pin1, INPUT_PULLUP);
+        pinMode(pin2, INPUT_PULLUP);
+    }
+
+    long read() {
+        MockBoard::instance().spend(MOCK_COST_ENCODER, MOCK_ENCODER_READ_CYCLES);
+        return MockBoard::instance().encoder_position;
+    }
+};
+
+#endif // MOCK_ENCODER_H
@@ -0,0 +1,75 @@
+#ifndef MOCK_LIQUID_CRYSTAL_I2C_H
+#define MOCK_LIQUID_CRYSTAL_I2C_H
+
+// An HD44780 behind a PCF8574 expander, as driven by LiquidCrystal_I2C: every byte goes out as two 4-bit
+// nibbles, each written once and then pulsed on the enable line (three I2C transmissions and 51 us of delays)
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#define LCD_TRANSMISSIONS_PER_BYTE 6
+#define LCD_DELAY_US_PER_BYTE 102
+#define LCD_CLEAR_DELAY_US 2000
+
+class LiquidCrystal_I2C {
+public:
+    LiquidCrystal_I2C(uint8_t address, uint8_t cols, uint8_t rows) : address(address), cols(cols), rows(rows) {}
+
+    // Power-up waits and the 4-bit mode handshake
+    void init() {
+        delay(1050);
+        for (int i = 0; i < 4; ++i) nibbleOut();
+        delayMicroseconds(3 * 4500 + 150);
+
+        for (int i = 0; i < 4; ++i) byteOut();  // Function set, display on, entry mode, home
+        clear();
+    }
+
+    void backlight() {
+        MockBoard::instance().i2cTransmission(1);
+    }
+
+    void clear() {
+        byteOut();
+        MockBoard::instance().spend(MOCK_COST_I2C, LCD_CLEAR_DELAY_US * MOCK_CYCLES_PER_US);
+    }
+
+    void setCursor(uint8_t col, uint8_t row) {
+        (void)col;
+        (void)row;
+        byteOut();
+    }
+
+    size_t write(uint8_t value) {
+        (void)value;
+        byteOut();
+        return 1;
+    }
+
+    size_t print(const char *text) {
+        size_t n = strlen(text);
+        for (size_t i = 0; i < n; ++i) byteOut();
+        return n;
+    }
+
+    size_t print(const String &text) {
+        return print(text.c_str());
+    }
+
+private:
+    uint8_t address;
+    uint8_t cols;
+    uint8_t rows;
+
+    void nibbleOut() {
+        for (int i = 0; i < LCD_TRANSMISSIONS_PER_BYTE / 2; ++i) MockBoard::instance().i2cTransmission(1);
+        MockBoard::instance().spend(MOCK_COST_I2C, LCD_DELAY_US_PER_BYTE / 2 * MOCK_CYCLES_PER_US);
+    }
+
+    void byteOut() {
+        nibbleOut();
+        nibbleOut();
+    }
+};
+
+#endif // MOCK_LIQUID_CRYSTAL_I2C_H
@@ -0,0 +1,242 @@
+#ifndef MOCK_BOARD_H
+#define MOCK_BOARD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Host stand-in for the Uno the firmware runs on (see src/firmware_profile.cpp). Time is a simulated count of
+// 16 MHz cycles that only the mocked I/O advances, each call charged roughly what it costs on the board, so
+// the counts describe the firmware's I/O and bus traffic, not its own computation.
+#define MOCK_CPU_HZ 16000000UL
+#define MOCK_CYCLES_PER_US (MOCK_CPU_HZ / 1000000UL)
+
+// Arduino core pin functions (pin lookup plus port access)
+#define MOCK_DIGITAL_READ_CYCLES 52
+#define MOCK_DIGITAL_WRITE_CYCLES 56
+
+// Serial.write() queues a byte in the core's 64-byte transmit buffer and only waits once that is full
+#define MOCK_SERIAL_WRITE_CYCLES 40
+#define MOCK_SERIAL_TX_BUFFER 63
+#define MOCK_SERIAL_BITS_PER_BYTE 10
+
+// Serial.available() and Serial.read() only look at the core's receive ring
+#define MOCK_SERIAL_READ_CYCLES 20
+
+// Wire sends synchronously at 100 kHz: 9 bits per byte including the acknowledge
+#define MOCK_I2C_HZ 100000UL
+#define MOCK_I2C_BITS_PER_BYTE 9
+
+// WS2812 data at 800 kHz, 24 bits per pixel, sent with interrupts off; the library waits until 300 us have
+// passed since the strip's previous show() so the pixels latch
+#define MOCK_NEOPIXEL_CYCLES_PER_BIT 20
+#define MOCK_NEOPIXEL_LATCH_US 300
+
+// Encoder::read() copies the position with interrupts off
+#define MOCK_ENCODER_READ_CYCLES 20
+
+enum MockCost {
+    MOCK_COST_GPIO = 0,      // digitalRead/digitalWrite
+    MOCK_COST_DELAY = 1,     // delay()/delayMicroseconds()
+    MOCK_COST_SERIAL = 2,    // Queueing bytes, plus waiting on a full transmit buffer
+    MOCK_COST_I2C = 3,       // LCD traffic, including the LCD's own command delays
+    MOCK_COST_NEOPIXEL = 4,
+    MOCK_COST_ENCODER = 5,
+    N_MOCK_COSTS = 6
+};
+
+struct MockCounters {
+    uint64_t cycles[N_MOCK_COSTS] = {};
+    uint64_t serial_bytes = 0;
+    uint64_t serial_blocked_cycles = 0;  // Part of the serial cycles spent waiting for buffer space
+    uint64_t i2c_bytes = 0;              // Address and data bytes on the bus
+    uint64_t neopixel_bytes = 0;
+    uint64_t gpio_calls = 0;
+
+    uint64_t totalCycles() const {
+        uint64_t total = 0;
+        for (int i = 0; i < N_MOCK_COSTS; ++i) total += cycles[i];
+        return total;
+    }
+};
+
+// A byte the firmware handed to Serial, with the simulated time it was queued
+struct MockSerialByte {
+    uint64_t cycle;
+    uint8_t value;
+};
+
+class MockBoard {
+public:
+    static MockBoard &instance() {
+        static MockBoard board;
+        return board;
+    }
+
+    uint64_t now() const {
+        return cycle;
+    }
+
+    void spend(MockCost cost, uint64_t cycles) {
+        counters.cycles[cost] += cycles;
+        cycle += cycles;
+    }
+
+    const MockCounters &totals() const {
+        return counters;
+    }
+
+    // Pins
+
+    void setPinMode(uint8_t pin, uint8_t pullup) {
+        if (pin < N_PINS && pullup) levels[pin] = 1;
+    }
+
+    // Drives an input from outside the board (a button, for example)
+    void setInput(uint8_t pin, int level) {
+        if (pin < N_PINS) levels[pin] = level ? 1 : 0;
+    }
+
+    int read(uint8_t pin) {
+        spend(MOCK_COST_GPIO, MOCK_DIGITAL_READ_CYCLES);
+        counters.gpio_calls++;
+
+        if (pin == chain_data_pin && !chain_inputs.empty()) {
+            size_t byte_index = chain_position / 8;
+            if (byte_index >= chain_inputs.size()) return 0;
+            return (chain_latched[byte_index] >> (7 - chain_position % 8)) & 1;
+        }
+        return pin < N_PINS ? levels[pin] : 0;
+    }
+
+    void write(uint8_t pin, int level) {
+        spend(MOCK_COST_GPIO, MOCK_DIGITAL_WRITE_CYCLES);
+        counters.gpio_calls++;
+        if (pin >= N_PINS) return;
+
+        int previous = levels[pin];
+        levels[pin] = level ? 1 : 0;
+
+        // A chain of 74HC165s: the parallel inputs load while the latch is low, and each rising clock edge
+        // moves the next bit to the data pin, most significant bit of the first byte first
+        if (pin == chain_latch_pin && !level) {
+            chain_latched = chain_inputs;
+            chain_position = 0;
+        } else if (pin == chain_clock_pin && level && !previous) {
+            chain_position++;
+        }
+    }
+
+    // Wires a chain of `n_bytes` shift registers to the given pins. Input bit i of the chain shows up as bit
+    // (i % 8) of byte (i / 8) once the firmware has shifted the chain in.
+    void attachShiftRegisters(uint8_t latch_pin, uint8_t clock_pin, uint8_t data_pin, size_t n_bytes) {
+        chain_latch_pin = latch_pin;
+        chain_clock_pin = clock_pin;
+        chain_data_pin = data_pin;
+        chain_inputs.assign(n_bytes, 0);
+        chain_latched.assign(n_bytes, 0);
+    }
+
+    void setShiftRegisterInput(size_t index, bool pressed) {
+        if (index / 8 >= chain_inputs.size()) return;
+
+        uint8_t mask = static_cast<uint8_t>(1 << (index % 8));
+        if (pressed) {
+            chain_inputs[index / 8] |= mask;
+        } else {
+            chain_inputs[index / 8] &= static_cast<uint8_t>(~mask);
+        }
+    }
+
+    // Serial
+
+    void serialBegin(unsigned long baud) {
+        cycles_per_serial_byte = MOCK_CPU_HZ * MOCK_SERIAL_BITS_PER_BYTE / baud;
+    }
+
+    void serialWrite(uint8_t value) {
+        if (cycles_per_serial_byte == 0) return;
+
+        // Bytes still waiting in the transmit buffer at this point
+        uint64_t pending = tx_idle_at > cycle ? (tx_idle_at - cycle + cycles_per_serial_byte - 1) / cycles_per_serial_byte : 0;
+
+        if (pending >= MOCK_SERIAL_TX_BUFFER) {
+            uint64_t space_at = tx_idle_at - (MOCK_SERIAL_TX_BUFFER - 1) * cycles_per_serial_byte;
+            counters.serial_blocked_cycles += space_at - cycle;
+            spend(MOCK_COST_SERIAL, space_at - cycle);
+        }
+
+        spend(MOCK_COST_SERIAL, MOCK_SERIAL_WRITE_CYCLES);
+        tx_idle_at = (tx_idle_at > cycle ? tx_idle_at : cycle) + cycles_per_serial_byte;
+
+        counters.serial_bytes++;
+        serial_output.push_back({cycle, value});
+    }
+
+    // Everything written to Serial so far; the caller may clear it
+    std::vector<MockSerialByte> serial_output;
+
+    // Bytes the host has sent, oldest first, as if already in the receive ring
+    std::deque<uint8_t> serial_input;
+
+    int serialAvailable() {
+        spend(MOCK_COST_SERIAL, MOCK_SERIAL_READ_CYCLES);
+        return static_cast<int>(serial_input.size());
+    }
+
+    int serialRead() {
+        spend(MOCK_COST_SERIAL, MOCK_SERIAL_READ_CYCLES);
+        if (serial_input.empty()) return -1;
+
+        uint8_t value = serial_input.front();
+        serial_input.pop_front();
+        return value;
+    }
+
+    // I2C
+
+    // One Wire transmission: the address byte plus `n_data_bytes`
+    void i2cTransmission(size_t n_data_bytes) {
+        uint64_t n_bytes = n_data_bytes + 1;
+        counters.i2c_bytes += n_bytes;
+        spend(MOCK_COST_I2C, n_bytes * MOCK_I2C_BITS_PER_BYTE * (MOCK_CPU_HZ / MOCK_I2C_HZ));
+    }
+
+    // Encoder
+
+    long encoder_position = 0;
+
+    // NeoPixel
+
+    // Sends `n_pixels` to a strip whose previous show() ended at `last_show_end` (updated)
+    void neopixelShow(size_t n_pixels, uint64_t &last_show_end) {
+        uint64_t latch_cycles = static_cast<uint64_t>(MOCK_NEOPIXEL_LATCH_US) * MOCK_CYCLES_PER_US;
+        if (last_show_end > 0 && cycle < last_show_end + latch_cycles) {
+            spend(MOCK_COST_NEOPIXEL, last_show_end + latch_cycles - cycle);
+        }
+
+        counters.neopixel_bytes += n_pixels * 3;
+        spend(MOCK_COST_NEOPIXEL, n_pixels * 24 * MOCK_NEOPIXEL_CYCLES_PER_BIT);
+        last_show_end = cycle;
+    }
+
+private:
+    static const uint8_t N_PINS = 32;
+
+    uint64_t cycle = 0;
+    MockCounters counters;
+    int levels[N_PINS] = {};
+
+    uint8_t chain_latch_pin = 0xFF;
+    uint8_t chain_clock_pin = 0xFF;
+    uint8_t chain_data_pin = 0xFF;
+    std::vector<uint8_t> chain_inputs;
+    std::vector<uint8_t> chain_latched;
+    size_t chain_position = 0;
+
+    uint64_t cycles_per_serial_byte = 0;
+    uint64_t tx_idle_at = 0;  // When the transmit buffer will have drained
+};
+
+#endif // MOCK_BOARD_H
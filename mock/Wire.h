@@ -0,0 +1,15 @@
+#ifndef MOCK_WIRE_H
+#define MOCK_WIRE_H
+
+// Only LiquidCrystal_I2C talks I2C, and its mock charges the bus traffic itself
+
+#include <Arduino.h>
+
+class TwoWire {
+public:
+    void begin() {}
+};
+
+inline TwoWire Wire;
+
+#endif // MOCK_WIRE_H
@@ -0,0 +1,62 @@
+#ifndef MOCK_CPP_QUEUE_H
+#define MOCK_CPP_QUEUE_H
+
+// cppQueue's fixed-size record queue; a push onto a full queue is refused
+
+#include <Arduino.h>
+#include <vector>
+
+typedef enum enumQueueType {
+    FIFO = 0,
+    LIFO = 1
+} QueueType;
+
+class cppQueue {
+public:
+    cppQueue(size_t record_size, uint16_t n_records, QueueType type = FIFO) :
+        record_size(record_size),
+        capacity(n_records),
+        type(type),
+        records(record_size * n_records) {}
+
+    bool push(const void *record) {
+        if (count == capacity) return false;
+
+        memcpy(&records[((head + count) % capacity) * record_size], record, record_size);
+        count++;
+        return true;
+    }
+
+    bool pop(void *record) {
+        if (count == 0) return false;
+
+        size_t index = type == LIFO ? (head + count - 1) % capacity : head;
+        memcpy(record, &records[index * record_size], record_size);
+
+        if (type != LIFO) head = (head + 1) % capacity;
+        count--;
+        return true;
+    }
+
+    bool isEmpty() const {
+        return count == 0;
+    }
+
+    bool isFull() const {
+        return count == capacity;
+    }
+
+    uint16_t getCount() const {
+        return count;
+    }
+
+private:
+    size_t record_size;
+    uint16_t capacity;
+    QueueType type;
+    std::vector<uint8_t> records;
+    size_t head = 0;
+    uint16_t count = 0;
+};
+
+#endif // MOCK_CPP_QUEUE_H
@@ -0,0 +1,188 @@
+// Throughput and fairness of the action bus with 1 to 8 producers pushing as fast as they can, next to the
+// single queue behind a producer mutex that it replaced. The consumer only pops, so this measures the handoff,
+// not the cost of applying an action. Build with `make busbench`.
+
+#include <ActionBus.h>
+#include <DrumMachineState.h>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define DEFAULT_BENCH_MS 500
+#define DEFAULT_MAX_PRODUCERS 8
+
+// Handoff latency is sampled once per this many actions
+#define LATENCY_SAMPLE_EVERY 64
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchAction {
+    Action action;
+    Clock::time_point pushed_time;
+};
+
+// The previous design: every producer takes turns on one single-producer queue
+class MutexQueue {
+public:
+    struct Message {
+        BenchAction value;
+        uint16_t source = 0;
+        uint32_t sequence = 0;
+    };
+
+    explicit MutexQueue(size_t n_sources) : next_sequence(n_sources, 0) {}
+
+    bool push(int source, const BenchAction &value) {
+        std::lock_guard<std::mutex> lock(producer_mtx);
+
+        Message message;
+        message.value = value;
+        message.source = static_cast<uint16_t>(source);
+        message.sequence = next_sequence[source];
+        if (!queue.push(message)) return false;
+
+        next_sequence[source]++;
+        return true;
+    }
+
+    bool pop(Message &message) {
+        return queue.pop(message);
+    }
+
+private:
+    boost::lockfree::spsc_queue<Message, boost::lockfree::capacity<10>> queue;
+    std::mutex producer_mtx;
+    std::vector<uint32_t> next_sequence;
+};
+
+struct BenchResult {
+    double actions_per_second = 0.0;
+    double fairness = 0.0;       // Fewest actions of any producer over the most, while all were pushing
+    double p50_handoff_us = 0.0;
+    double p99_handoff_us = 0.0;
+    size_t n_out_of_order = 0;   // Per-source sequence numbers that did not follow the previous one
+};
+
+template <typename Queue, typename Message>
+BenchResult runBench(Queue &queue, int n_producers, int bench_ms) {
+    std::atomic<bool> pushing{true};
+    std::atomic<int> n_ready{0};
+    std::vector<std::thread> producers;
+
+    for (int p = 0; p < n_producers; ++p) {
+        producers.emplace_back([&, p]() {
+            BenchAction action;
+            action.action = Action::create_TrackBeatToggle(static_cast<track_id_t>(p % N_TRACKS), static_cast<unsigned char>(p));
+
+            n_ready++;
+            while (n_ready.load() < n_producers) std::this_thread::yield();
+
+            // Waits yield, so the run means something with more threads than cores
+            while (pushing.load(std::memory_order_relaxed)) {
+                action.pushed_time = Clock::now();
+                while (!queue.push(p, action) && pushing.load(std::memory_order_relaxed)) std::this_thread::yield();
+            }
+        });
+    }
+
+    std::vector<uint64_t> popped(n_producers, 0);
+    std::vector<uint32_t> expected_sequence(n_producers, 0);
+    std::vector<double> handoff_us;
+    BenchResult result;
+
+    while (n_ready.load() < n_producers) std::this_thread::yield();
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = start + std::chrono::milliseconds(bench_ms);
+    uint64_t n_popped = 0;
+
+    Message message;
+    while (true) {
+        if (!queue.pop(message)) {
+            if (Clock::now() >= end) break;
+            std::this_thread::yield();
+            continue;
+        }
+
+        Clock::time_point now = Clock::now();
+        if (message.sequence != expected_sequence[message.source]) result.n_out_of_order++;
+        expected_sequence[message.source] = message.sequence + 1;
+        popped[message.source]++;
+
+        if (n_popped++ % LATENCY_SAMPLE_EVERY == 0) {
+            handoff_us.push_back(std::chrono::duration<double, std::micro>(now - message.value.pushed_time).count());
+            if (now >= end) break;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    pushing = false;
+    for (std::thread &producer : producers) producer.join();
+    while (queue.pop(message)) {}
+
+    result.actions_per_second = n_popped / seconds;
+    uint64_t fewest = *std::min_element(popped.begin(), popped.end());
+    uint64_t most = *std::max_element(popped.begin(), popped.end());
+    result.fairness = most > 0 ? static_cast<double>(fewest) / most : 0.0;
+
+    std::sort(handoff_us.begin(), handoff_us.end());
+    if (!handoff_us.empty()) {
+        result.p50_handoff_us = handoff_us[handoff_us.size() / 2];
+        result.p99_handoff_us = handoff_us[std::min(handoff_us.size() - 1, handoff_us.size() * 99 / 100)];
+    }
+    return result;
+}
+
+int main(int argc, char **argv) {
+    int bench_ms = DEFAULT_BENCH_MS;
+    int max_producers = DEFAULT_MAX_PRODUCERS;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--ms") == 0 && i + 1 < argc) {
+            bench_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-producers") == 0 && i + 1 < argc) {
+            max_producers = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--ms N] [--max-producers N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (bench_ms < 1 || max_producers < 1 || max_producers > ACTION_BUS_MAX_SOURCES) {
+        fprintf(stderr, "Error: the run must be positive and have 1-%d producers\n", ACTION_BUS_MAX_SOURCES);
+        return 1;
+    }
+
+    printf("Actions handed to one consumer, %d ms per run on %u hardware threads (fairness = fewest/most per producer)\n",
+           bench_ms, std::thread::hardware_concurrency());
+    printf("%11s | %14s %8s %9s %9s | %15s %8s %9s %9s\n", "", "bus actions/s", "fairness", "p50 us", "p99 us",
+           "mutex actions/s", "fairness", "p50 us", "p99 us");
+
+    size_t n_out_of_order = 0;
+    for (int n = 1; n <= max_producers; ++n) {
+        ActionBus<BenchAction> bus;
+        for (int p = 0; p < n; ++p) bus.addSource("producer " + std::to_string(p));
+        BenchResult lock_free = runBench<ActionBus<BenchAction>, ActionBus<BenchAction>::Message>(bus, n, bench_ms);
+
+        MutexQueue mutex_queue(n);
+        BenchResult locked = runBench<MutexQueue, MutexQueue::Message>(mutex_queue, n, bench_ms);
+
+        printf("%d %-9s | %14.0f %8.2f %9.1f %9.1f | %15.0f %8.2f %9.1f %9.1f\n", n, n == 1 ? "producer" : "producers",
+               lock_free.actions_per_second, lock_free.fairness, lock_free.p50_handoff_us, lock_free.p99_handoff_us,
+               locked.actions_per_second, locked.fairness, locked.p50_handoff_us, locked.p99_handoff_us);
+
+        n_out_of_order += lock_free.n_out_of_order + locked.n_out_of_order;
+    }
+
+    if (n_out_of_order > 0) {
+        fprintf(stderr, "Error: %zu actions arrived out of order within their source\n", n_out_of_order);
+        return 1;
+    }
+    return 0;
+}
@@ -11,484 +11,2190 @@ using namespace LibSerial;
 #include <atomic>
 #include <chrono>
 #include <csignal>
+#include <sys/resource.h>
 #include <cstdio>
+#include <cstring>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <utility>
 #include <vector>
 #include <queue>
 #include <algorithm>
 #include <boost/lockfree/spsc_queue.hpp>
+#include <ActionBus.h>
 #include <SFML/Audio.hpp>
 #include <SwitchingSoundStream.h>
+#include <MixedBusStream.h>
+#include <WorkStealingPool.h>
+#include <DrumRenderEngine.h>
+#include <PatternBank.h>
+#include <SongPlayer.h>
+#include <RealtimeThreads.h>
+#include <SerialCapture.h>
+#include <SerialDiscovery.h>
+#include <MidiActionMap.h>
+#include <MidiClock.h>
+#include <ControlProtocol.h>
+#include <future>
+#include <deque>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <AlsaMidi.h>
 
 #define SERIAL_READ_TIMEOUT_MS 100
 
+// Wait for the board to reset after its port opens at startup
+#define SERIAL_SETTLE_MS 500
+
+// A lost controller is looked for again after SERIAL_RECONNECT_MIN_MS, then twice as long each time, up to the max
+#define SERIAL_RECONNECT_MIN_MS 250
+#define SERIAL_RECONNECT_MAX_MS 4000
+#define SERIAL_DISCONNECTED_POLL_MS 20
+
+// How often an idle port checks that its device still exists
+#define SERIAL_PRESENCE_CHECK_MS 250
+
+// A reconnected board that has not echoed the resync snapshot back is sent it again after this long
+#define SERIAL_RESYNC_RETRY_MS 1000
+#define MIDI_POLL_TIMEOUT_MS 100
+
+// The control socket thread wakes at least this often to deliver replies and playhead events
+#define CONTROL_POLL_MS 5
+#define CONTROL_MAX_CLIENTS 16
+
+// A client whose unread output or unfinished request line grows past this is disconnected
+#define CONTROL_MAX_BUFFER_BYTES (1 << 20)
+
+// Audio mixed per session count by --bench-sessions, after one second of warm-up
+#define SESSION_BENCH_SECONDS 5
+
 std::atomic_bool running = true;
 
-void signalHandler(int signum) {
-    std::cout << "\nInterrupt signal (" << signum << ") received. Stopping thread..." << std::endl;
-    running = false;  // Set the flag to false to signal the thread to stop
-}
+void signalHandler(int signum) {
+    std::cout << "\nInterrupt signal (" << signum << ") received. Stopping thread..." << std::endl;
+    running = false;  // Set the flag to false to signal the thread to stop
+}
+
+typedef DrumRenderEngine<DefaultEngineConfig> Engine;
+
+// An action with the time its message arrived, so latency is measured from the controller, not the queue
+struct QueuedAction {
+    Action action;
+    SwitchingSoundStream::Clock::time_point received_time;
+};
+
+// A request that the consumer answers on its own thread: from the control socket (see ControlProtocol.h), or a
+// serial controller's resync
+struct ControlRequest {
+    enum Type {
+        BATCH,
+        STATE,
+        STATS,
+        SNAPSHOT,  // The active sequence, serialized; the reply holds its bytes
+    };
+    Type type;
+    std::vector<Action> actions;
+    SwitchingSoundStream::Clock::time_point received_time;
+    std::promise<std::string> reply;  // Data lines, then `ok ...` or `error ...`
+};
+
+typedef ControlProtocol<Engine::Sequence> EngineControlProtocol;
+
+class DrumSequenceDataConsumer {
+public:
+    // Sessions in one process share the sample bank, the render cache and, optionally, a render worker pool
+    DrumSequenceDataConsumer(
+        SampleBank<Engine::sample_t> &sample_bank,
+        RenderCache<DefaultEngineConfig> &render_cache,
+        WorkStealingPool *render_pool = nullptr
+    ) :
+        sample_bank(sample_bank),
+        pattern_bank(sample_bank, &render_cache, render_pool) {
+        // Initialize the audio stream; it starts playing in startOutput()
+        sound_stream.setLoop(true);
+    };
+
+    ~DrumSequenceDataConsumer() {
+        if (consumer_thread.joinable()) {
+            consumer_thread.join();
+        }
+
+        if (recorder) {
+            sound_stream.setRecorder(nullptr);
+            recorder->stop();
+            recorder->printStatistics();
+        }
+
+        if (midi_clock) {
+            sound_stream.setMidiClock(nullptr);
+            midi_clock->stop();
+            midi_clock->printStatistics();
+        }
+
+        printLatencyReport();
+    }
+
+    void spin() {
+        startOutput();
+        consumer_thread = std::thread(&DrumSequenceDataConsumer::consumerThread, this);
+    }
+
+    // Called once on the thread that polls, before the first poll()
+    void begin() {
+        if (!initial_song.empty()) {
+            song_player.start(initial_song, loop_initial_song);
+        }
+    }
+
+    // Advances song playback and applies at most one pending action; false when there was nothing to apply
+    bool poll() {
+        Action action;
+        song_player.poll();
+
+        if (publish_when_rendered) {
+            publishRenderedPattern();
+        }
+
+        reportStreamEvents();
+
+        if (pollControlRequests()) {
+            return true;
+        }
+
+        ActionBus<QueuedAction>::Message message;
+        if (!action_bus.pop(message)) {
+            return false;
+        }
+
+        action = message.value.action;
+        printf("Consumed action of type %d from source %d (#%u)\n", action.type, message.source, message.sequence);
+        edit_time = message.value.received_time;
+
+        SwitchingSoundStream::Clock::time_point now = SwitchingSoundStream::Clock::now();
+        if (n_actions++ == 0) first_action_time = now;
+        last_action_time = now;
+
+        if (action.type == Action::Type::LIVE_TRIGGER) {
+            // Only this thread writes the sequence, so reading a track's instrument needs no pattern lock
+            track_id_t track_id = action.data.trigger_track_id;
+            if (track_id >= Engine::Sequence::n_tracks) return true;
+
+            const Engine::Track &track = pattern_bank.active().sequence_data.tracks[track_id];
+            const AudioStreamBuffer &samples = oneShotSamples(track.instrument_id);
+
+            if (!samples.empty()) {
+                sound_stream.triggerOneShot(&samples, track.volume * action.data.trigger_velocity / 127.0f, edit_time);
+            }
+            return true;
+        }
+
+        if (action.type == Action::Type::SELECT_PATTERN) {
+            // The new pattern's mix is already rendered; it starts playing at the next bar
+            StreamMix mix;
+            Engine::Stats stats;
+            if (!pattern_bank.select(action.data.new_pattern_id, mix, stats)) return true;
+            sound_stream.queueAtBarBoundary(mix, stats, edit_time);
+
+            // Choosing a pattern by hand leaves song mode
+            song_player.stop();
+            publish_when_rendered = false;
+
+            return true;
+        }
+
+        PatternBank<DefaultEngineConfig>::Pattern &pattern = pattern_bank.active();
+        std::lock_guard<std::mutex> pattern_lock(pattern.mtx);
+
+        // Edits build on the stems, so any render still waiting on a resampled variant is finished first
+        if (pattern.stale) {
+            pattern.render();
+        }
+
+        Engine::Sequence &sequence_data = pattern.sequence_data;
+        Engine &engine = pattern.engine;
+
+        switch (action.type) {
+            case Action::Type::TRACK_BEAT_TOGGLE: {
+                track_id_t track_id = action.data.toggle_beat_track_id;
+                unsigned char beat_idx = action.data.toggled_beat_id;
+                if (track_id >= Engine::Sequence::n_tracks || beat_idx >= Engine::Track::max_steps) break;
+
+                Engine::Track &track = sequence_data.tracks[track_id];
+                track.toggleTrigger(beat_idx);
+
+                // Mix in or remove the sample at this step
+                engine.applyStepToggle(track, track_id, beat_idx);
+                publishMix(pattern);
+
+                break;
+            }
+
+            case Action::Type::STEP_VELOCITY_SELECT: {
+                track_id_t track_id = action.data.velocity_track_id;
+                unsigned char step_idx = action.data.velocity_step_id;
+                uint8_t velocity = action.data.new_velocity;
+                if (track_id >= Engine::Sequence::n_tracks) break;
+
+                if (step_idx >= Engine::Track::max_steps || velocity >= VELOCITY_LEVELS) {
+                    std::cerr << "Error: invalid velocity " << static_cast<int>(velocity) << " for step "
+                              << static_cast<int>(step_idx) << "\n";
+                    break;
+                }
+
+                Engine::Track &track = sequence_data.tracks[track_id];
+                uint8_t old_velocity = track.velocity(step_idx);
+                track.setVelocity(step_idx, velocity);
+
+                engine.applyStepVelocity(track, track_id, step_idx, old_velocity);
+                publishMix(pattern);
+
+                break;
+            }
+
+            case Action::Type::TRACK_MUTE_TOGGLE: {
+                track_id_t track_id = action.data.mute_unmute_track_id;
+                if (track_id >= Engine::Sequence::n_tracks) break;
+
+                Engine::Track &track = sequence_data.tracks[track_id];
+                track.muted = !track.muted;
+
+                publishMix(pattern);
+
+                break;
+            }
+
+            case Action::Type::PAUSE_TOGGLE: {
+                paused = !paused;
+
+                if (midi_clock && paused) {
+                    midi_clock->pause();
+                } else if (midi_clock) {
+                    midi_clock->resume();
+                }
+
+                if (mixed_output) {
+                    sound_stream.setHeld(paused);
+                } else if (paused) {
+                    sound_stream.pause();
+                } else {
+                    sound_stream.play();
+                }
+
+                break;
+            }
+
+            case Action::Type::INSTRUMENT_SAMPLE: {
+                sampleInstrument(action.data.sample_instrument_id);
+
+                break;
+            }
+
+            case Action::Type::BPM_SELECT: {
+                sequence_data.bpm = action.data.new_bpm;
+
+                // Re-render every track on the new grid; the other patterns follow in the background
+                renderWholePattern(pattern);
+                pattern_bank.setTempo(sequence_data);
+
+                break;
+            }
+
+            case Action::Type::GROOVE_SELECT: {
+                uint8_t bpm_fraction = action.data.new_bpm_fraction;
+                uint8_t swing = action.data.new_swing;
+
+                if (!Engine::Sequence::isValidGroove(bpm_fraction, swing)) {
+                    std::cerr << "Error: invalid groove (bpm fraction " << static_cast<int>(bpm_fraction)
+                              << ", swing " << static_cast<int>(swing) << ")\n";
+                    break;
+                }
+
+                sequence_data.bpm_fraction = bpm_fraction;
+                sequence_data.swing = swing;
+
+                // Same as a tempo change: every step moves
+                renderWholePattern(pattern);
+                pattern_bank.setTempo(sequence_data);
+
+                break;
+            }
+
+            case Action::Type::CHANGE_TRACK_INSTRUMENT_ID: {
+                track_id_t track_id = action.data.change_instrument_track_id;
+                if (track_id >= Engine::Sequence::n_tracks) break;
+
+                sequence_data.tracks[track_id].instrument_id = action.data.new_instrument_id;
+
+                if (engine.samplesReady(sequence_data.tracks[track_id])) {
+                    engine.renderTrack(sequence_data, track_id);
+                    publishMix(pattern);
+                } else {
+                    renderInBackground(pattern);
+                }
+
+                break;
+            }
+
+            case Action::Type::TRACK_LENGTH_SELECT: {
+                track_id_t track_id = action.data.length_track_id;
+                if (track_id >= Engine::Sequence::n_tracks) break;
+
+                uint8_t n_steps = action.data.new_n_steps;
+                uint8_t step_division = action.data.new_step_division;
+
+                if (!Engine::Track::isValidLength(n_steps, step_division)) {
+                    std::cerr << "Error: invalid track length " << static_cast<int>(n_steps) << " x 1/"
+                              << static_cast<int>(step_division) << "\n";
+                    break;
+                }
+
+                sequence_data.tracks[track_id].n_steps = n_steps;
+                sequence_data.tracks[track_id].step_division = step_division;
+
+                // Only this track's stem changes; it is rendered one cycle long
+                engine.renderTrack(sequence_data, track_id);
+                publishMix(pattern);
+
+                break;
+            }
+
+            case Action::Type::TRACK_PITCH_SELECT: {
+                track_id_t track_id = action.data.pitch_track_id;
+                if (track_id >= Engine::Sequence::n_tracks) break;
+
+                int16_t pitch_cents = action.data.new_pitch_cents;
+
+                if (!Engine::Track::isValidPitch(pitch_cents)) {
+                    std::cerr << "Error: invalid track pitch " << pitch_cents << " cents\n";
+                    break;
+                }
+
+                sequence_data.tracks[track_id].pitch_cents = pitch_cents;
+
+                if (engine.samplesReady(sequence_data.tracks[track_id])) {
+                    engine.renderTrack(sequence_data, track_id);
+                    publishMix(pattern);
+                } else {
+                    renderInBackground(pattern);
+                }
+
+                break;
+            }
+
+            case Action::Type::TRACK_EFFECT_SELECT: {
+                track_id_t track_id = action.data.effect_track_id;
+                if (track_id >= Engine::Sequence::n_tracks) break;
+
+                uint8_t param = action.data.effect_param;
+                uint8_t value = action.data.new_effect_value;
+
+                if (!Engine::Track::isValidEffectParam(param, value)) {
+                    std::cerr << "Error: invalid value " << static_cast<int>(value) << " for effect parameter "
+                              << static_cast<int>(param) << "\n";
+                    break;
+                }
+
+                sequence_data.tracks[track_id].setEffectParam(param, value);
+
+                // Render-time effects re-process the stem; live ones only hand new settings to the stream
+                engine.applyEffects(sequence_data.tracks[track_id], track_id);
+                publishMix(pattern);
+
+                break;
+            }
+
+            case Action::Type::CLEAR_ALL: {
+                // Clear all triggers
+                sequence_data.reset();
+                engine.clear(sequence_data);
+                publishMix(pattern);
+                pattern_bank.setTempo(sequence_data);
+
+                break;
+            }
+
+            case Action::Type::SEQUENCE_SNAPSHOT: {
+                // Replace the whole sequence and re-render every track
+                sequence_data.deserialize(action.data.snapshot);
+                renderWholePattern(pattern);
+                pattern_bank.setTempo(sequence_data);
+
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        return true;
+    }
+
+    // Starts this session's own stream; a session mixed onto a shared bus is played by the bus
+    void startOutput() {
+        if (!mixed_output) sound_stream.play();
+    }
+
+    // Hands the session's stream to `bus` instead of playing it directly; call before startOutput()
+    void configureMixedOutput(MixedBusStream &bus) {
+        bus.addSource(&sound_stream);
+        mixed_output = true;
+    }
+
+    void configureRealtime(const RealtimeConfig &config) {
+        realtime_config = config;
+        if (!config.enabled) return;
+
+        // Mixes are zero-filled by the consumer before they are published, so with MCL_FUTURE every
+        // buffer the audio thread reads is already resident
+        lockProcessMemory(config);
+        sound_stream.setAudioThreadInit([config]() {
+            applyRealtimePolicy(ThreadRole::AUDIO, config);
+        });
+    }
+
+    // Must be called before spin(); the song starts on the consumer thread
+    void configureSong(const std::vector<SongEntry> &chain, bool loop) {
+        initial_song = chain;
+        loop_initial_song = loop;
+    }
+
+    // Records everything the stream plays into a WAV file at `path`, from now until exit
+    bool configureRecording(const std::string &path) {
+        recorder.reset(new OutputRecorder(AUDIO_SAMPLE_RATE, AUDIO_CHANNELS));
+        if (!recorder->start(path)) {
+            recorder.reset();
+            return false;
+        }
+
+        sound_stream.setRecorder(recorder.get());
+        return true;
+    }
+
+    // Sends MIDI clock and transport derived from the stream through `send`, from a thread of its own
+    void configureMidiClock(MidiClockOutput::Sender send) {
+        midi_clock.reset(new MidiClockOutput(AUDIO_SAMPLE_RATE));
+
+        RealtimeConfig config = realtime_config;
+        midi_clock->start(std::move(send), [config]() {
+            // Clock messages are due at exact times, so the sender runs with the serial reader's priority
+            applyRealtimePolicy(ThreadRole::SERIAL, config);
+        });
+        sound_stream.setMidiClock(midi_clock.get());
+    }
+
+    void configureChunking(size_t chunk_frames, bool adaptive) {
+        sound_stream.setChunkFrames(chunk_frames);
+        sound_stream.setAdaptiveChunking(adaptive);
+    }
+
+    void printLatencyReport() {
+        StreamLatencyStatistics stats = sound_stream.getLatencyStatistics();
+        printf(
+            "Edit-to-output latency (estimated): last %.2f ms, avg %.2f ms, max %.2f ms over %zu edits (chunk=%zu frames, %zu underruns inferred)\n",
+            stats.last_latency_ms, stats.averageLatencyMs(), stats.max_latency_ms,
+            stats.n_swaps, stats.chunk_frames, stats.n_underruns
+        );
+        printf(
+            "Edit-to-output percentiles (estimated): p50 %.0f ms, p95 %.0f ms, p99 %.0f ms\n",
+            stats.percentileMs(50.0), stats.percentileMs(95.0), stats.percentileMs(99.0)
+        );
+
+        double action_seconds = std::chrono::duration<double>(last_action_time - first_action_time).count();
+        printf(
+            "Actions: %zu applied, %.1f/s sustained from the first to the last\n",
+            n_actions, action_seconds > 0.0 ? (n_actions - 1) / action_seconds : 0.0
+        );
+
+        std::vector<ActionBus<QueuedAction>::SourceStatistics> sources = action_bus.statistics();
+        for (size_t i = 0; i < sources.size(); ++i) {
+            printf(
+                "  source %zu (%s): %llu actions, %llu pushes waited on a full queue\n", i, sources[i].name.c_str(),
+                static_cast<unsigned long long>(sources[i].n_popped), static_cast<unsigned long long>(sources[i].n_full)
+            );
+        }
+
+        StreamLatencyStatistics triggers = sound_stream.getTriggerLatencyStatistics();
+        if (triggers.n_swaps > 0) {
+            printf(
+                "Live trigger latency (event to output, estimated): avg %.2f ms, p50 %.0f ms, p95 %.0f ms, p99 %.0f ms, max %.2f ms over %zu hits\n",
+                triggers.averageLatencyMs(), triggers.percentileMs(50.0), triggers.percentileMs(95.0),
+                triggers.percentileMs(99.0), triggers.max_latency_ms, triggers.n_swaps
+            );
+        }
+
+        LimiterStatistics limiter = sound_stream.getLimiterStatistics();
+        printf(
+            "Master limiter: last %.1f dB, max %.1f dB gain reduction (%.3f%% of a core on polymetric chunks)\n",
+            limiter.last_gain_reduction_db, limiter.max_gain_reduction_db, 100.0 * limiter.cpuShare(AUDIO_SAMPLE_RATE)
+        );
+    }
+
+    // Registers an input of this session (a controller, MIDI, the control socket); -1 if there are too many
+    int addActionSource(const std::string &name) {
+        int source = action_bus.addSource(name);
+        if (source < 0) {
+            std::cerr << "Error: no room for action source " << name << " (at most " << ACTION_BUS_MAX_SOURCES << ")\n";
+        }
+        return source;
+    }
+
+    // Hands an action from `source` to the consumer thread; false if that source's queue is full. Only one
+    // thread may push for a given source, but sources never wait on each other.
+    bool pushAction(int source, const Action &action, SwitchingSoundStream::Clock::time_point received_time = SwitchingSoundStream::Clock::now()) {
+        return action_bus.push(source, QueuedAction{action, received_time});
+    }
+
+    // Queues a control socket request; the reply is set once the consumer has handled it
+    std::future<std::string> submitControlRequest(ControlRequest::Type type, std::vector<Action> actions = {}) {
+        std::unique_ptr<ControlRequest> request(new ControlRequest());
+        request->type = type;
+        request->actions = std::move(actions);
+        request->received_time = SwitchingSoundStream::Clock::now();
+        std::future<std::string> reply = request->reply.get_future();
+
+        std::lock_guard<std::mutex> lock(control_mtx);
+        control_requests.push_back(std::move(request));
+        return reply;
+    }
+
+    // Playhead events for control socket subscribers; safe from any thread
+    size_t barsStarted() const {
+        return sound_stream.barsStarted();
+    }
+
+    StreamLatencyStatistics latencyStatistics() {
+        return sound_stream.getLatencyStatistics();
+    }
+
+private:
+    // Actions from every input of the session, drained fairly by the consumer thread
+    ActionBus<QueuedAction> action_bus;
+
+    std::deque<std::unique_ptr<ControlRequest>> control_requests;
+    std::mutex control_mtx;
+
+    std::thread consumer_thread;
+    bool paused = false;
+    bool mixed_output = false;
+    RealtimeConfig realtime_config;
+
+    // Mapping from instrument ID to sample data, possibly shared with other sessions
+    SampleBank<Engine::sample_t> &sample_bank;
+
+    // Drum sequences with their stems (looked up in the shared render cache); edits apply to the active pattern
+    PatternBank<DefaultEngineConfig> pattern_bank;
+
+    // Optional copy of the output on disk; declared before the stream so it outlives it
+    std::unique_ptr<OutputRecorder> recorder;
+
+    // Optional MIDI clock for other gear, fed by the stream; also declared before it
+    std::unique_ptr<MidiClockOutput> midi_clock;
+
+    // Instance of the sound stream which loops the current mix
+    SwitchingSoundStream sound_stream = SwitchingSoundStream(AUDIO_SAMPLE_RATE, AUDIO_CHANNELS);
+
+    // Chains patterns into a song; idle unless a song was started
+    SongPlayer<DefaultEngineConfig> song_player = SongPlayer<DefaultEngineConfig>(pattern_bank, sound_stream);
+    std::vector<SongEntry> initial_song;
+    bool loop_initial_song = false;
+
+    // Time at which the action currently being applied arrived from its controller
+    SwitchingSoundStream::Clock::time_point edit_time;
+
+    // Instrument samples converted for live triggers; entries are never erased, so the stream's voices can
+    // point into them
+    std::unordered_map<instrument_id_t, AudioStreamBuffer> one_shot_samples;
+
+    // Sustained action rate, for load tests
+    size_t n_actions = 0;
+    SwitchingSoundStream::Clock::time_point first_action_time;
+    SwitchingSoundStream::Clock::time_point last_action_time;
+
+    // Set while the active pattern is re-rendered in the background (waiting on a resampled variant)
+    bool publish_when_rendered = false;
+
+    // Stream events already logged
+    size_t swaps_reported = 0;
+    size_t backoffs_reported = 0;
+
+    // Logs the stream's swaps and chunk back-offs here rather than on the audio thread. Only the latest of
+    // several swaps between two polls is logged; all of them are in the latency statistics.
+    void reportStreamEvents() {
+        size_t swaps = sound_stream.swapsDone();
+        if (swaps != swaps_reported) {
+            swaps_reported = swaps;
+            printf("Swapped in new mix (estimated edit-to-output latency %.2f ms)\n", sound_stream.lastSwapLatencyMs());
+        }
+
+        size_t backoffs = sound_stream.chunkBackoffs();
+        if (backoffs != backoffs_reported) {
+            backoffs_reported = backoffs;
+            printf("Underrun detected, backing off to %zu frames per chunk\n", sound_stream.backoffChunkFrames());
+        }
+    }
+
+    void consumerThread() {
+        applyRealtimePolicy(ThreadRole::CONSUMER, realtime_config);
+        begin();
+
+        while (running) {
+            if (!poll() && realtime_config.enabled) {
+                std::this_thread::sleep_for(std::chrono::microseconds(RT_IDLE_BACKOFF_US));
+            }
+        }
+    }
+
+    // Answers one control socket request, if any is waiting
+    bool pollControlRequests() {
+        std::unique_ptr<ControlRequest> request;
+        {
+            std::lock_guard<std::mutex> lock(control_mtx);
+            if (control_requests.empty()) return false;
+
+            request = std::move(control_requests.front());
+            control_requests.pop_front();
+        }
+
+        switch (request->type) {
+            case ControlRequest::BATCH: request->reply.set_value(applyBatch(request->actions, request->received_time)); break;
+            case ControlRequest::STATE: request->reply.set_value(stateReport()); break;
+            case ControlRequest::STATS: request->reply.set_value(statsReport()); break;
+            case ControlRequest::SNAPSHOT: request->reply.set_value(snapshotBytes()); break;
+        }
+        return true;
+    }
+
+    // What a batch changed, so it can be rendered once at the end
+    struct BatchChanges {
+        bool retimed = false;  // Tempo, groove or the whole sequence: every track is re-rendered
+        bool tracks[Engine::Sequence::n_tracks] = {};
+        bool mix = false;      // Only the mix (mutes)
+    };
+
+    // Applies sequence edits (already validated by the protocol parser) to the active pattern, then renders
+    // only what they touched and publishes one mix
+    std::string applyBatch(const std::vector<Action> &actions, SwitchingSoundStream::Clock::time_point received_time) {
+        SwitchingSoundStream::Clock::time_point start = SwitchingSoundStream::Clock::now();
+        edit_time = received_time;
+
+        if (n_actions == 0) first_action_time = start;
+        n_actions += actions.size();
+
+        PatternBank<DefaultEngineConfig>::Pattern &pattern = pattern_bank.active();
+        std::lock_guard<std::mutex> pattern_lock(pattern.mtx);
+
+        if (pattern.stale) {
+            pattern.render();
+        }
+
+        Engine::Sequence &sequence_data = pattern.sequence_data;
+        Engine &engine = pattern.engine;
+        BatchChanges changes;
+
+        for (const Action &action : actions) {
+            editSequence(sequence_data, action, changes);
+        }
+
+        bool waiting = false;
+        if (changes.retimed) {
+            if (engine.samplesReady(sequence_data)) {
+                engine.setTempo(sequence_data);
+            } else {
+                waiting = true;
+            }
+            pattern_bank.setTempo(sequence_data);
+        } else {
+            for (int j = 0; j < Engine::Sequence::n_tracks; ++j) {
+                if (!changes.tracks[j]) continue;
+
+                if (engine.samplesReady(sequence_data.tracks[j])) {
+                    engine.renderTrack(sequence_data, static_cast<track_id_t>(j));
+                } else {
+                    waiting = true;
+                }
+            }
+        }
+
+        if (waiting) {
+            renderInBackground(pattern);
+        } else {
+            publishMix(pattern);
+        }
+
+        last_action_time = SwitchingSoundStream::Clock::now();
+        double render_ms = std::chrono::duration<double, std::milli>(last_action_time - start).count();
+
+        char reply[128];
+        snprintf(reply, sizeof(reply), "ok %zu actions, rendered in %.2f ms%s", actions.size(), render_ms,
+                 waiting ? " (publishing after a resample)" : "");
+        return reply;
+    }
+
+    void editSequence(Engine::Sequence &sequence_data, const Action &action, BatchChanges &changes) {
+        switch (action.type) {
+            case Action::Type::TRACK_BEAT_TOGGLE: {
+                sequence_data.tracks[action.data.toggle_beat_track_id].toggleTrigger(action.data.toggled_beat_id);
+                changes.tracks[action.data.toggle_beat_track_id] = true;
+                break;
+            }
+
+            case Action::Type::STEP_VELOCITY_SELECT: {
+                sequence_data.tracks[action.data.velocity_track_id].setVelocity(action.data.velocity_step_id, action.data.new_velocity);
+                changes.tracks[action.data.velocity_track_id] = true;
+                break;
+            }
+
+            case Action::Type::TRACK_MUTE_TOGGLE: {
+                Engine::Track &track = sequence_data.tracks[action.data.mute_unmute_track_id];
+                track.muted = !track.muted;
+                changes.mix = true;
+                break;
+            }
+
+            case Action::Type::CHANGE_TRACK_INSTRUMENT_ID: {
+                sequence_data.tracks[action.data.change_instrument_track_id].instrument_id = action.data.new_instrument_id;
+                changes.tracks[action.data.change_instrument_track_id] = true;
+                break;
+            }
+
+            case Action::Type::TRACK_LENGTH_SELECT: {
+                Engine::Track &track = sequence_data.tracks[action.data.length_track_id];
+                track.n_steps = action.data.new_n_steps;
+                track.step_division = action.data.new_step_division;
+                changes.tracks[action.data.length_track_id] = true;
+                break;
+            }
+
+            case Action::Type::TRACK_PITCH_SELECT: {
+                sequence_data.tracks[action.data.pitch_track_id].pitch_cents = action.data.new_pitch_cents;
+                changes.tracks[action.data.pitch_track_id] = true;
+                break;
+            }
+
+            case Action::Type::TRACK_EFFECT_SELECT: {
+                sequence_data.tracks[action.data.effect_track_id].setEffectParam(action.data.effect_param, action.data.new_effect_value);
+                changes.tracks[action.data.effect_track_id] = true;
+                break;
+            }
+
+            case Action::Type::BPM_SELECT: {
+                sequence_data.bpm = action.data.new_bpm;
+                changes.retimed = true;
+                break;
+            }
+
+            case Action::Type::GROOVE_SELECT: {
+                sequence_data.bpm_fraction = action.data.new_bpm_fraction;
+                sequence_data.swing = action.data.new_swing;
+                changes.retimed = true;
+                break;
+            }
+
+            case Action::Type::CLEAR_ALL: {
+                sequence_data.reset();
+                changes.retimed = true;
+                break;
+            }
+
+            case Action::Type::SEQUENCE_SNAPSHOT: {
+                sequence_data.deserialize(action.data.snapshot);
+                changes.retimed = true;
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+
+    std::string stateReport() {
+        PatternBank<DefaultEngineConfig>::Pattern &pattern = pattern_bank.active();
+        std::lock_guard<std::mutex> pattern_lock(pattern.mtx);
+        const Engine::Sequence &sequence_data = pattern.sequence_data;
+
+        char line[128];
+        std::string report;
+
+        snprintf(line, sizeof(line), "pattern %d\n", pattern_bank.activeId());
+        report += line;
+        snprintf(line, sizeof(line), "bpm %d.%02d swing %d%s\n", sequence_data.bpm, sequence_data.bpm_fraction,
+                 sequence_data.swing, paused ? " paused" : "");
+        report += line;
+        report += "snapshot " + EngineControlProtocol::toHex(sequence_data) + "\n";
+
+        return report + "ok";
+    }
+
+    std::string snapshotBytes() {
+        PatternBank<DefaultEngineConfig>::Pattern &pattern = pattern_bank.active();
+        std::lock_guard<std::mutex> pattern_lock(pattern.mtx);
+
+        unsigned char snapshot[Engine::Sequence::serialized_size];
+        pattern.sequence_data.serialize(snapshot);
+        return std::string(reinterpret_cast<const char *>(snapshot), sizeof(snapshot));
+    }
+
+    std::string statsReport() {
+        StreamLatencyStatistics edits = sound_stream.getLatencyStatistics();
+        StreamLatencyStatistics triggers = sound_stream.getTriggerLatencyStatistics();
+
+        char line[256];
+        std::string report;
+
+        snprintf(line, sizeof(line), "edit-latency p50 %.0f p95 %.0f p99 %.0f max %.2f ms over %zu swaps (estimated)\n",
+                 edits.percentileMs(50.0), edits.percentileMs(95.0), edits.percentileMs(99.0), edits.max_latency_ms, edits.n_swaps);
+        report += line;
+        snprintf(line, sizeof(line), "trigger-latency p50 %.0f p95 %.0f p99 %.0f max %.2f ms over %zu hits (estimated)\n",
+                 triggers.percentileMs(50.0), triggers.percentileMs(95.0), triggers.percentileMs(99.0), triggers.max_latency_ms,
+                 triggers.n_swaps);
+        report += line;
+        snprintf(line, sizeof(line), "actions %zu\n", n_actions);
+        report += line;
+        snprintf(line, sizeof(line), "underruns %zu (inferred) chunk %zu frames\n", edits.n_underruns, edits.chunk_frames);
+        report += line;
+        snprintf(line, sizeof(line), "bars %zu\n", sound_stream.barsStarted());
+        report += line;
+
+        return report + "ok";
+    }
+
+    // Update the sound stream with the active pattern's new mix
+    void publishMix(PatternBank<DefaultEngineConfig>::Pattern &pattern) {
+        pattern.mix = pattern.engine.renderMix(pattern.sequence_data);
+        sound_stream.populateIntermetideBuffer(pattern.mix, pattern.engine.stats(), edit_time);
+    }
+
+    // For edits that need a pitched variant not resampled yet: the old mix keeps playing while the resampler
+    // and the background thread catch up, and the pattern is published once it is rendered
+    void renderInBackground(PatternBank<DefaultEngineConfig>::Pattern &pattern) {
+        pattern.stale = true;
+        pattern_bank.requestRender();
+        publish_when_rendered = true;
+    }
+
+    // Re-renders every track of the pattern (after a tempo, groove or whole-sequence change) and publishes it,
+    // unless that would wait on the resampler
+    void renderWholePattern(PatternBank<DefaultEngineConfig>::Pattern &pattern) {
+        if (!pattern.engine.samplesReady(pattern.sequence_data)) {
+            renderInBackground(pattern);
+            return;
+        }
+
+        pattern.engine.setTempo(pattern.sequence_data);
+        publishMix(pattern);
+    }
+
+    // Publishes the active pattern once the background thread has rendered it
+    void publishRenderedPattern() {
+        PatternBank<DefaultEngineConfig>::Pattern &pattern = pattern_bank.active();
+        std::unique_lock<std::mutex> pattern_lock(pattern.mtx, std::try_to_lock);
+
+        if (!pattern_lock.owns_lock() || pattern.stale) return;
+
+        sound_stream.populateIntermetideBuffer(pattern.mix, pattern.engine.stats(), edit_time);
+        publish_when_rendered = false;
+    }
+
+    const AudioStreamBuffer &oneShotSamples(instrument_id_t instrument_id) {
+        auto found = one_shot_samples.find(instrument_id);
+        if (found != one_shot_samples.end()) return found->second;
+
+        return one_shot_samples.emplace(instrument_id, toStreamBuffer(sample_bank.get(instrument_id))).first->second;
+    }
+
+    void sampleInstrument(instrument_id_t instrument_id) {
+        const Engine::Buffer &sample = sample_bank.get(instrument_id);
+
+        if (sample.empty()) {
+            std::cerr << "Error: samples failed to load.\n";
+            return;
+        }
+
+        sampleInstrument(toStreamBuffer(sample));
+    }
+
+    void sampleInstrument(const AudioStreamBuffer &buffer) {
+        sf::SoundBuffer sound_buffer;
+        if (!sound_buffer.loadFromSamples(buffer.data(), buffer.size(), AUDIO_CHANNELS, AUDIO_SAMPLE_RATE)) {
+            std::cerr << "Failed to load audio buffer from samples!" << std::endl;
+            return;
+        }
+
+        sf::Sound sample_sound;
+        sample_sound.setBuffer(sound_buffer);
+
+        // Play the sound
+        sample_sound.play();
+
+        // Keep the program running while the sound plays
+        while (sample_sound.getStatus() == sf::Sound::Playing) {
+            sf::sleep(sf::milliseconds(50));
+        }
+
+        return;
+    }
+};
+
+// One serial controller. A controller that goes away (unplugged, a USB glitch) is looked for again with backoff
+// while the audio keeps playing, by its USB serial number if it comes back under another name. Opening the port
+// resets the board, so a board that reconnects is sent the host's sequence as one snapshot, and its messages are
+// dropped until it sends that snapshot back.
+class DrumSequenceDataProvider {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Takes whichever controller turns up first; see openAny()
+    DrumSequenceDataProvider() : any_port(true) {}
+
+    // The controller at `port`, waited for if it does not open now
+    explicit DrumSequenceDataProvider(const std::string &port) : port(port) {
+        if (!connect(port, true)) {
+            std::cerr << "Waiting for a controller on " << port << std::endl;
+        }
+    };
+
+    ~DrumSequenceDataProvider() {
+        if (serial_read_thread.joinable()) {
+            serial_read_thread.join();
+        }
+
+        closePort();
+
+        if (n_losses > 0) {
+            printf("Controller on %s: lost %zu times, reconnected %zu times\n", port.c_str(), n_losses, n_reconnects);
+        }
+    }
+
+    void spin() {
+        serial_read_thread = std::thread(&DrumSequenceDataProvider::serialReadThread, this);
+    }
+
+    static std::vector<std::string> discoverPorts() {
+        std::vector<std::string> ports;
+        for (const SerialDevice &device : discoverSerialDevices()) ports.push_back(device.path);
+        return ports;
+    }
+
+    // Opens every port in `ports` at once, since each open waits out its board's reset; ports that do not open
+    // are waited for
+    static std::vector<std::unique_ptr<DrumSequenceDataProvider>> openAll(const std::vector<std::string> &ports) {
+        std::vector<std::future<std::unique_ptr<DrumSequenceDataProvider>>> opening;
+        for (const std::string &port : ports) {
+            opening.push_back(std::async(std::launch::async, [port]() {
+                return std::unique_ptr<DrumSequenceDataProvider>(new DrumSequenceDataProvider(port));
+            }));
+        }
+
+        std::vector<std::unique_ptr<DrumSequenceDataProvider>> providers;
+        for (std::future<std::unique_ptr<DrumSequenceDataProvider>> &provider : opening) {
+            providers.push_back(provider.get());
+        }
+        return providers;
+    }
+
+    // The first controller found: every discovered device is tried at once and the first in discovery order
+    // (boards before other USB serial devices) that opens is kept. Without one, waits for any to be plugged in.
+    static std::unique_ptr<DrumSequenceDataProvider> openAny() {
+        std::vector<std::future<std::unique_ptr<DrumSequenceDataProvider>>> opening;
+        for (const std::string &port : discoverPorts()) {
+            opening.push_back(std::async(std::launch::async, [port]() {
+                std::unique_ptr<DrumSequenceDataProvider> provider(new DrumSequenceDataProvider());
+                if (!provider->connect(port, true)) provider.reset();
+                return provider;
+            }));
+        }
+
+        std::unique_ptr<DrumSequenceDataProvider> first;
+        for (std::future<std::unique_ptr<DrumSequenceDataProvider>> &provider : opening) {
+            std::unique_ptr<DrumSequenceDataProvider> connected = provider.get();
+            if (!first) first = std::move(connected);
+        }
+
+        if (!first) {
+            std::cerr << "No controller found; waiting for one to be plugged in" << std::endl;
+            first.reset(new DrumSequenceDataProvider());
+        }
+        return first;
+    }
+
+    // Opens `port`. At startup this waits for the board to reset and the host takes the board's state; later
+    // the board is resynced from the host instead. False if the port does not open.
+    bool connect(const std::string &port, bool startup) {
+        try {
+            serial.Open(port);
+            serial.SetBaudRate(BaudRate::BAUD_9600);
+            serial.SetCharacterSize(CharacterSize::CHAR_SIZE_8);
+            serial.SetStopBits(StopBits::STOP_BITS_1);
+            serial.SetParity(Parity::PARITY_NONE);
+
+            // Clear any old data in the buffer
+            serial.FlushIOBuffers();
+        } catch (const OpenFailed &) {
+            if (startup) std::cerr << "Failed to open port " << port << std::endl;
+            return false;
+        } catch (...) {
+            if (startup) std::cerr << "An error occurred with port " << port << std::endl;
+            closePort();
+            return false;
+        }
+
+        this->port = port;
+        device_id = usbIdOf(port);
+        last_presence_check = Clock::now();
+        reconnect_backoff = std::chrono::milliseconds(SERIAL_RECONNECT_MIN_MS);
+
+        if (startup) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(SERIAL_SETTLE_MS));
+            std::cout << "Connected to serial port " << port << std::endl;
+        } else {
+            n_reconnects++;
+            std::cout << "Reconnected to serial port " << port << ", resyncing the controller" << std::endl;
+            beginResync();
+        }
+        return true;
+    }
+
+    // Reads and forwards one message if one has arrived; false when the port had nothing. A missing controller
+    // is looked for here, at most once per backoff period, so this never blocks on a port that is not there.
+    bool poll() {
+        if (!serial.IsOpen()) {
+            if (Clock::now() >= next_attempt) reconnect();
+            return false;
+        }
+
+        try {
+            if (resyncing) sendResyncSnapshot();
+            if (readAndDecodeMessage()) return true;
+            checkPresence();
+        } catch (const ReadTimeout &) {
+            // A frame cut short; the stream picks up again at the next start byte
+            return true;
+        } catch (const std::exception &e) {
+            lose(e.what());
+        }
+        return false;
+    }
+
+    void attachDataConsumer(DrumSequenceDataConsumer *consumer) {
+        action_source = consumer->addActionSource("serial " + (port.empty() ? std::string("(any controller)") : port));
+        data_consumer = action_source >= 0 ? consumer : nullptr;
+    }
+
+    void configureRealtime(const RealtimeConfig &config) {
+        realtime_config = config;
+    }
+
+    // Writes every frame received, with its arrival time, to `path` (replayed by serial_replay)
+    bool configureCapture(const std::string &path) {
+        capture.reset(new SerialCaptureWriter());
+        if (!capture->open(path)) {
+            std::cerr << "Error: cannot write serial capture " << path << "\n";
+            capture.reset();
+            return false;
+        }
+        return true;
+    }
+
+private:
+    SerialPort serial;
+    std::string port;
+    std::thread serial_read_thread;
+    DrumSequenceDataConsumer *data_consumer = nullptr;
+    int action_source = -1;
+    RealtimeConfig realtime_config;
+    std::unique_ptr<SerialCaptureWriter> capture;
+
+    // Finding the controller again
+    bool any_port = false;
+    std::string device_id;  // USB VENDOR:PRODUCT:SERIAL, if known
+    Clock::time_point next_attempt;
+    std::chrono::milliseconds reconnect_backoff{SERIAL_RECONNECT_MIN_MS};
+    Clock::time_point last_presence_check;
+    size_t n_losses = 0;
+    size_t n_reconnects = 0;
+
+    // Resyncing a reconnected board
+    bool resyncing = false;
+    std::future<std::string> pending_snapshot;
+    std::string resync_snapshot;
+    Clock::time_point resync_start;
+    Clock::time_point resync_sent_time;
+    size_t n_dropped_resyncing = 0;
+
+    void serialReadThread() {
+        applyRealtimePolicy(ThreadRole::SERIAL, realtime_config);
+
+        while (running) {
+            if (poll()) continue;
+
+            if (!serial.IsOpen()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(SERIAL_DISCONNECTED_POLL_MS));
+            } else if (realtime_config.enabled) {
+                std::this_thread::sleep_for(std::chrono::microseconds(RT_IDLE_BACKOFF_US));
+            }
+        }
+    }
+
+    static std::string usbIdOf(const std::string &port) {
+        char resolved[PATH_MAX];
+        std::string path = realpath(port.c_str(), resolved) ? resolved : port;
+
+        for (const SerialDevice &device : discoverSerialDevices()) {
+            if (device.path == path) return device.usb_id;
+        }
+        return "";
+    }
+
+    void closePort() {
+        try {
+            if (serial.IsOpen()) serial.Close();
+        } catch (...) {
+            // The device is already gone
+        }
+    }
+
+    void lose(const std::string &reason) {
+        closePort();
+        resyncing = false;
+        n_losses++;
+
+        std::cerr << "Lost the controller on " << port << " (" << reason << "); audio keeps playing, reconnecting" << std::endl;
+        reconnect_backoff = std::chrono::milliseconds(SERIAL_RECONNECT_MIN_MS);
+        next_attempt = Clock::now() + reconnect_backoff;
+    }
+
+    // An unplugged tty may just stop delivering data, so an idle port checks now and then that its device is there
+    void checkPresence() {
+        Clock::time_point now = Clock::now();
+        if (now - last_presence_check < std::chrono::milliseconds(SERIAL_PRESENCE_CHECK_MS)) return;
+
+        last_presence_check = now;
+        if (access(port.c_str(), F_OK) != 0) lose("device removed");
+    }
+
+    // The same board under whatever name it came back as, then the last port, then (for any_port) any device
+    void reconnect() {
+        std::vector<SerialDevice> devices = discoverSerialDevices();
+        std::vector<std::string> candidates;
+
+        for (const SerialDevice &device : devices) {
+            if (!device_id.empty() && device.usb_id == device_id) candidates.push_back(device.path);
+        }
+        if (!port.empty()) candidates.push_back(port);
+        if (any_port) {
+            for (const SerialDevice &device : devices) candidates.push_back(device.path);
+        }
+
+        for (const std::string &candidate : candidates) {
+            if (access(candidate.c_str(), F_OK) == 0 && connect(candidate, false)) return;
+        }
+
+        next_attempt = Clock::now() + reconnect_backoff;
+        reconnect_backoff = std::min(2 * reconnect_backoff, std::chrono::milliseconds(SERIAL_RECONNECT_MAX_MS));
+    }
+
+    void beginResync() {
+        // The firmware holds a default-shaped sequence; a `make large` build cannot describe it in one message
+        if (data_consumer == nullptr || Engine::Sequence::serialized_size > 255) {
+            if (data_consumer != nullptr) {
+                std::cerr << "This build's sequence does not fit the controller's; it keeps its own state" << std::endl;
+            }
+            return;
+        }
+
+        resyncing = true;
+        resync_start = Clock::now();
+        resync_sent_time = Clock::time_point();
+        n_dropped_resyncing = 0;
+    }
+
+    // Sends the session's sequence as it is now, again every SERIAL_RESYNC_RETRY_MS (the board may still be in its
+    // bootloader) until the board echoes it back
+    void sendResyncSnapshot() {
+        if (pending_snapshot.valid()) {
+            if (pending_snapshot.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+
+            try {
+                resync_snapshot = pending_snapshot.get();
+            } catch (const std::future_error &) {
+                return;  // Shutting down
+            }
+
+            DataBuffer frame = {MSG_START_BYTE, MSG_TYPE_SEQUENCE_SNAPSHOT, static_cast<uint8_t>(resync_snapshot.size())};
+            frame.insert(frame.end(), resync_snapshot.begin(), resync_snapshot.end());
+            serial.Write(frame);
+            resync_sent_time = Clock::now();
+            return;
+        }
+
+        if (Clock::now() - resync_sent_time >= std::chrono::milliseconds(SERIAL_RESYNC_RETRY_MS)) {
+            pending_snapshot = data_consumer->submitControlRequest(ControlRequest::SNAPSHOT);
+        }
+    }
+
+    bool readAndDecodeMessage() {
+        if (!serial.IsDataAvailable()) {
+            return false;
+        }
+
+        uint8_t start_byte;
+        serial.ReadByte(start_byte, SERIAL_READ_TIMEOUT_MS);
+
+        if (start_byte != MSG_START_BYTE) return true;  // Ignore if not a valid start byte
+
+        // Read message header
+        uint8_t msg_type;
+        uint8_t payload_size;
+        DataBuffer payload;
+
+        serial.ReadByte(msg_type, SERIAL_READ_TIMEOUT_MS);
+        serial.ReadByte(payload_size, SERIAL_READ_TIMEOUT_MS);
+
+        if (payload_size > 0) {
+            serial.Read(payload, payload_size, SERIAL_READ_TIMEOUT_MS);
+        }
+
+        SwitchingSoundStream::Clock::time_point received_time = SwitchingSoundStream::Clock::now();
+
+        if (capture) {
+            std::vector<uint8_t> frame = {start_byte, msg_type, payload_size};
+            frame.insert(frame.end(), payload.begin(), payload.end());
+            capture->write(frame.data(), frame.size());
+        }
+
+        const unsigned char *buffer = static_cast<const unsigned char *>(payload.data());
+
+        MessageType variant = static_cast<MessageType>(msg_type);
 
-class DrumSequenceDataConsumer {
-public:
-    DrumSequenceDataConsumer() {
-        // Initialize the audio stream
-        sound_stream.setLoop(true);
-        sound_stream.play();
-    };
+        // Until the board confirms the resync, what it sends describes its state from before it (a reset board's
+        // boot snapshot, edits to it) and is dropped
+        if (resyncing) {
+            bool confirmed = variant == MSG_TYPE_SEQUENCE_SNAPSHOT && !resync_snapshot.empty() &&
+                             payload.size() == resync_snapshot.size() && std::equal(payload.begin(), payload.end(), resync_snapshot.begin(),
+                                 [](uint8_t a, char b) { return a == static_cast<uint8_t>(b); });
+            if (!confirmed) {
+                n_dropped_resyncing++;
+                return true;
+            }
 
-    ~DrumSequenceDataConsumer() {
-        if (consumer_thread.joinable()) {
-            consumer_thread.join();
+            resyncing = false;
+            printf(
+                "Controller on %s resynced in %.0f ms (%zu of its messages dropped meanwhile)\n", port.c_str(),
+                std::chrono::duration<double, std::milli>(Clock::now() - resync_start).count(), n_dropped_resyncing
+            );
+            return true;
+        }
+
+        // A snapshot only decodes into a sequence of the same shape (e.g. not into a `make large` build)
+        if (variant == MSG_TYPE_SEQUENCE_SNAPSHOT && payload_size != SequenceData::serialized_size) {
+            std::cerr << "Error: snapshot of " << static_cast<int>(payload_size) << " bytes does not match this build ("
+                      << SequenceData::serialized_size << " bytes), ignoring\n";
+            return true;
         }
+        Action action = Action::fromSerialized(variant, buffer, payload.size());
+        if (action.type == Action::Type::NOOP) {
+            std::cerr << "Error: message of type " << static_cast<int>(msg_type) << " with " << payload.size()
+                      << " payload bytes cannot be decoded, ignoring\n";
+            return true;
+        }
+
+        printf("Received message of type %d (with payload size %d bytes)\n", msg_type, payload_size);
+
+        if (data_consumer != nullptr) {
+            while (running && !data_consumer->pushAction(action_source, action, received_time));
+        }
+
+        return true;
     }
+};
 
-    void spin() {
-        consumer_thread = std::thread(&DrumSequenceDataConsumer::consumerThread, this);
+#ifdef MIDI_USE_ALSA
+// Second action source next to the serial controller: MIDI from pads or a sequencer, received on a virtual ALSA
+// sequencer port and mapped to actions by MidiActionMap. Each action is stamped when its event is read, so the
+// latency report covers the whole path from the MIDI event to the output.
+class MidiInputProvider {
+public:
+    ~MidiInputProvider() {
+        if (midi_read_thread.joinable()) {
+            midi_read_thread.join();
+        }
+
+        printf("MIDI: %zu events received, %zu mapped to actions\n", n_events, n_actions);
     }
-    
-    boost::lockfree::spsc_queue<Action, boost::lockfree::capacity<10>> action_queue;
-private:
-    std::thread consumer_thread;
-    bool paused = false;
 
-    // Drum sequence data, built incrementally
-    SequenceData sequence_data;
+    // Creates the port and, if `source` is not empty, connects that client's port ("CLIENT:PORT") to it
+    bool open(const std::string &source) {
+        if (!port.open("in", AlsaMidiPort::INPUT)) return false;
+        return source.empty() || port.connect(source);
+    }
 
-    // Stores mapping from instrument ID to sample data
-    std::unordered_map<instrument_id_t, AudioStreamBuffer> instrument_samples;
+    void spin() {
+        midi_read_thread = std::thread(&MidiInputProvider::midiReadThread, this);
+    }
 
-    // Audio buffers for each track, each with a length of 4 bars
-    AudioStreamBuffer individual_tracks[N_TRACKS];
+    void attachDataConsumer(DrumSequenceDataConsumer *consumer) {
+        action_source = consumer->addActionSource("midi");
+        data_consumer = action_source >= 0 ? consumer : nullptr;
+    }
 
-    // Looping statistics for the current sequence
-    LoopingStatistics looping_stats = LoopingStatistics::fromBPM(sequence_data.bpm);
+    void configureRealtime(const RealtimeConfig &config) {
+        realtime_config = config;
+    }
 
-    // Instance of the sound stream which loops the current mix
-    SwitchingSoundStream sound_stream = SwitchingSoundStream(AUDIO_SAMPLE_RATE, AUDIO_CHANNELS);
+private:
+    AlsaMidiPort port;
+    MidiActionMap<Engine::Sequence> action_map;
+    std::thread midi_read_thread;
+    DrumSequenceDataConsumer *data_consumer = nullptr;
+    int action_source = -1;
+    RealtimeConfig realtime_config;
 
-    void consumerThread() {
-        Action action;
+    size_t n_events = 0;
+    size_t n_actions = 0;
+
+    void midiReadThread() {
+        // MIDI is an input path like the serial port, and gets the same priority
+        applyRealtimePolicy(ThreadRole::SERIAL, realtime_config);
 
         while (running) {
-            if (action_queue.pop(action)) {
-                printf("Consumed action of type %d\n", action.type);
-
-                switch (action.type) {
-                    case Action::Type::TRACK_BEAT_TOGGLE: {
-                        track_id_t track_id = action.data.toggle_beat_track_id;
-                        unsigned char beat_idx = action.data.toggled_beat_id;
-
-                        TrackData &track = sequence_data.tracks[track_id];
-                        track.triggers[beat_idx] = !track.triggers[beat_idx];
-                        track.n_active_triggers += track.triggers[beat_idx] ? 1 : -1;
-
-                        // sequence_data.prettyPrint();
-
-                        if (track.triggers[beat_idx]) {
-                            // Case 1: beat was toggled on, so mix in a new sample
-                            addSampleToTrackByIndex(
-                                individual_tracks[track_id],
-                                track.instrument_id,
-                                beat_idx,
-                                looping_stats,
-                                track.volume
-                            );
-                        } else {
-                            // Case 2: beat was toggled off, so remove the sample
-                            eraseSampleFromTrackByIndex(
-                                individual_tracks[track_id],
-                                track.instrument_id,
-                                beat_idx,
-                                looping_stats,
-                                track.volume
-                            );
-                        }
-
-                        // Update the sound stream with the new mix
-                        AudioStreamBuffer mix_buffer = mixTracksTogether(individual_tracks, sequence_data, looping_stats);
-                        sound_stream.populateIntermetideBuffer(mix_buffer, looping_stats);
-
-                        break;
-                    }
-
-                    case Action::Type::TRACK_MUTE_TOGGLE: {
-                        track_id_t track_id = action.data.mute_unmute_track_id;
-                        TrackData &track = sequence_data.tracks[track_id];
-                        track.muted = !track.muted;
-
-                        // Update the sound stream with the new mix
-                        AudioStreamBuffer mix_buffer = mixTracksTogether(individual_tracks, sequence_data, looping_stats);
-                        sound_stream.populateIntermetideBuffer(mix_buffer, looping_stats);
-
-                        break;
-                    }
-
-                    case Action::Type::PAUSE_TOGGLE: {
-                        paused = !paused;
-
-                        if (paused) {
-                            sound_stream.pause();
-                        } else {
-                            sound_stream.play();
-                        }
-
-                        break;
-                    }
-
-                    case Action::Type::INSTRUMENT_SAMPLE: {
-                        sampleInstrument(action.data.sample_instrument_id);
-
-                        break;
-                    }
-
-                    case Action::Type::BPM_SELECT: {
-                        bpm_t new_bpm = action.data.new_bpm;
-                        sequence_data.bpm = new_bpm;
-                        looping_stats = LoopingStatistics::fromBPM(new_bpm);
-
-                        // Update the individual tracks
-                        for (int j = 0; j < N_TRACKS; ++j) {
-                            individual_tracks[j] = std::move(populateFromTrackData(sequence_data.tracks[j], looping_stats));
-                        }
-
-                        // Update the sound stream with the new mix
-                        AudioStreamBuffer mix_buffer = mixTracksTogether(individual_tracks, sequence_data, looping_stats);
-                        sound_stream.populateIntermetideBuffer(mix_buffer, looping_stats);
-
-                        break;
-                    }
-
-                    case Action::Type::CHANGE_TRACK_INSTRUMENT_ID: {
-                        track_id_t track_id = action.data.change_instrument_track_id;
-                        instrument_id_t new_instrument_id = action.data.new_instrument_id;
-
-                        TrackData &track = sequence_data.tracks[track_id];
-                        track.instrument_id = new_instrument_id;
-
-                        // Update the individual track
-                        individual_tracks[track_id] = std::move(populateFromTrackData(track, looping_stats));
-
-                        // Update the sound stream with the new mix
-                        AudioStreamBuffer mix_buffer = mixTracksTogether(individual_tracks, sequence_data, looping_stats);
-                        sound_stream.populateIntermetideBuffer(mix_buffer, looping_stats);
-
-                        break;
-                    }
-
-                    case Action::Type::CLEAR_ALL: {
-                        // Clear all triggers
-                        sequence_data.reset();
-                        looping_stats = LoopingStatistics::fromBPM(sequence_data.bpm);
-
-                        for (int i = 0; i < N_TRACKS; ++i) {
-                            individual_tracks[i].clear();
-                        }
-
-                        // Update the sound stream with the new mix
-                        AudioStreamBuffer mix_buffer = mixTracksTogether(individual_tracks, sequence_data, looping_stats);
-                        sound_stream.populateIntermetideBuffer(mix_buffer, looping_stats);
-
-                        break;
-                    }
-
-                    default:
-                        break;
+            bool ok = port.receive(MIDI_POLL_TIMEOUT_MS, [this](uint8_t status, uint8_t data1, uint8_t data2) {
+                SwitchingSoundStream::Clock::time_point received_time = SwitchingSoundStream::Clock::now();
+                n_events++;
+
+                Action action;
+                if (!action_map.map(status, data1, data2, action)) return;
+
+                n_actions++;
+                if (data_consumer != nullptr) {
+                    while (running && !data_consumer->pushAction(action_source, action, received_time));
                 }
-            }
+            });
+
+            if (!ok) break;
         }
     }
+};
+#endif // MIDI_USE_ALSA
 
-    void sampleInstrument(instrument_id_t instrument_id) {
-        // Load in the audio sample if we haven't already
-        auto instrument_audio = instrument_samples.find(instrument_id);
-        if (instrument_audio == instrument_samples.end()) {
-            // If the instrument isnt yet loaded, load it into the hashmap
-            const char *file_name = ABSOLUTE_PATHS[instrument_id];
-
-            instrument_samples[instrument_id] = AudioStreamBuffer();
-            int sample_rate, channels;
 
-            loadWavFile(file_name, instrument_samples[instrument_id], sample_rate, channels);
-            instrument_audio = instrument_samples.find(instrument_id);
+// Local automation API on a Unix-domain stream socket, in the text protocol of ControlProtocol.h. One thread
+// serves every client: single actions enter the action queue like any controller's, while batches and queries
+// are answered by the consumer thread, one request per client at a time so replies keep their order.
+class ControlSocketProvider {
+public:
+    ~ControlSocketProvider() {
+        if (server_thread.joinable()) {
+            server_thread.join();
         }
 
-        const AudioStreamBuffer& sample = instrument_audio->second;
-
-        if (sample.empty()) {
-            std::cerr << "Error: samples failed to load.\n";
-            return;
+        for (Client &client : clients) ::close(client.fd);
+        if (listen_fd >= 0) {
+            ::close(listen_fd);
+            unlink(path.c_str());
         }
 
-        sampleInstrument(sample);
+        printf("Control socket: %zu requests, %zu actions in %zu batches\n", n_requests, n_batched_actions, n_batches);
     }
 
-    void sampleInstrument(const AudioStreamBuffer &buffer) {
-        sf::SoundBuffer sound_buffer;
-        if (!sound_buffer.loadFromSamples(buffer.data(), buffer.size(), AUDIO_CHANNELS, AUDIO_SAMPLE_RATE)) {
-            std::cerr << "Failed to load audio buffer from samples!" << std::endl;
-            return;
+    // Listens on `path`, replacing a socket left behind by an earlier run (but no other kind of file)
+    bool open(const std::string &path) {
+        struct sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Error: control socket path " << path << " is too long\n";
+            return false;
         }
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
 
-        sf::Sound sample_sound;
-        sample_sound.setBuffer(sound_buffer);
-
-        // Play the sound
-        sample_sound.play();
+        struct stat existing;
+        if (lstat(path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+            unlink(path.c_str());
+        }
 
-        // Keep the program running while the sound plays
-        while (sample_sound.getStatus() == sf::Sound::Playing) {
-            sf::sleep(sf::milliseconds(50));
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 ||
+            listen(listen_fd, CONTROL_MAX_CLIENTS) != 0) {
+            std::cerr << "Error: cannot listen on " << path << ": " << strerror(errno) << "\n";
+            if (listen_fd >= 0) ::close(listen_fd);
+            listen_fd = -1;
+            return false;
         }
+        fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
 
-        return;
+        this->path = path;
+        printf("Control socket listening on %s\n", path.c_str());
+        return true;
+    }
+
+    void spin() {
+        server_thread = std::thread(&ControlSocketProvider::serverThread, this);
+    }
+
+    void attachDataConsumer(DrumSequenceDataConsumer *consumer) {
+        data_consumer = consumer;
+        action_source = consumer->addActionSource("control socket");
     }
 
-    // Modify the track's audio buffer to remove all sound at the given beat index
-    void eraseSampleFromTrackByIndex(
-        AudioStreamBuffer &track,
-        const AudioStreamBuffer &sample,
-        unsigned char beat_idx,
-        const LoopingStatistics &stats,
-        float volume // This should be the volume of the sample when it was added
-    ) {
-        int frame_start_idx = beat_idx * stats.n_frames_subdivision;
-        unmixSample(track, sample, frame_start_idx, volume);
+private:
+    struct Client {
+        int fd = -1;
+        std::string input;
+        std::string output;
+        bool closed = false;
+
+        // Lines between `batch` and `end`; the first invalid one rejects the whole batch
+        bool in_batch = false;
+        std::vector<Action> batch;
+        std::string batch_error;
+
+        // A request the consumer has not answered yet; later lines wait for it
+        bool waiting = false;
+        std::future<std::string> reply;
+
+        // An action the full action bus could not take yet; retried each round, and later lines wait for it
+        bool parked = false;
+        Action parked_action;
+        SwitchingSoundStream::Clock::time_point parked_time;
+
+        bool subscribed = false;
+        size_t last_bar = 0;
+        size_t last_swap = 0;
+    };
+
+    std::string path;
+    int listen_fd = -1;
+    std::thread server_thread;
+    DrumSequenceDataConsumer *data_consumer = nullptr;
+    int action_source = -1;
+    std::vector<Client> clients;
+
+    size_t n_requests = 0;
+    size_t n_batches = 0;
+    size_t n_batched_actions = 0;
+
+    void serverThread() {
+        std::vector<struct pollfd> fds;
+
+        while (running) {
+            fds.clear();
+            fds.push_back({listen_fd, POLLIN, 0});
+            for (const Client &client : clients) {
+                fds.push_back({client.fd, static_cast<short>(POLLIN | (client.output.empty() ? 0 : POLLOUT)), 0});
+            }
+
+            if (poll(fds.data(), fds.size(), CONTROL_POLL_MS) < 0 && errno != EINTR) {
+                std::cerr << "Error: control socket poll failed: " << strerror(errno) << "\n";
+                break;
+            }
+
+            // Clients accepted below are polled from the next round on
+            for (size_t i = 0; i < clients.size(); ++i) {
+                if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) receive(clients[i]);
+            }
+            if (fds[0].revents & POLLIN) accept();
+
+            deliverEvents();
+
+            for (Client &client : clients) {
+                collectReply(client);
+                retryParkedAction(client);
+                handleLines(client);
+                send(client);
+            }
+
+            clients.erase(
+                std::remove_if(clients.begin(), clients.end(), [](const Client &client) {
+                    if (client.closed) ::close(client.fd);
+                    return client.closed;
+                }),
+                clients.end()
+            );
+        }
     }
 
-    void eraseSampleFromTrackByIndex(
-        AudioStreamBuffer &track,
-        instrument_id_t instrument_id,
-        unsigned char beat_idx,
-        const LoopingStatistics &stats,
-        float volume
-    ) {
-        auto instrument_audio = instrument_samples.find(instrument_id);
-        if (instrument_audio == instrument_samples.end()) {
-            std::cerr << "Error: trying to erase instrument not found in map.\n";
+    void accept() {
+        while (true) {
+            int fd = ::accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) return;
+
+            if (clients.size() >= CONTROL_MAX_CLIENTS) {
+                ::close(fd);
+                continue;
+            }
+
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            clients.emplace_back();
+            clients.back().fd = fd;
         }
+    }
 
-        const AudioStreamBuffer& sample = instrument_audio->second;
-        if (sample.empty()) {
-            std::cerr << "Error: samples failed to load.\n";
+    void receive(Client &client) {
+        char buffer[4096];
+
+        while (true) {
+            ssize_t n = read(client.fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                client.input.append(buffer, static_cast<size_t>(n));
+                if (client.input.size() > CONTROL_MAX_BUFFER_BYTES) client.closed = true;
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EINTR)) client.closed = true;
             return;
         }
+    }
+
+    void send(Client &client) {
+        while (!client.output.empty() && !client.closed) {
+            ssize_t n = ::send(client.fd, client.output.data(), client.output.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) {
+                client.output.erase(0, static_cast<size_t>(n));
+                continue;
+            }
+            if (n < 0 && errno != EAGAIN && errno != EINTR) client.closed = true;
+            break;
+        }
 
-        eraseSampleFromTrackByIndex(track, sample, beat_idx, stats, volume);
+        // A subscriber that stopped reading
+        if (client.output.size() > CONTROL_MAX_BUFFER_BYTES) client.closed = true;
     }
 
-    void addSampleToTrackByIndex(
-        AudioStreamBuffer &track,
-        const AudioStreamBuffer &sample,
-        unsigned char beat_idx,
-        const LoopingStatistics &stats,
-        float volume
-    ) {
-        int frame_start_idx = beat_idx * stats.n_frames_subdivision;
-        mixSample(track, sample, frame_start_idx, volume);
+    void reply(Client &client, const std::string &text) {
+        client.output += text;
+        client.output += '\n';
     }
 
-    void addSampleToTrackByIndex(
-        AudioStreamBuffer &track,
-        instrument_id_t instrument_id,
-        unsigned char beat_idx,
-        const LoopingStatistics &stats,
-        float volume = 0.75f
-    ) {
-        // Resize the track if it is empty
-        if (track.empty()) {
-            printf("Resizing track, was previously empty\n");
-            int total_frames = stats.bar_length_frames;
-            track.resize(total_frames * AUDIO_CHANNELS, 0);
+    void collectReply(Client &client) {
+        if (!client.waiting || client.reply.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+
+        try {
+            reply(client, client.reply.get());
+        } catch (const std::future_error &) {
+            reply(client, "error shutting down");
         }
+        client.waiting = false;
+    }
 
-        // Load in the audio sample if we haven't already
-        auto instrument_audio = instrument_samples.find(instrument_id);
-        if (instrument_audio == instrument_samples.end()) {
-            // If the instrument isnt yet loaded, load it into the hashmap
-            const char *file_name = ABSOLUTE_PATHS[instrument_id];
+    void handleLines(Client &client) {
+        size_t newline;
+        while (!client.waiting && !client.parked && !client.closed && (newline = client.input.find('\n')) != std::string::npos) {
+            std::string line = client.input.substr(0, newline);
+            client.input.erase(0, newline + 1);
 
-            instrument_samples[instrument_id] = AudioStreamBuffer();
-            int sample_rate, channels;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty() || line[0] == '#') continue;
 
-            loadWavFile(file_name, instrument_samples[instrument_id], sample_rate, channels);
-            instrument_audio = instrument_samples.find(instrument_id);
+            handleLine(client, line);
         }
+    }
 
-        const AudioStreamBuffer& sample = instrument_audio->second;
+    void handleLine(Client &client, const std::string &line) {
+        if (client.in_batch) {
+            if (line == "end") {
+                finishBatch(client);
+                return;
+            }
+            if (!client.batch_error.empty()) return;
 
-        if (sample.empty()) {
-            std::cerr << "Error: samples failed to load.\n";
+            Action action;
+            std::string error = EngineControlProtocol::parseAction(line, action);
+            if (error.empty() && !EngineControlProtocol::isBatchable(action)) error = "cannot be batched";
+            if (error.empty() && client.batch.size() >= CONTROL_MAX_BATCH_ACTIONS) error = "batch too long";
+
+            if (!error.empty()) {
+                client.batch_error = "`" + line + "`: " + error;
+            } else {
+                client.batch.push_back(action);
+            }
             return;
         }
 
-        addSampleToTrackByIndex(track, sample, beat_idx, stats, volume);
-    }
+        n_requests++;
+
+        if (line == "batch") {
+            client.in_batch = true;
+            client.batch.clear();
+            client.batch_error.clear();
+        } else if (line == "end") {
+            reply(client, "error `end` without `batch`");
+        } else if (line == "state" || line == "stats") {
+            client.reply = data_consumer->submitControlRequest(line == "state" ? ControlRequest::STATE : ControlRequest::STATS);
+            client.waiting = true;
+        } else if (line == "subscribe") {
+            client.subscribed = true;
+            client.last_bar = data_consumer->barsStarted();
+            client.last_swap = data_consumer->latencyStatistics().n_swaps;
+            reply(client, "ok subscribed");
+        } else {
+            Action action;
+            std::string error = EngineControlProtocol::parseAction(line, action);
+            if (error.empty() && action_source < 0) error = "no action source for the control socket";
+            if (!error.empty()) {
+                reply(client, "error " + error);
+                return;
+            }
 
-    AudioStreamBuffer populateFromTrackData(const TrackData &data, const LoopingStatistics &looping_stats) {
-        AudioStreamBuffer track = {};
+            client.parked = true;
+            client.parked_action = action;
+            client.parked_time = SwitchingSoundStream::Clock::now();
+            retryParkedAction(client);
+        }
+    }
 
-        for (int i = 0; i < N_TRACK_SUBDIVISIONS; ++i) {
-            if (data.triggers[i]) {
-                addSampleToTrackByIndex(
-                    track,
-                    data.instrument_id,
-                    i,
-                    looping_stats,
-                    data.volume
-                );
-            }
+    // The action bus holds only a few actions per source, so a client that sends faster than the consumer
+    // applies them waits here, a poll round at a time, instead of holding up every other client
+    void retryParkedAction(Client &client) {
+        if (!client.parked || !data_consumer->pushAction(action_source, client.parked_action, client.parked_time)) {
+            return;
         }
 
-        return track;
+        client.parked = false;
+        reply(client, "ok");
     }
 
-    AudioStreamBuffer mixTracksTogether(
-        AudioStreamBuffer individual_tracks[N_TRACKS],
-        SequenceData &sequence_data,
-        LoopingStatistics &stats
-    ) {
-        int total_frames = stats.bar_length_frames;
-        AudioStreamBuffer mix_buffer(total_frames * AUDIO_CHANNELS, 0);
+    void finishBatch(Client &client) {
+        client.in_batch = false;
 
-        int n_active_tracks = 0;
-        for (int j = 0; j < N_TRACKS; ++j) {
-            n_active_tracks += sequence_data.tracks[j].isActive();
+        if (!client.batch_error.empty()) {
+            reply(client, "error batch rejected at " + client.batch_error);
+            return;
+        }
+        if (client.batch.empty()) {
+            reply(client, "ok 0 actions");
+            return;
         }
 
-        float volume_multiplier = 1.0f / static_cast<float>(n_active_tracks);
+        n_batches++;
+        n_batched_actions += client.batch.size();
+        client.reply = data_consumer->submitControlRequest(ControlRequest::BATCH, std::move(client.batch));
+        client.batch.clear();
+        client.waiting = true;
+    }
 
-        for (int j = 0; j < N_TRACKS; ++j) {
-            if (!sequence_data.tracks[j].isActive()) continue;
+    // Bar starts and mix swaps since the last round, for subscribers
+    void deliverEvents() {
+        bool any_subscribed = false;
+        for (const Client &client : clients) any_subscribed |= client.subscribed;
+        if (!any_subscribed) return;
 
-            std::transform(
-                individual_tracks[j].begin(), individual_tracks[j].end(),
-                mix_buffer.begin(), mix_buffer.begin(),
-                [volume_multiplier](sf::Int16 v, sf::Int16 w) {
-                    return static_cast<sf::Int16>(v * volume_multiplier + w);
-            });
-        }
+        size_t bars = data_consumer->barsStarted();
+        StreamLatencyStatistics latency = data_consumer->latencyStatistics();
+        char line[64];
 
-        return mix_buffer;
+        for (Client &client : clients) {
+            if (!client.subscribed) continue;
+
+            if (bars != client.last_bar) {
+                snprintf(line, sizeof(line), "bar %zu", bars);
+                reply(client, line);
+                client.last_bar = bars;
+            }
+            if (latency.n_swaps != client.last_swap) {
+                snprintf(line, sizeof(line), "swap %.2f", latency.last_latency_ms);
+                reply(client, line);
+                client.last_swap = latency.n_swaps;
+            }
+        }
     }
 };
 
-class DrumSequenceDataProvider {
-public:
-    DrumSequenceDataProvider() {
-        const std::vector<std::string> ports = {
-            "/dev/tty.usbmodem11301", "/dev/tty.usbmodem12301", "/dev/cu.usbmodem1101", "/dev/ttyUSB0", "/dev/ttyUSB1", "/dev/ttyACM0", "/dev/ttyACM1",
-        };
 
-        std::string connected_port = ports[0];
+// Several drum machines in one process, one per controller. The sessions share the sample bank, the render
+// cache and one render worker pool; a single thread applies every session's actions and a single thread reads
+// every controller, both backing off when idle instead of spinning. Each session plays through its own stream,
+// or all of them are mixed onto one bus.
+class DrumSessionHost {
+public:
+    DrumSessionHost(
+        SampleBank<Engine::sample_t> &sample_bank,
+        RenderCache<DefaultEngineConfig> &render_cache,
+        size_t render_threads,
+        bool mixed
+    ) :
+        sample_bank(sample_bank),
+        render_cache(render_cache),
+        mixed(mixed),
+        bus(AUDIO_SAMPLE_RATE, AUDIO_CHANNELS),
+        render_pool(render_threads) {}
+
+    ~DrumSessionHost() {
+        if (consumer_thread.joinable()) consumer_thread.join();
+        if (serial_thread.joinable()) serial_thread.join();
+
+        bus.stop();
+        controllers.clear();
+
+        for (size_t i = 0; i < sessions.size(); ++i) {
+            printf("Session %zu:\n", i);
+            sessions[i].reset();
+        }
 
-        for (const auto &port : ports) {
-            try {
-                serial.Open(port);
-                serial.SetBaudRate(BaudRate::BAUD_9600);
-                serial.SetCharacterSize(CharacterSize::CHAR_SIZE_8);
-                serial.SetStopBits(StopBits::STOP_BITS_1);
-                serial.SetParity(Parity::PARITY_NONE);
+        if (mixed) {
+            BusStatistics stats = bus.getStatistics();
+            LimiterStatistics limiter = bus.getLimiterStatistics();
+            printf(
+                "Session bus: %.3f%% of a core, max %.0f us per chunk, max %.1f dB gain reduction\n",
+                100.0 * stats.cpuShare(AUDIO_SAMPLE_RATE), stats.max_chunk_us, limiter.max_gain_reduction_db
+            );
+        }
+    }
 
-                // Clear any old data in the buffer
-                serial.FlushIOBuffers();
+    // Adds a session with no controller
+    DrumSequenceDataConsumer &addSession() {
+        sessions.emplace_back(new DrumSequenceDataConsumer(sample_bank, render_cache, &render_pool));
+        DrumSequenceDataConsumer &session = *sessions.back();
 
-                connected_port = port;
+        if (mixed) {
+            session.configureMixedOutput(bus);
+        }
 
-                // Wait briefly for the Arduino to reset (typical on connection)
-                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        return session;
+    }
 
-                break;
-            } catch (const OpenFailed &) {
-                std::cerr << "Failed to open port " << port << std::endl;
-            } catch (...) {
-                std::cerr << "An error occurred with port " << port << std::endl;
-            }
+    // Adds a session per port, each reading actions from the controller there (none for an empty port). The
+    // ports are opened at once, so every board resets and settles in parallel.
+    void addSessions(const std::vector<std::string> &ports) {
+        std::vector<std::string> opened_ports;
+        for (const std::string &port : ports) {
+            if (!port.empty()) opened_ports.push_back(port);
         }
+        std::vector<std::unique_ptr<DrumSequenceDataProvider>> opened = DrumSequenceDataProvider::openAll(opened_ports);
 
-        if (!serial.IsOpen()) {
-            std::cerr << "Failed to open any serial port!" << std::endl;
-            exit(1);
-        } else {
-            std::cout << "Connected to serial port " << connected_port << std::endl;
+        size_t next = 0;
+        for (const std::string &port : ports) {
+            DrumSequenceDataConsumer &session = addSession();
+            if (port.empty()) continue;
+
+            controllers.push_back(std::move(opened[next++]));
+            controllers.back()->attachDataConsumer(&session);
         }
-    };
+    }
 
-    ~DrumSequenceDataProvider() {
-        if (serial_read_thread.joinable()) {
-            serial_read_thread.join();
+    // Applies to every session added so far
+    void configure(size_t chunk_frames, bool adaptive_chunks, const RealtimeConfig &config, const std::vector<SongEntry> &song, bool loop_song) {
+        realtime_config = config;
+        lockProcessMemory(config);
+
+        // Memory is locked once above; each stream that plays only needs its audio thread set up
+        RealtimeConfig stream_config = config;
+        stream_config.lock_memory = false;
+
+        for (std::unique_ptr<DrumSequenceDataConsumer> &session : sessions) {
+            // Bus-mixed sessions are pulled in bus-sized chunks; their size only informs the latency report
+            session->configureChunking(chunk_frames, adaptive_chunks && !mixed);
+            session->configureSong(song, loop_song);
+            if (!mixed) session->configureRealtime(stream_config);
         }
 
-        if (serial.IsOpen()) {
-            serial.Close();
+        bus.setChunkFrames(chunk_frames);
+        if (mixed && config.enabled) {
+            bus.setAudioThreadInit([config]() {
+                applyRealtimePolicy(ThreadRole::AUDIO, config);
+            });
         }
     }
 
     void spin() {
-        serial_read_thread = std::thread(&DrumSequenceDataProvider::serialReadThread, this);
+        for (std::unique_ptr<DrumSequenceDataConsumer> &session : sessions) {
+            session->startOutput();
+        }
+        if (mixed) {
+            bus.play();
+        }
+
+        consumer_thread = std::thread(&DrumSessionHost::consumerThread, this);
+        serial_thread = std::thread(&DrumSessionHost::serialThread, this);
     }
 
-    void attachDataConsumer(DrumSequenceDataConsumer *consumer) {
-        data_consumer = consumer;
+    DrumSequenceDataConsumer &session(size_t index) {
+        return *sessions[index];
+    }
+
+    size_t sessionCount() const {
+        return sessions.size();
+    }
+
+    MixedBusStream &mixedBus() {
+        return bus;
+    }
+
+    // Blocks until every background render queued so far has finished
+    void waitForRenders() {
+        render_pool.wait();
     }
 
 private:
-    SerialPort serial;
-    std::thread serial_read_thread;
-    DrumSequenceDataConsumer *data_consumer = nullptr;
+    SampleBank<Engine::sample_t> &sample_bank;
+    RenderCache<DefaultEngineConfig> &render_cache;
+    bool mixed;
+    RealtimeConfig realtime_config;
+
+    std::vector<std::unique_ptr<DrumSequenceDataConsumer>> sessions;
+    std::vector<std::unique_ptr<DrumSequenceDataProvider>> controllers;
+    MixedBusStream bus;
+
+    // Background pattern renders of every session
+    WorkStealingPool render_pool;
+
+    std::thread consumer_thread;
+    std::thread serial_thread;
+
+    void consumerThread() {
+        applyRealtimePolicy(ThreadRole::CONSUMER, realtime_config);
+
+        for (std::unique_ptr<DrumSequenceDataConsumer> &session : sessions) {
+            session->begin();
+        }
 
-    void serialReadThread() {
         while (running) {
-            readAndDecodeMessage();
+            bool busy = false;
+            for (std::unique_ptr<DrumSequenceDataConsumer> &session : sessions) {
+                busy |= session->poll();
+            }
+
+            if (!busy) std::this_thread::sleep_for(std::chrono::microseconds(RT_IDLE_BACKOFF_US));
         }
     }
 
-    void readAndDecodeMessage() {
-        if (!serial.IsDataAvailable()) return;
+    void serialThread() {
+        applyRealtimePolicy(ThreadRole::SERIAL, realtime_config);
 
-        uint8_t start_byte;
-        serial.ReadByte(start_byte, SERIAL_READ_TIMEOUT_MS);
+        while (running) {
+            bool busy = false;
+            for (std::unique_ptr<DrumSequenceDataProvider> &controller : controllers) {
+                busy |= controller->poll();
+            }
 
-        if (start_byte != MSG_START_BYTE) return;  // Ignore if not a valid start byte
+            if (!busy) std::this_thread::sleep_for(std::chrono::microseconds(RT_IDLE_BACKOFF_US));
+        }
+    }
+};
 
-        // Read message header
-        uint8_t msg_type;
-        uint8_t payload_size;
-        DataBuffer payload;
+// Splits "a,b,c" into its parts
+std::vector<std::string> parsePortList(const char *arg) {
+    std::vector<std::string> ports;
+    std::string list(arg);
+    size_t start = 0;
+
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) comma = list.size();
+        if (comma > start) ports.push_back(list.substr(start, comma - start));
+        start = comma + 1;
+    }
 
-        serial.ReadByte(msg_type, SERIAL_READ_TIMEOUT_MS);
-        serial.ReadByte(payload_size, SERIAL_READ_TIMEOUT_MS);
+    return ports;
+}
 
-        if (payload_size > 0) {
-            serial.Read(payload, payload_size, SERIAL_READ_TIMEOUT_MS);
+// A busy five-track pattern that exercises the whole chunk path: a 7/8 track makes it polymetric and the last
+// track's filter runs live. Sessions get different instruments and tempos, as separate controllers would.
+Engine::Sequence benchSequence(size_t session) {
+    Engine::Sequence sequence_data;
+    sequence_data.bpm = static_cast<bpm_t>(100 + session % 40);
+
+    for (int j = 0; j < Engine::Sequence::n_tracks && j < 5; ++j) {
+        Engine::Track &track = sequence_data.tracks[j];
+        track.instrument_id = static_cast<instrument_id_t>((session * 5 + j) % NUM_INSTRUMENTS);
+
+        for (int step = 0; step < Engine::Track::max_steps; step += (j + 1)) {
+            track.toggleTrigger(static_cast<uint8_t>(step));
         }
+    }
 
-        const unsigned char *buffer = static_cast<const unsigned char *>(payload.data());
+    sequence_data.tracks[3].n_steps = 7;
+    sequence_data.tracks[3].step_division = 8;
+    sequence_data.tracks[4].setEffectParam(EFFECT_FILTER_CUTOFF, 70);
+    sequence_data.tracks[4].setEffectParam(EFFECT_PARAM_LIVE, 1 << TRACK_EFFECT_FILTER);
 
-        MessageType variant = static_cast<MessageType>(msg_type);
-        Action action = Action::fromSerialized(variant, buffer);
+    return sequence_data;
+}
 
-        printf("Received message of type %d (with payload size %d bytes)\n", msg_type, payload_size);
+double maxResidentMegabytes() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1048576.0;  // Bytes
+#else
+    return usage.ru_maxrss / 1024.0;     // Kilobytes
+#endif
+}
 
-        if (data_consumer != nullptr) {
-            while (running && !data_consumer->action_queue.push(action));
+// Mixes 1, 2, 4, ... up to `max_sessions` sessions onto one bus, without a device or controllers, and reports
+// what the audio path costs and how many sessions one core can therefore sustain
+int runSessionBenchmark(size_t max_sessions, size_t chunk_frames, size_t render_threads, SampleBank<Engine::sample_t> &sample_bank, RenderCache<DefaultEngineConfig> &render_cache) {
+    DrumSessionHost host(sample_bank, render_cache, render_threads, true);
+    host.mixedBus().setChunkFrames(chunk_frames);
+
+    std::vector<size_t> counts;
+    for (size_t n = 1; n < max_sessions; n *= 2) counts.push_back(n);
+    counts.push_back(max_sessions);
+
+    struct Row {
+        size_t sessions;
+        double core_share;
+        double resident_mb;
+    };
+    std::vector<Row> rows;
+
+    for (size_t n : counts) {
+        while (host.sessionCount() < n) {
+            DrumSequenceDataConsumer &session = host.addSession();
+            session.configureChunking(chunk_frames, false);
+
+            Action action;
+            action.type = Action::Type::SEQUENCE_SNAPSHOT;
+            benchSequence(host.sessionCount() - 1).serialize(action.data.snapshot);
+            session.pushAction(session.addActionSource("bench"), action);
+            while (session.poll()) {}
+        }
+        host.waitForRenders();
+
+        size_t warmup_frames = AUDIO_SAMPLE_RATE;
+        size_t bench_frames = static_cast<size_t>(SESSION_BENCH_SECONDS) * AUDIO_SAMPLE_RATE;
+
+        for (size_t frames = 0; frames < warmup_frames; frames += chunk_frames) {
+            host.mixedBus().mixChunk(chunk_frames);
         }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t frames = 0; frames < bench_frames; frames += chunk_frames) {
+            host.mixedBus().mixChunk(chunk_frames);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        rows.push_back({n, seconds / SESSION_BENCH_SECONDS, maxResidentMegabytes()});
+    }
+
+    printf("\nSessions mixed onto one bus, %zu-frame chunks (polymetric patterns with a live filter)\n", chunk_frames);
+    printf("%8s %14s %20s %14s\n", "sessions", "% of a core", "us per session-sec", "max RSS (MB)");
+    for (const Row &row : rows) {
+        printf("%8zu %13.3f%% %20.1f %14.1f\n", row.sessions, 100.0 * row.core_share, 1e6 * row.core_share / row.sessions, row.resident_mb);
+    }
+
+    const Row &largest = rows.back();
+    if (rows.size() > 1) {
+        printf(
+            "Each added session costs %.1f MB resident\n",
+            (largest.resident_mb - rows.front().resident_mb) / (largest.sessions - rows.front().sessions)
+        );
+    }
+    if (largest.core_share > 0.0) {
+        printf("One core sustains about %.0f sessions on the audio path\n", largest.sessions / largest.core_share);
     }
-};
 
+    return 0;
+}
 
-int main() {
+int main(int argc, char **argv) {
     std::signal(SIGINT, signalHandler);
 
-    DrumSequenceDataConsumer data_consumer = DrumSequenceDataConsumer();
-    DrumSequenceDataProvider data_provider = DrumSequenceDataProvider();
-    data_provider.attachDataConsumer(&data_consumer);
+    size_t chunk_frames = DEFAULT_CHUNK_FRAMES;
+    bool adaptive_chunks = false;
+    RealtimeConfig realtime_config = RealtimeConfig::withDefaultCores();
+    size_t cache_mb = DEFAULT_RENDER_CACHE_MB;
+    std::vector<SongEntry> song;
+    bool loop_song = false;
+    const char *record_path = nullptr;
+    std::vector<std::string> session_ports;
+    bool mix_sessions = false;
+    size_t render_threads = 0;
+    size_t bench_sessions = 0;
+    std::vector<std::string> serial_ports;
+    bool all_ports = false;
+    const char *capture_path = nullptr;
+    bool use_midi = false;
+    std::string midi_source;
+    bool use_serial = true;
+    bool use_midi_clock = false;
+    const char *control_socket_path = nullptr;
+    std::string midi_clock_destination;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--chunk-frames") == 0 && i + 1 < argc) {
+            chunk_frames = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--adaptive-chunks") == 0) {
+            adaptive_chunks = true;
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            realtime_config.enabled = true;
+        } else if (strcmp(argv[i], "--rt-cores") == 0 && i + 1 < argc && parseRealtimeCores(argv[i + 1], realtime_config)) {
+            ++i;
+        } else if (strcmp(argv[i], "--no-mlock") == 0) {
+            realtime_config.lock_memory = false;
+        } else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            cache_mb = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--song") == 0 && i + 1 < argc && parseSongChain(argv[i + 1], song)) {
+            ++i;
+        } else if (strcmp(argv[i], "--song-loop") == 0) {
+            loop_song = true;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--sessions") == 0 && i + 1 < argc) {
+            session_ports = parsePortList(argv[++i]);
+        } else if (strcmp(argv[i], "--mix-sessions") == 0) {
+            mix_sessions = true;
+        } else if (strcmp(argv[i], "--render-threads") == 0 && i + 1 < argc) {
+            render_threads = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--bench-sessions") == 0 && i + 1 < argc) {
+            bench_sessions = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            serial_ports = parsePortList(argv[++i]);
+        } else if (strcmp(argv[i], "--all-ports") == 0) {
+            all_ports = true;
+        } else if (strcmp(argv[i], "--capture-serial") == 0 && i + 1 < argc) {
+            capture_path = argv[++i];
+        } else if (strcmp(argv[i], "--midi") == 0) {
+            use_midi = true;
+        } else if (strcmp(argv[i], "--midi-from") == 0 && i + 1 < argc) {
+            use_midi = true;
+            midi_source = argv[++i];
+        } else if (strcmp(argv[i], "--no-serial") == 0) {
+            use_serial = false;
+        } else if (strcmp(argv[i], "--control-socket") == 0 && i + 1 < argc) {
+            control_socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--midi-clock") == 0) {
+            use_midi_clock = true;
+        } else if (strcmp(argv[i], "--midi-clock-to") == 0 && i + 1 < argc) {
+            use_midi_clock = true;
+            midi_clock_destination = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--chunk-frames N] [--adaptive-chunks]"
+                      << " [--realtime] [--rt-cores AUDIO,CONSUMER,SERIAL] [--no-mlock]"
+                      << " [--cache-mb N] [--song PATTERNxBARS,...] [--song-loop] [--record FILE.wav]"
+                      << " [--port PATH,...|--all-ports] [--capture-serial FILE] [--midi] [--midi-from CLIENT:PORT] [--no-serial]"
+                      << " [--midi-clock] [--midi-clock-to CLIENT:PORT] [--control-socket PATH]"
+                      << " [--sessions PORT,PORT,... [--mix-sessions] [--render-threads N]] [--bench-sessions N]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (chunk_frames < MIN_CHUNK_FRAMES || chunk_frames > MAX_CHUNK_FRAMES) {
+        std::cerr << "Error: --chunk-frames must be between " << MIN_CHUNK_FRAMES << " and " << MAX_CHUNK_FRAMES
+                  << std::endl;
+        return 1;
+    }
+
+    if ((record_path || !serial_ports.empty() || all_ports || capture_path || use_midi || !use_serial || use_midi_clock || control_socket_path) &&
+        (!session_ports.empty() || bench_sessions > 0)) {
+        std::cerr << "Error: --record, --port, --all-ports, --capture-serial, --midi, --no-serial, --midi-clock and --control-socket need a single session"
+                  << std::endl;
+        return 1;
+    }
+
+    if (!use_serial && (!serial_ports.empty() || all_ports || capture_path)) {
+        std::cerr << "Error: --port, --all-ports and --capture-serial need the serial controller" << std::endl;
+        return 1;
+    }
+
+    bool several_controllers = all_ports || serial_ports.size() > 1;
+    if (capture_path && several_controllers) {
+        std::cerr << "Error: --capture-serial records a single controller" << std::endl;
+        return 1;
+    }
+
+#ifndef MIDI_USE_ALSA
+    if (use_midi || use_midi_clock) {
+        std::cerr << "Error: MIDI input and clock need a build with ALSA (`make mac ALSA_MIDI=1`)" << std::endl;
+        return 1;
+    }
+#endif
+
+    // Shared by every session in the process
+    SampleBank<Engine::sample_t> sample_bank;
+    RenderCache<DefaultEngineConfig> render_cache(cache_mb << 20);
+
+    if (bench_sessions > 0) {
+        runSessionBenchmark(bench_sessions, chunk_frames, render_threads, sample_bank, render_cache);
+    } else if (!session_ports.empty()) {
+        DrumSessionHost host(sample_bank, render_cache, render_threads, mix_sessions);
+        host.addSessions(session_ports);
+
+        host.configure(chunk_frames, adaptive_chunks, realtime_config, song, loop_song);
+        host.spin();
+    } else {
+#ifdef MIDI_USE_ALSA
+        // Outlives the consumer, whose clock sender writes to it
+        AlsaMidiPort clock_port;
+        if (use_midi_clock && (!clock_port.open("clock", AlsaMidiPort::OUTPUT, ALSA_MIDI_CLOCK_CLIENT_NAME) ||
+                               (!midi_clock_destination.empty() && !clock_port.connect(midi_clock_destination)))) {
+            return 1;
+        }
+#endif
+
+        DrumSequenceDataConsumer data_consumer(sample_bank, render_cache);
+        data_consumer.configureChunking(chunk_frames, adaptive_chunks);
+        data_consumer.configureRealtime(realtime_config);
+        data_consumer.configureSong(song, loop_song);
+        if (record_path && !data_consumer.configureRecording(record_path)) {
+            return 1;
+        }
+#ifdef MIDI_USE_ALSA
+        if (use_midi_clock) {
+            data_consumer.configureMidiClock([&clock_port](uint8_t status, uint16_t song_position) {
+                clock_port.send(status, song_position);
+            });
+        }
+#endif
+
+        // One controller, the first one discovered, unless ports were named; several are all opened at once.
+        // Controllers that are missing or go away are waited for while the rest keeps playing.
+        std::vector<std::unique_ptr<DrumSequenceDataProvider>> data_providers;
+        std::vector<std::string> ports = all_ports ? DrumSequenceDataProvider::discoverPorts() : serial_ports;
+        if (use_serial && ports.size() > 1) {
+            data_providers = DrumSequenceDataProvider::openAll(ports);
+        } else if (use_serial && ports.size() == 1) {
+            data_providers.emplace_back(new DrumSequenceDataProvider(ports[0]));
+        } else if (use_serial) {
+            data_providers.push_back(DrumSequenceDataProvider::openAny());
+        }
+
+        for (std::unique_ptr<DrumSequenceDataProvider> &data_provider : data_providers) {
+            data_provider->attachDataConsumer(&data_consumer);
+            data_provider->configureRealtime(realtime_config);
+        }
+        if (capture_path && !data_providers[0]->configureCapture(capture_path)) {
+            return 1;
+        }
+
+#ifdef MIDI_USE_ALSA
+        std::unique_ptr<MidiInputProvider> midi_provider;
+        if (use_midi) {
+            midi_provider.reset(new MidiInputProvider());
+            if (!midi_provider->open(midi_source)) {
+                return 1;
+            }
+            midi_provider->attachDataConsumer(&data_consumer);
+            midi_provider->configureRealtime(realtime_config);
+        }
+#endif
+
+        std::unique_ptr<ControlSocketProvider> control_socket;
+        if (control_socket_path) {
+            control_socket.reset(new ControlSocketProvider());
+            if (!control_socket->open(control_socket_path)) {
+                return 1;
+            }
+            control_socket->attachDataConsumer(&data_consumer);
+        }
+
+        data_consumer.spin();
+        for (std::unique_ptr<DrumSequenceDataProvider> &data_provider : data_providers) data_provider->spin();
+        if (control_socket) control_socket->spin();
+#ifdef MIDI_USE_ALSA
+        if (midi_provider) midi_provider->spin();
+#endif
+    }
 
-    data_consumer.spin();
-    data_provider.spin();
+    // Reached once the threads above have been joined (after an interrupt)
+    render_cache.printStatistics();
+    sample_bank.printStatistics();
 
     return 0;
 }
\ No newline at end of file
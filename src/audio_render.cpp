@@ -0,0 +1,191 @@
+// Offline batch renderer: turns text descriptions of patterns (see PatternText.h) into WAV files, as fast as
+// the cores allow. Each pattern is rendered by the same DrumRenderEngine and played out by the same MixPlayhead
+// as in audio_mix, so with the same chunk size a file holds exactly the samples the stream plays for that
+// pattern from a bar start. Build with `make render`.
+
+#include <AudioUtils.h>
+#include <DrumMachineTrackData.h>
+#include <DrumRenderEngine.h>
+#include <MixPlayhead.h>
+#include <PatternText.h>
+#include <RenderCache.h>
+#include <SampleBank.h>
+#include <SwitchingSoundStream.h>
+#include <WavFile.h>
+#include <WorkStealingPool.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#define DEFAULT_RENDER_BARS 4
+
+typedef DefaultEngineConfig Config;
+typedef DrumRenderEngine<Config> Engine;
+typedef PatternDescription<Config::Sequence> Pattern;
+typedef std::chrono::steady_clock Clock;
+
+struct RenderJob {
+    Pattern pattern;
+    std::string path;
+    size_t frames = 0;
+    bool ok = false;
+};
+
+class BatchRenderer {
+public:
+    BatchRenderer(size_t cache_budget_bytes, size_t chunk_frames, size_t default_bars) :
+        render_cache(cache_budget_bytes),
+        chunk_frames(chunk_frames),
+        default_bars(default_bars) {}
+
+    // Renders `job.pattern` into `job.path`; runs on any worker, sharing only the sample bank and render cache
+    void render(RenderJob &job) {
+        const Config::Sequence &sequence_data = job.pattern.sequence_data;
+        size_t bars = job.pattern.bars > 0 ? job.pattern.bars : default_bars;
+
+        Engine engine(sample_bank, sequence_data.bpm, &render_cache);
+        engine.setTempo(sequence_data);
+        StreamMix mix = engine.renderMix(sequence_data);
+        Engine::Stats stats = engine.stats();
+
+        WavWriter wav;
+        if (!wav.open(job.path, AUDIO_SAMPLE_RATE, AUDIO_CHANNELS)) {
+            std::cerr << "Error: cannot write " << job.path << "\n";
+            return;
+        }
+
+        MixPlayhead playhead(AUDIO_SAMPLE_RATE, AUDIO_CHANNELS, chunk_frames);
+        playhead.setMix(&mix, &stats);
+
+        const sf::Int16 *samples = nullptr;
+        size_t sample_count = 0;
+
+        for (size_t bar = 0; bar < bars; ++bar) {
+            while (playhead.nextChunk(chunk_frames, samples, sample_count)) {
+                wav.write(samples, sample_count);
+                job.frames += sample_count / AUDIO_CHANNELS;
+            }
+        }
+
+        job.ok = wav.close();
+        if (!job.ok) {
+            std::cerr << "Error: failed writing " << job.path << "\n";
+        }
+    }
+
+    void printStatistics() {
+        render_cache.printStatistics();
+        sample_bank.printStatistics();
+    }
+
+private:
+    SampleBank<Engine::sample_t> sample_bank;
+    RenderCache<Config> render_cache;
+    size_t chunk_frames;
+    size_t default_bars;
+};
+
+// Output file for each pattern, with a numeric suffix for names used more than once
+std::vector<std::string> outputPaths(const std::vector<RenderJob> &jobs, const std::string &out_dir) {
+    std::vector<std::string> paths;
+    std::set<std::string> used;
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        std::string name = jobs[i].pattern.name;
+        if (used.count(name)) name += "_" + std::to_string(i);
+        used.insert(name);
+
+        paths.push_back(out_dir + "/" + name + ".wav");
+    }
+
+    return paths;
+}
+
+int main(int argc, char **argv) {
+    size_t n_jobs = 0;
+    size_t bars = DEFAULT_RENDER_BARS;
+    size_t chunk_frames = DEFAULT_CHUNK_FRAMES;
+    size_t cache_mb = DEFAULT_RENDER_CACHE_MB;
+    std::string out_dir = ".";
+    std::vector<std::string> inputs;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            n_jobs = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--bars") == 0 && i + 1 < argc) {
+            bars = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--chunk-frames") == 0 && i + 1 < argc) {
+            chunk_frames = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            cache_mb = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_dir = argv[++i];
+        } else if (argv[i][0] != '-') {
+            inputs.push_back(argv[i]);
+        } else {
+            inputs.clear();
+            break;
+        }
+    }
+
+    if (inputs.empty() || bars < 1 || chunk_frames < MIN_CHUNK_FRAMES || chunk_frames > MAX_CHUNK_FRAMES) {
+        std::cerr << "Usage: " << argv[0] << " [--jobs N] [--bars N] [--chunk-frames " << MIN_CHUNK_FRAMES << "-"
+                  << MAX_CHUNK_FRAMES << "] [--cache-mb N] [--out DIR] PATTERNS.txt..." << std::endl;
+        return 1;
+    }
+
+    std::vector<Pattern> patterns;
+    for (const std::string &input : inputs) {
+        if (!PatternTextParser<Config::Sequence>::parseFile(input, patterns)) return 1;
+    }
+
+    if (mkdir(out_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Error: cannot create " << out_dir << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    std::vector<RenderJob> jobs(patterns.size());
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        jobs[i].pattern = patterns[i];
+    }
+    std::vector<std::string> paths = outputPaths(jobs, out_dir);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        jobs[i].path = paths[i];
+    }
+
+    BatchRenderer renderer(cache_mb << 20, chunk_frames, bars);
+    WorkStealingPool pool(n_jobs);
+
+    Clock::time_point start = Clock::now();
+    for (RenderJob &job : jobs) {
+        pool.submit([&renderer, &job]() { renderer.render(job); });
+    }
+    pool.wait();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    size_t n_ok = 0;
+    size_t total_frames = 0;
+    for (const RenderJob &job : jobs) {
+        if (job.ok) n_ok++;
+        total_frames += job.frames;
+    }
+
+    WorkStealingStatistics pool_stats = pool.statistics();
+    double audio_seconds = static_cast<double>(total_frames) / AUDIO_SAMPLE_RATE;
+
+    printf(
+        "Rendered %zu of %zu patterns in %.2f s on %zu threads: %.1f patterns/s, %.1f s of audio (%.0fx real time), %zu steals\n",
+        n_ok, jobs.size(), seconds, pool.threadCount(), seconds > 0.0 ? n_ok / seconds : 0.0,
+        audio_seconds, seconds > 0.0 ? audio_seconds / seconds : 0.0, pool_stats.steals
+    );
+    renderer.printStatistics();
+
+    return n_ok == jobs.size() ? 0 : 1;
+}
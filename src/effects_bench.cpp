@@ -0,0 +1,147 @@
+// Measures what the per-track effects cost, per track per second of audio, in both places they can run:
+// rendered into a stem (a one-bar loop, including its warm-up passes; paid once per edit) and live in the
+// stream's chunk path (paid continuously while the track plays). Build with `make bench`.
+
+#include <AudioUtils.h>
+#include <DrumMachineTrackData.h>
+#include <DrumRenderEngine.h>
+#include <MasterLimiter.h>
+#include <SwitchingSoundStream.h>
+#include <TrackEffects.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define BENCH_SECONDS 20
+
+typedef DefaultEngineConfig Config;
+typedef std::chrono::steady_clock Clock;
+
+struct BenchCase {
+    const char *name;
+    uint8_t effects;
+};
+
+// A bar of decaying noise bursts on every quarter note, roughly the shape of a drum stem
+Config::Buffer makeStem(const Config::Stats &stats) {
+    Config::Buffer stem(static_cast<size_t>(stats.bar_length_frames) * Config::n_channels, 0);
+    srand(1);
+
+    for (int beat = 0; beat < 4; ++beat) {
+        size_t start = static_cast<size_t>(stats.stepFrame(beat, 4));
+        for (size_t f = 0; f < 8000 && start + f < stem.size() / Config::n_channels; ++f) {
+            float envelope = std::exp(-static_cast<float>(f) / 1500.0f);
+            for (int c = 0; c < Config::n_channels; ++c) {
+                float noise = rand() / static_cast<float>(RAND_MAX) * 2.0f - 1.0f;
+                stem[(start + f) * Config::n_channels + c] = SampleTraits<Config::sample_t>::fromUnit(0.8f * envelope * noise);
+            }
+        }
+    }
+
+    return stem;
+}
+
+Config::Track makeTrack() {
+    Config::Track track;
+    track.effect_params[EFFECT_FILTER_CUTOFF] = 80;
+    track.effect_params[EFFECT_FILTER_RESONANCE] = 60;
+    track.effect_params[EFFECT_DRIVE] = 70;
+    track.effect_params[EFFECT_DELAY_TIME] = 3;
+    track.effect_params[EFFECT_DELAY_FEEDBACK] = 80;
+    track.effect_params[EFFECT_DELAY_MIX] = 50;
+    return track;
+}
+
+// Microseconds per second of audio for processing the stem as a render-time loop
+double benchRenderTime(const Config::Buffer &stem, const EffectSettings &settings) {
+    size_t loop_frames = stem.size() / Config::n_channels;
+    TrackEffectChain<Config::n_channels> chain(settings.delay_frames);
+
+    size_t frames = 0;
+    Clock::time_point start = Clock::now();
+    while (frames < static_cast<size_t>(BENCH_SECONDS) * AUDIO_SAMPLE_RATE) {
+        Config::Buffer processed = chain.processLoop(stem, settings);
+        frames += loop_frames;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    return 1e6 * seconds * AUDIO_SAMPLE_RATE / frames;
+}
+
+// Microseconds per second of audio for processing the stem live, chunk by chunk with the limiter's look-ahead
+double benchLive(const Config::Buffer &stem, const EffectSettings &settings, size_t chunk_frames) {
+    size_t loop_frames = stem.size() / Config::n_channels;
+    size_t lookahead_frames = MasterLimiter<Config::n_channels>::lookaheadFrames();
+    std::vector<float> chunk((chunk_frames + lookahead_frames) * Config::n_channels);
+
+    TrackEffectChain<Config::n_channels> chain;
+    chain.setSettings(settings);
+    chain.reset();
+
+    size_t frames = 0;
+    double seconds = 0.0;
+    while (frames < static_cast<size_t>(BENCH_SECONDS) * AUDIO_SAMPLE_RATE) {
+        // Filling the chunk is the stream's job, so only the chain is timed
+        for (size_t f = 0; f < chunk_frames + lookahead_frames; ++f) {
+            size_t position = (frames + f) % loop_frames;
+            for (int c = 0; c < Config::n_channels; ++c) {
+                chunk[f * Config::n_channels + c] = SampleTraits<Config::sample_t>::toUnit(stem[position * Config::n_channels + c]);
+            }
+        }
+
+        Clock::time_point start = Clock::now();
+        chain.processStream(chunk.data(), chunk_frames, lookahead_frames);
+        seconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+        frames += chunk_frames;
+    }
+
+    return 1e6 * seconds * AUDIO_SAMPLE_RATE / frames;
+}
+
+int main(int argc, char **argv) {
+    size_t chunk_frames = DEFAULT_CHUNK_FRAMES;
+    bpm_t bpm = 120;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--chunk-frames") == 0 && i + 1 < argc) {
+            chunk_frames = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--bpm") == 0 && i + 1 < argc) {
+            bpm = static_cast<bpm_t>(atoi(argv[++i]));
+        } else {
+            fprintf(stderr, "Usage: %s [--chunk-frames N] [--bpm BPM]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (chunk_frames < 1 || bpm < MIN_BPM || bpm > MAX_BPM) {
+        fprintf(stderr, "Error: chunk size must be positive and the tempo %d-%d BPM\n", MIN_BPM, MAX_BPM);
+        return 1;
+    }
+
+    Config::Stats stats = Config::StatsTable::forBPM(bpm);
+    Config::Buffer stem = makeStem(stats);
+    Config::Track track = makeTrack();
+
+    const BenchCase cases[] = {
+        {"filter", 1 << TRACK_EFFECT_FILTER},
+        {"drive", 1 << TRACK_EFFECT_DRIVE},
+        {"delay", 1 << TRACK_EFFECT_DELAY},
+        {"full chain", (1 << TRACK_EFFECT_FILTER) | (1 << TRACK_EFFECT_DRIVE) | (1 << TRACK_EFFECT_DELAY)},
+    };
+
+    printf("Per-track effect cost at %d BPM, %zu-frame chunks (us per track per second of audio, %% of one core)\n", bpm, chunk_frames);
+    printf("%-12s %22s %22s\n", "effect", "render-time (stem)", "live (chunk path)");
+
+    for (const BenchCase &bench : cases) {
+        EffectSettings settings = effectSettings(track, stats, bench.effects);
+        double render_us = benchRenderTime(stem, settings);
+        double live_us = benchLive(stem, settings, chunk_frames);
+
+        printf("%-12s %12.1f (%6.3f%%) %12.1f (%6.3f%%)\n", bench.name, render_us, render_us / 1e4, live_us, live_us / 1e4);
+    }
+
+    return 0;
+}
@@ -0,0 +1,205 @@
+// Host build of the firmware for profiling loop(): src/main.cpp runs unchanged against the Arduino mocks in
+// mock/, driven by a scripted player, and each loop() iteration is measured in simulated Uno cycles and bus
+// bytes (mock/MockBoard.h lists what each call is charged). Build with `make firmware`.
+
+#include "main.cpp"
+
+#include <SerialCapture.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define DEFAULT_PROFILE_LOOPS 20000
+
+// The scripted player opens the instrument page and picks an instrument, then presses a beat button every
+// DEFAULT_PRESS_EVERY_MS and turns the encoder one detent every ENCODER_TURN_EVERY_MS
+#define DEFAULT_PRESS_EVERY_MS 250
+#define PRESS_HOLD_MS 60
+#define MENU_CLICK_MS 80
+#define ENCODER_TURN_EVERY_MS 2000
+#define ENCODER_COUNTS_PER_DETENT 4
+
+typedef std::chrono::steady_clock Clock;
+
+class ScriptedPlayer {
+public:
+    explicit ScriptedPlayer(unsigned long press_every_ms) : press_every_ms(press_every_ms) {}
+
+    // Sets the inputs for the loop() that starts `now_ms` after the first one
+    void step(unsigned long now_ms) {
+        MockBoard &board = MockBoard::instance();
+
+        // Two menu clicks: into the first category, then select its first instrument
+        bool menu_down = (now_ms >= 100 && now_ms < 100 + MENU_CLICK_MS) || (now_ms >= 700 && now_ms < 700 + MENU_CLICK_MS);
+        board.setInput(ENC_SW_PIN, menu_down ? LOW : HIGH);
+
+        if (now_ms < 1500) return;
+        unsigned long t = now_ms - 1500;
+
+        if (press_every_ms > 0) {
+            unsigned long press = t / press_every_ms;
+            uint8_t beat = static_cast<uint8_t>(press % N_TRACK_SUBDIVISIONS);
+            bool down = t % press_every_ms < PRESS_HOLD_MS;
+
+            if (beat != held_beat) board.setShiftRegisterInput(held_beat, false);
+            board.setShiftRegisterInput(beat, down);
+            held_beat = beat;
+        }
+
+        // Down one entry, then back up, so the cursor stays on the page
+        long detents = static_cast<long>(t / ENCODER_TURN_EVERY_MS);
+        board.encoder_position = (detents % 2) * ENCODER_COUNTS_PER_DETENT;
+    }
+
+private:
+    unsigned long press_every_ms;
+    uint8_t held_beat = 0;
+};
+
+struct LoopProfile {
+    std::vector<uint64_t> loop_cycles;
+    MockCounters totals;
+    double host_seconds = 0.0;
+};
+
+uint64_t percentile(const std::vector<uint64_t> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+double cyclesToMs(double cycles) {
+    return cycles * 1000.0 / MOCK_CPU_HZ;
+}
+
+// Splits what the firmware wrote into protocol frames (start byte, type, payload size, payload)
+size_t collectFrames(const std::vector<MockSerialByte> &output, SerialCaptureWriter *capture) {
+    size_t n_frames = 0;
+    size_t i = 0;
+
+    while (i + 2 < output.size()) {
+        if (output[i].value != MSG_START_BYTE) {
+            i++;
+            continue;
+        }
+
+        size_t frame_size = 3 + output[i + 2].value;
+        if (i + frame_size > output.size()) break;
+
+        if (capture) {
+            std::vector<uint8_t> frame;
+            for (size_t j = i; j < i + frame_size; ++j) frame.push_back(output[j].value);
+            capture->writeAt(output[i].cycle / MOCK_CYCLES_PER_US, frame.data(), frame.size());
+        }
+
+        n_frames++;
+        i += frame_size;
+    }
+
+    return n_frames;
+}
+
+int main(int argc, char **argv) {
+    size_t n_loops = DEFAULT_PROFILE_LOOPS;
+    unsigned long press_every_ms = DEFAULT_PRESS_EVERY_MS;
+    const char *capture_path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--loops") == 0 && i + 1 < argc) {
+            n_loops = static_cast<size_t>(atol(argv[++i]));
+        } else if (strcmp(argv[i], "--press-every-ms") == 0 && i + 1 < argc) {
+            press_every_ms = static_cast<unsigned long>(atol(argv[++i]));
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capture_path = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--loops N] [--press-every-ms N] [--capture FILE]" << std::endl;
+            return 1;
+        }
+    }
+
+    MockBoard &board = MockBoard::instance();
+    board.attachShiftRegisters(SR_LATCH_PIN, SR_CLOCK_PIN, SR_DATA_PIN, NUM_SHIFT_REGISTER_BYTES);
+    board.setInput(ENC_SW_PIN, HIGH);
+
+    setup();
+    uint64_t setup_cycles = board.now();
+    MockCounters after_setup = board.totals();
+
+    ScriptedPlayer player(press_every_ms);
+    LoopProfile profile;
+    profile.loop_cycles.reserve(n_loops);
+
+    unsigned long first_loop_ms = millis();
+    for (size_t n = 0; n < n_loops; ++n) {
+        player.step(millis() - first_loop_ms);
+
+        uint64_t before = board.now();
+        Clock::time_point start = Clock::now();
+        loop();
+        profile.host_seconds += std::chrono::duration<double>(Clock::now() - start).count();
+        profile.loop_cycles.push_back(board.now() - before);
+    }
+
+    // Per-loop totals, without setup()
+    const MockCounters &totals = board.totals();
+    for (int c = 0; c < N_MOCK_COSTS; ++c) {
+        profile.totals.cycles[c] = totals.cycles[c] - after_setup.cycles[c];
+    }
+    profile.totals.serial_bytes = totals.serial_bytes - after_setup.serial_bytes;
+    profile.totals.serial_blocked_cycles = totals.serial_blocked_cycles - after_setup.serial_blocked_cycles;
+    profile.totals.i2c_bytes = totals.i2c_bytes - after_setup.i2c_bytes;
+    profile.totals.neopixel_bytes = totals.neopixel_bytes - after_setup.neopixel_bytes;
+    profile.totals.gpio_calls = totals.gpio_calls - after_setup.gpio_calls;
+
+    SerialCaptureWriter capture;
+    if (capture_path && !capture.open(capture_path)) {
+        std::cerr << "Error: cannot write " << capture_path << "\n";
+        return 1;
+    }
+    size_t n_frames = collectFrames(board.serial_output, capture_path ? &capture : nullptr);
+
+    std::vector<uint64_t> sorted = profile.loop_cycles;
+    std::sort(sorted.begin(), sorted.end());
+
+    double loops = static_cast<double>(n_loops);
+    double loop_cycles = profile.totals.totalCycles() / loops;
+    double simulated_seconds = profile.totals.totalCycles() / static_cast<double>(MOCK_CPU_HZ);
+
+    printf("setup(): %.1f ms\n", cyclesToMs(static_cast<double>(setup_cycles)));
+    printf("Simulated %zu loop() iterations, %.2f s on a 16 MHz Uno\n", n_loops, simulated_seconds);
+    printf(
+        "loop(): avg %.0f cycles (%.3f ms), p50 %.3f ms, p99 %.3f ms, max %.3f ms: %.0f button scans/s\n",
+        loop_cycles, cyclesToMs(loop_cycles), cyclesToMs(percentile(sorted, 50.0)), cyclesToMs(percentile(sorted, 99.0)),
+        cyclesToMs(static_cast<double>(sorted.back())), loop_cycles > 0.0 ? MOCK_CPU_HZ / loop_cycles : 0.0
+    );
+
+    static const char *cost_names[N_MOCK_COSTS] = {"GPIO", "delays", "serial", "LCD (I2C)", "NeoPixel", "encoder"};
+    printf("Cycles per loop():");
+    for (int c = 0; c < N_MOCK_COSTS; ++c) {
+        double cycles = profile.totals.cycles[c] / loops;
+        printf(" %s %.0f (%.1f%%)%s", cost_names[c], cycles, loop_cycles > 0.0 ? 100.0 * cycles / loop_cycles : 0.0,
+               c + 1 < N_MOCK_COSTS ? "," : "\n");
+    }
+
+    printf(
+        "Bytes per loop(): serial %.3f, I2C %.1f, NeoPixel %.1f; %.1f pin reads/writes\n",
+        profile.totals.serial_bytes / loops, profile.totals.i2c_bytes / loops, profile.totals.neopixel_bytes / loops,
+        profile.totals.gpio_calls / loops
+    );
+    printf(
+        "Serial: %zu frames, %llu bytes, %.2f ms blocked on a full transmit buffer\n", n_frames,
+        static_cast<unsigned long long>(board.totals().serial_bytes),
+        cyclesToMs(static_cast<double>(profile.totals.serial_blocked_cycles))
+    );
+    printf(
+        "Host time per loop() (firmware code plus mocks, not in the cycle counts): %.2f us\n",
+        1e6 * profile.host_seconds / loops
+    );
+
+    return 0;
+}
@@ -11,9 +11,6 @@
 #include <ShiftRegisterDebounce.h>
 #include <Messaging.h>
 
-// Drum sequence data
-SequenceData sequence_data;
-
 // LCD Parameters/pins
 #define LCD_NUM_ROWS 4
 #define LCD_NUM_COLS 20
@@ -145,6 +142,9 @@ void setup() {
     track_strip.show();  // Initialize all the pixels to 'off' since nothing has been programmed yet
 
     Serial.begin(9600);
+
+    // Let the host start from the firmware's state
+    state.sendSnapshot();
 }
 
 void loop() {
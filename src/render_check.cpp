@@ -0,0 +1,161 @@
+// Checks that the incremental edits of the render engine leave the same samples as rendering from scratch. The
+// instruments are generated here, so no sample files are needed. Build and run with `make check`; exits with
+// status 1 if a check fails.
+
+#include <AudioUtils.h>
+#include <DrumMachineTrackData.h>
+#include <DrumRenderEngine.h>
+#include <RenderCache.h>
+#include <SampleBank.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define CHECK_TOGGLES 50
+
+typedef DefaultEngineConfig Config;
+typedef DrumRenderEngine<Config> Engine;
+
+// A decaying noise burst `n_frames` long peaking near `peak` (full scale = 1.0), roughly the shape of a drum hit
+Config::Buffer makeHit(size_t n_frames, float peak, float decay_frames, unsigned int seed) {
+    Config::Buffer hit(n_frames * Config::n_channels);
+    srand(seed);
+
+    for (size_t f = 0; f < n_frames; ++f) {
+        float envelope = std::exp(-static_cast<float>(f) / decay_frames);
+        for (int c = 0; c < Config::n_channels; ++c) {
+            float noise = rand() / static_cast<float>(RAND_MAX) * 2.0f - 1.0f;
+            hit[f * Config::n_channels + c] = SampleTraits<Config::sample_t>::fromUnit(peak * envelope * noise);
+        }
+    }
+
+    return hit;
+}
+
+// Compares `actual` with `expected` and reports the differing samples under `name`
+bool compareBuffers(const char *name, const Config::Buffer &actual, const Config::Buffer &expected) {
+    size_t n_different = 0;
+    int max_difference = 0;
+
+    for (size_t i = 0; i < std::max(actual.size(), expected.size()); ++i) {
+        int a = i < actual.size() ? actual[i] : 0;
+        int e = i < expected.size() ? expected[i] : 0;
+        if (a == e) continue;
+
+        n_different++;
+        max_difference = std::max(max_difference, std::abs(a - e));
+    }
+
+    if (actual.size() != expected.size() || n_different > 0) {
+        printf("FAIL %s: %zu samples differ (by up to %d LSB), %zu against %zu samples\n", name, n_different,
+               max_difference, actual.size(), expected.size());
+        return false;
+    }
+
+    printf("ok   %s\n", name);
+    return true;
+}
+
+// Toggles a step on and off, and moves another between velocities, CHECK_TOGGLES times each; the stem must end
+// up exactly as a fresh render of the same track
+bool checkRepeatedToggles(SampleBank<Config::sample_t> &bank) {
+    Engine engine(bank);
+    Config::Sequence sequence_data;
+    Config::Track &track = sequence_data.tracks[0];
+
+    for (uint8_t step : {0, 4, 8, 12, 14}) track.toggleTrigger(step);
+    track.setVelocity(4, VELOCITY_ACCENT);
+    engine.setTempo(sequence_data);
+
+    // Quiet enough that no edit can clip, so the stem is edited rather than rendered again
+    Config::Track loudest = track;
+    loudest.toggleTrigger(5);
+    loudest.setVelocity(8, VELOCITY_ACCENT);
+    if (!engine.editIsExact(loudest, loudest)) {
+        printf("FAIL repeated toggles: the track is loud enough to be rendered from scratch\n");
+        return false;
+    }
+
+    for (int i = 0; i < 2 * CHECK_TOGGLES; ++i) {
+        track.toggleTrigger(5);
+        engine.applyStepToggle(track, 0, 5);
+
+        uint8_t old_velocity = track.velocity(8);
+        track.setVelocity(8, static_cast<uint8_t>((old_velocity + 1) % VELOCITY_LEVELS));
+        engine.applyStepVelocity(track, 0, 8, old_velocity);
+    }
+
+    return compareBuffers("step toggled and re-velocitied 100 times matches a fresh render", *engine.track(0),
+                          engine.populateFromTrackData(track));
+}
+
+// A track loud enough to clip, edited through a cache: every stem the cache hands back, including ones for
+// states only ever reached by edits, must be exactly a fresh render
+bool checkClippingEditsThroughCache(SampleBank<Config::sample_t> &bank) {
+    RenderCache<Config> cache(static_cast<size_t>(64) << 20);
+    Engine engine(bank, 120, &cache);
+    Config::Sequence sequence_data;
+    Config::Track &track = sequence_data.tracks[0];
+
+    track.instrument_id = 1;
+    track.volume = 1.0f;
+    for (uint8_t step = 0; step < 16; step += 2) track.toggleTrigger(step);
+    engine.setTempo(sequence_data);
+
+    // Every toggle reaches a state not seen before, so the stems are edited or rendered, never found
+    for (int i = 0; i < CHECK_TOGGLES; ++i) {
+        uint8_t step = static_cast<uint8_t>(1 + 2 * (i % 8));
+        track.toggleTrigger(step);
+        engine.applyStepToggle(track, 0, step);
+
+        if (i % 8 == 7) {
+            uint8_t old_velocity = track.velocity(0);
+            track.setVelocity(0, static_cast<uint8_t>((old_velocity + 1) % VELOCITY_LEVELS));
+            engine.applyStepVelocity(track, 0, 0, old_velocity);
+        }
+    }
+
+    Engine fresh(bank);
+    fresh.setTempo(sequence_data);
+
+    return compareBuffers("clipping stem edited 50 times through the cache matches a fresh render", *engine.track(0),
+                          *fresh.track(0));
+}
+
+// A kick on the last step of a bar shorter than the sample wraps around the bar, onto its own tail more than
+// once; erasing it must leave the bar silent again
+bool checkWrappedTailErase(SampleBank<Config::sample_t> &bank) {
+    Config::Stats stats = Config::Stats::fromBPM(120);
+    const Config::Buffer &kick = bank.get(2);
+    const SampleAnalysis &analysis = bank.analysis(2);
+    float gain = 0.75f * VELOCITY_GAINS[VELOCITY_ACCENT];
+
+    Config::Buffer bar(stats.bar_length_frames * Config::n_channels);
+    int last_step = stats.stepFrame(Config::n_steps - 1);
+    if (kick.size() <= bar.size()) {
+        printf("FAIL wrapped tail: the kick does not outlast the bar\n");
+        return false;
+    }
+
+    mixSample<Config::sample_t, Config::n_channels>(bar, kick, analysis, last_step, gain);
+    unmixSample<Config::sample_t, Config::n_channels>(bar, kick, analysis, last_step, gain);
+
+    return compareBuffers("kick wrapped around a shorter bar erases to silence", bar,
+                          Config::Buffer(bar.size()));
+}
+
+int main() {
+    SampleBank<Config::sample_t> bank;
+    bank.setInstrument(0, makeHit(10000, 0.4f, 4000.0f, 1));
+    bank.setInstrument(1, makeHit(60000, 0.9f, 20000.0f, 2));
+    bank.setInstrument(2, makeHit(200000, 0.25f, 80000.0f, 3));
+
+    bool ok = true;
+    ok &= checkRepeatedToggles(bank);
+    ok &= checkClippingEditsThroughCache(bank);
+    ok &= checkWrappedTailErase(bank);
+
+    return ok ? 0 : 1;
+}
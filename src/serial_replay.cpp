@@ -0,0 +1,217 @@
+// Arduino stand-in for load tests: replays a serial capture (audio_mix --capture-serial) through a
+// pseudo-terminal, which audio_mix opens with --port as if it were the board. Frames go out at their recorded
+// spacing, scaled by --speed, or back to back with --max. Build with `make replay` (no SFML or libserial needed).
+
+#include <SerialCapture.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// How long to wait after audio_mix opens the port before the first frame (it flushes and waits 500 ms for the
+// board to reset on connection)
+#define DEFAULT_SETTLE_MS 1000
+
+#define REPLAY_POLL_MS 100
+
+typedef std::chrono::steady_clock Clock;
+
+class PseudoTerminal {
+public:
+    ~PseudoTerminal() {
+        if (!link_path.empty()) unlink(link_path.c_str());
+        if (master >= 0) ::close(master);
+    }
+
+    // Creates the pair with the follower side in raw mode; `link_path` (if not empty) becomes a symlink to it
+    bool open(const std::string &link_path) {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+            std::cerr << "Error: cannot create a pseudo-terminal: " << strerror(errno) << "\n";
+            return false;
+        }
+
+        const char *name = ptsname(master);
+        if (!name) return false;
+        follower_path = name;
+
+        struct termios settings;
+        if (tcgetattr(master, &settings) == 0) {
+            cfmakeraw(&settings);
+            tcsetattr(master, TCSANOW, &settings);
+        }
+
+        // The master only reports a hang-up once the follower has been opened and closed again
+        int follower = ::open(follower_path.c_str(), O_RDWR | O_NOCTTY);
+        if (follower >= 0) ::close(follower);
+
+        if (!link_path.empty()) {
+            unlink(link_path.c_str());
+            if (symlink(follower_path.c_str(), link_path.c_str()) != 0) {
+                std::cerr << "Error: cannot link " << link_path << ": " << strerror(errno) << "\n";
+                return false;
+            }
+            this->link_path = link_path;
+        }
+
+        return true;
+    }
+
+    const std::string &followerPath() const {
+        return follower_path;
+    }
+
+    // Blocks until something opens the follower side
+    bool waitForReader() {
+        while (true) {
+            struct pollfd fds = {master, POLLIN, 0};
+            if (poll(&fds, 1, REPLAY_POLL_MS) < 0 && errno != EINTR) return false;
+            if (!(fds.revents & POLLHUP)) return true;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(REPLAY_POLL_MS));
+        }
+    }
+
+    // Blocks while the reader's buffer is full
+    bool write(const uint8_t *bytes, size_t n_bytes) {
+        size_t done = 0;
+        while (done < n_bytes) {
+            ssize_t written = ::write(master, bytes + done, n_bytes - done);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            done += static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    // Discards what the reader sends (nothing is expected, but an unread buffer must not fill up); false once
+    // the reader has closed the port
+    bool drainInput() {
+        uint8_t discard[256];
+        struct pollfd fds = {master, POLLIN, 0};
+
+        while (poll(&fds, 1, 0) > 0) {
+            if (fds.revents & POLLHUP) return false;
+            if (!(fds.revents & POLLIN) || read(master, discard, sizeof(discard)) <= 0) break;
+        }
+        return true;
+    }
+
+private:
+    int master = -1;
+    std::string follower_path;
+    std::string link_path;
+};
+
+struct ReplayStatistics {
+    size_t frames = 0;
+    size_t bytes = 0;
+    double seconds = 0.0;
+    double max_late_ms = 0.0;  // Furthest a frame went out behind its scheduled time
+};
+
+int main(int argc, char **argv) {
+    double speed = 1.0;
+    bool max_speed = false;
+    size_t loops = 1;
+    std::string link_path;
+    int settle_ms = DEFAULT_SETTLE_MS;
+    std::string capture_path;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            speed = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max") == 0) {
+            max_speed = true;
+        } else if (strcmp(argv[i], "--loop") == 0 && i + 1 < argc) {
+            loops = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--link") == 0 && i + 1 < argc) {
+            link_path = argv[++i];
+        } else if (strcmp(argv[i], "--settle-ms") == 0 && i + 1 < argc) {
+            settle_ms = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && capture_path.empty()) {
+            capture_path = argv[i];
+        } else {
+            capture_path.clear();
+            break;
+        }
+    }
+
+    if (capture_path.empty() || speed <= 0.0 || loops < 1) {
+        std::cerr << "Usage: " << argv[0] << " [--speed X | --max] [--loop N] [--link PATH] [--settle-ms N] CAPTURE"
+                  << std::endl;
+        return 1;
+    }
+
+    std::vector<CapturedFrame> frames;
+    if (!SerialCaptureWriter::readFile(capture_path, frames)) return 1;
+    if (frames.empty()) {
+        std::cerr << "Error: " << capture_path << " holds no frames\n";
+        return 1;
+    }
+
+    PseudoTerminal pty;
+    if (!pty.open(link_path)) return 1;
+
+    printf(
+        "Replaying %zu frames x %zu from %s on %s%s%s\n", frames.size(), loops, capture_path.c_str(),
+        pty.followerPath().c_str(), link_path.empty() ? "" : " via ", link_path.c_str()
+    );
+    printf("Waiting for a reader (audio_mix --port %s)...\n", link_path.empty() ? pty.followerPath().c_str() : link_path.c_str());
+
+    if (!pty.waitForReader()) return 1;
+    std::this_thread::sleep_for(std::chrono::milliseconds(settle_ms));
+
+    // Leading idle time in the capture is skipped; each loop follows the previous one without a gap
+    uint64_t first_us = frames.front().time_us;
+    uint64_t loop_us = frames.back().time_us - first_us;
+
+    ReplayStatistics stats;
+    Clock::time_point start = Clock::now();
+    bool reader_gone = false;
+
+    for (size_t loop = 0; loop < loops && !reader_gone; ++loop) {
+        for (const CapturedFrame &frame : frames) {
+            if (!max_speed) {
+                double offset_us = static_cast<double>(loop * loop_us + (frame.time_us - first_us)) / speed;
+                Clock::time_point due = start + std::chrono::microseconds(static_cast<int64_t>(offset_us));
+
+                std::this_thread::sleep_until(due);
+                double late_ms = std::chrono::duration<double, std::milli>(Clock::now() - due).count();
+                if (late_ms > stats.max_late_ms) stats.max_late_ms = late_ms;
+            }
+
+            if (!pty.write(frame.bytes.data(), frame.bytes.size()) || !pty.drainInput()) {
+                std::cerr << "Reader closed the port, stopping\n";
+                reader_gone = true;
+                break;
+            }
+
+            stats.frames++;
+            stats.bytes += frame.bytes.size();
+        }
+    }
+
+    stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    printf(
+        "Sent %zu frames (%zu bytes) in %.2f s: %.1f frames/s, max %.2f ms behind schedule\n",
+        stats.frames, stats.bytes, stats.seconds, stats.seconds > 0.0 ? stats.frames / stats.seconds : 0.0,
+        stats.max_late_ms
+    );
+
+    // Give the reader time to take the last frames before the pair goes away
+    std::this_thread::sleep_for(std::chrono::milliseconds(settle_ms));
+
+    return reader_gone ? 1 : 0;
+}